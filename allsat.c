@@ -0,0 +1,148 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "allsat.h"
+#include "circuit.h"
+#include "cnf.h"
+#include "sat.h"
+#include "environment.h"
+#include <stdlib.h>
+#include <string.h>
+
+// True if the variables bound in env already force expr to true
+static bool forces_true(Expression* expr, Environment* env) {
+    Expression* residual = expr->partial_eval(expr, env);
+    bool value;
+    bool forced = expression_is_constant(residual, &value) && value;
+    residual->free(residual);
+    return forced;
+}
+
+// Enumerates the models of expr as cubes. Each model found by the SAT
+// solver is generalised by dropping every variable whose value is not
+// needed for expr to be true, and the cube is then blocked, so the number
+// of solver calls follows the number of cubes rather than the number of
+// models. Partial evaluation drops most variables cheaply, but it does
+// not see that a residual such as A | ~A is true, so each literal it
+// keeps is tested with a second solver holding the encoding without the
+// root asserted: the literal can go if the rest of the cube together with
+// ~expr is unsatisfiable. Returns the number of cubes.
+long long allsat_enumerate(Expression* expr, AllSatCallback emit, void* data) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+
+    Cnf* cnf = cnf_from_circuit(c);
+    int* node_literals = calloc(c->size, sizeof(int));
+    int literal = cnf_encode(cnf, c, root, node_literals);
+    SatSolver* checker = sat_new();
+    sat_reserve_vars(checker, n);
+    sat_add_cnf(checker, cnf, 0);
+    cnf_add_clause(cnf, &literal, 1);
+
+    SatSolver* solver = sat_new();
+    sat_reserve_vars(solver, n);
+    sat_add_cnf(solver, cnf, 0);
+
+    signed char* cube = malloc(n > 0 ? n : 1);
+    int* blocking = malloc(sizeof(int) * (n > 0 ? n : 1));
+    int* assumptions = malloc(sizeof(int) * (n + 1));
+    Environment* env = environment_new();
+    long long cubes = 0;
+
+    while (sat_solve(solver, NULL, 0)) {
+        for (int v = 0; v < n; v++) {
+            cube[v] = sat_model_value(solver, v + 1);
+            environment_set(env, c->vars[v], cube[v]);
+        }
+        for (int v = 0; v < n; v++) {
+            environment_unset(env, c->vars[v]);
+            if (forces_true(expr, env)) {
+                cube[v] = -1;
+            } else {
+                environment_set(env, c->vars[v], cube[v]);
+            }
+        }
+        for (int v = 0; v < n; v++) {
+            if (cube[v] < 0) continue;
+            int size = 0;
+            for (int u = 0; u < n; u++) {
+                if (u != v && cube[u] >= 0) assumptions[size++] = cube[u] ? u + 1 : -(u + 1);
+            }
+            assumptions[size++] = -literal;
+            if (!sat_solve(checker, assumptions, size)) {
+                cube[v] = -1;
+                environment_unset(env, c->vars[v]);
+            }
+        }
+
+        emit(c->vars, cube, n, data);
+        cubes++;
+
+        int size = 0;
+        for (int v = 0; v < n; v++) {
+            if (cube[v] >= 0) {
+                blocking[size++] = cube[v] ? -(v + 1) : v + 1;
+                environment_unset(env, c->vars[v]);
+            }
+        }
+        // An empty cube means the expression is valid and nothing is left
+        if (!sat_add_clause(solver, blocking, size)) break;
+    }
+
+    environment_free(env);
+    free(assumptions);
+    free(blocking);
+    free(cube);
+    sat_free(solver);
+    sat_free(checker);
+    free(node_literals);
+    cnf_free(cnf);
+    circuit_free(c);
+    return cubes;
+}
+
+static void print_header(char** names, int var_count, FILE* out) {
+    for (int v = 0; v < var_count; v++) {
+        fprintf(out, "%s ", names[v]);
+    }
+    fprintf(out, "\n");
+}
+
+typedef struct {
+    FILE* out;
+    bool header_printed;
+} PrintState;
+
+// Cells line up with the header like the rows of a truth table, with '-'
+// for variables that do not matter
+static void print_cube(char** names, const signed char* cube, int var_count, void* data) {
+    PrintState* state = data;
+    if (!state->header_printed) {
+        print_header(names, var_count, state->out);
+        state->header_printed = true;
+    }
+    for (int v = 0; v < var_count; v++) {
+        fputc(cube[v] < 0 ? '-' : cube[v] ? 'T' : 'F', state->out);
+        for (size_t i = 0; i < strlen(names[v]); i++) {
+            fputc(' ', state->out);
+        }
+    }
+    fputc('\n', state->out);
+    fflush(state->out);
+}
+
+long long allsat_print(Expression* expr, FILE* out) {
+    PrintState state = { out, false };
+    long long cubes = allsat_enumerate(expr, print_cube, &state);
+    if (cubes == 0) {
+        fprintf(out, "Unsatisfiable\n");
+    } else {
+        fprintf(out, "%lld cube%s\n", cubes, cubes == 1 ? "" : "s");
+    }
+    return cubes;
+}
@@ -0,0 +1,21 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef ALLSAT_H
+#define ALLSAT_H
+
+#include "ast.h"
+#include <stdio.h>
+
+// Receives one cube: cube[v] is 1 or 0 if variable names[v] is fixed to
+// true or false, and -1 if it does not matter
+typedef void (*AllSatCallback)(char** names, const signed char* cube, int var_count, void* data);
+
+long long allsat_enumerate(Expression* expr, AllSatCallback emit, void* data);
+long long allsat_print(Expression* expr, FILE* out);
+
+#endif
@@ -0,0 +1,186 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "anf.h"
+#include "circuit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Words of the truth table simulated together per pass over the circuit
+#define BLOCK_WORDS 64
+
+// Bit p of masks[i] is bit i of p: the value of variable i in row p of a
+// 64-row word, and the rows whose monomials contain variable i
+static const uint64_t masks[6] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+};
+
+// Row p of the table is the assignment in which variable v has the value
+// of bit v of p. Variables 0 to 5 vary within a word and the rest from
+// word to word, so each word is one 64-row slice and a block of words is
+// simulated with one pass over the circuit.
+static void fill_truth_table(Circuit* c, int root, uint64_t* table, size_t words) {
+    size_t block = words < BLOCK_WORDS ? words : BLOCK_WORDS;
+    uint64_t* values = malloc(sizeof(uint64_t) * block * c->size);
+
+    for (size_t base = 0; base < words; base += block) {
+        for (int i = 0; i < c->size; i++) {
+            CircuitNode* node = &c->nodes[i];
+            uint64_t* out = values + (size_t)i * block;
+            // For constants and variables a is a value, not an operand
+            uint64_t* a = values + (size_t)(node->op >= CIRCUIT_NOT ? node->a : 0) * block;
+            uint64_t* b = values + (size_t)node->b * block;
+            switch (node->op) {
+                case CIRCUIT_CONST:
+                    for (size_t j = 0; j < block; j++) out[j] = node->a ? ~0ULL : 0;
+                    break;
+                case CIRCUIT_VAR:
+                    for (size_t j = 0; j < block; j++) {
+                        out[j] = node->a < 6 ? masks[node->a]
+                               : ((base + j) >> (node->a - 6)) & 1 ? ~0ULL : 0;
+                    }
+                    break;
+                case CIRCUIT_NOT:
+                    for (size_t j = 0; j < block; j++) out[j] = ~a[j];
+                    break;
+                case CIRCUIT_AND:
+                    for (size_t j = 0; j < block; j++) out[j] = a[j] & b[j];
+                    break;
+                case CIRCUIT_OR:
+                    for (size_t j = 0; j < block; j++) out[j] = a[j] | b[j];
+                    break;
+                case CIRCUIT_XOR:
+                    for (size_t j = 0; j < block; j++) out[j] = a[j] ^ b[j];
+                    break;
+                case CIRCUIT_IMPLIES:
+                    for (size_t j = 0; j < block; j++) out[j] = ~a[j] | b[j];
+                    break;
+                case CIRCUIT_IFF:
+                    for (size_t j = 0; j < block; j++) out[j] = ~(a[j] ^ b[j]);
+                    break;
+            }
+        }
+        memcpy(table + base, values + (size_t)root * block, sizeof(uint64_t) * block);
+    }
+    free(values);
+}
+
+// In-place fast Möbius transform over GF(2): afterwards bit m is the XOR
+// of the original bits of every subset of m. Variables within a word take
+// one shift and mask each; every other variable XORs the lower half of
+// each pair of word ranges into the upper half.
+static void mobius_transform(uint64_t* table, size_t words, int var_count) {
+    int inner = var_count < 6 ? var_count : 6;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t x = table[w];
+        for (int i = 0; i < inner; i++) {
+            x ^= (x << (1 << i)) & masks[i];
+        }
+        table[w] = x;
+    }
+
+    for (size_t stride = 1; stride < words; stride <<= 1) {
+        for (size_t base = 0; base < words; base += 2 * stride) {
+            uint64_t* low = table + base;
+            uint64_t* high = low + stride;
+            for (size_t j = 0; j < stride; j++) {
+                high[j] ^= low[j];
+            }
+        }
+    }
+}
+
+// Returns NULL when expr has more than ANF_MAX_VARS variables
+Anf* anf_compute(Expression* expr) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+    if (n > ANF_MAX_VARS) {
+        circuit_free(c);
+        return NULL;
+    }
+
+    Anf* anf = malloc(sizeof(Anf));
+    anf->var_count = n;
+    anf->vars = malloc(sizeof(char*) * (n > 0 ? n : 1));
+    for (int v = 0; v < n; v++) {
+        anf->vars[v] = strdup(c->vars[v]);
+    }
+    anf->words = n > 6 ? (size_t)1 << (n - 6) : 1;
+    anf->coefficients = malloc(sizeof(uint64_t) * anf->words);
+
+    fill_truth_table(c, root, anf->coefficients, anf->words);
+    circuit_free(c);
+    if (n < 6) {
+        // Rows past 2^n repeat the pattern of a sixth variable that does
+        // not exist
+        anf->coefficients[0] &= (1ULL << (1 << n)) - 1;
+    }
+    mobius_transform(anf->coefficients, anf->words, n);
+
+    anf->term_count = 0;
+    anf->degree = 0;
+    for (size_t w = 0; w < anf->words; w++) {
+        uint64_t word = anf->coefficients[w];
+        anf->term_count += __builtin_popcountll(word);
+        while (word) {
+            uint64_t monomial = w * 64 + __builtin_ctzll(word);
+            int degree = __builtin_popcountll(monomial);
+            if (degree > anf->degree) anf->degree = degree;
+            word &= word - 1;
+        }
+    }
+    return anf;
+}
+
+static Expression* monomial_expression(Anf* anf, uint64_t monomial) {
+    Expression* term = NULL;
+    for (int v = 0; v < anf->var_count; v++) {
+        if (!((monomial >> v) & 1)) continue;
+        Expression* ident = new_identifier(token_new(T_IDENT, anf->vars[v]), anf->vars[v]);
+        term = term ? new_infix(token_new(T_AND, "&"), term, "&", ident) : ident;
+    }
+    return term ? term : new_boolean(token_new(T_TRUE, "true"), true);
+}
+
+// Terms are combined as a balanced XOR tree so a polynomial with many
+// terms does not nest deeply
+static Expression* xor_terms(Expression** terms, long long count) {
+    if (count == 1) return terms[0];
+    long long half = count / 2;
+    Expression* left = xor_terms(terms, half);
+    Expression* right = xor_terms(terms + half, count - half);
+    return new_infix(token_new(T_XOR, "^"), left, "^", right);
+}
+
+Expression* anf_to_expression(Anf* anf) {
+    if (anf->term_count == 0) {
+        return new_boolean(token_new(T_FALSE, "false"), false);
+    }
+
+    Expression** terms = malloc(sizeof(Expression*) * anf->term_count);
+    long long count = 0;
+    for (size_t w = 0; w < anf->words; w++) {
+        for (uint64_t word = anf->coefficients[w]; word; word &= word - 1) {
+            terms[count++] = monomial_expression(anf, w * 64 + __builtin_ctzll(word));
+        }
+    }
+    Expression* result = xor_terms(terms, count);
+    free(terms);
+    return result;
+}
+
+void anf_free(Anf* anf) {
+    if (!anf) return;
+    for (int v = 0; v < anf->var_count; v++) {
+        free(anf->vars[v]);
+    }
+    free(anf->vars);
+    free(anf->coefficients);
+    free(anf);
+}
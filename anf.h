@@ -0,0 +1,34 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef ANF_H
+#define ANF_H
+
+#include "ast.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ANF_MAX_VARS 30
+
+// The algebraic normal form (Zhegalkin polynomial) of an expression: an
+// XOR of ANDs of variables, unique for each Boolean function. Monomial m
+// is the AND of the variables whose bits are set in m, and the empty
+// monomial is the constant true.
+typedef struct {
+    char** vars;
+    int var_count;
+    uint64_t* coefficients;  // Bit m (word m / 64) is set when monomial m is present
+    size_t words;
+    long long term_count;
+    int degree;  // Size of the largest monomial, 0 for a constant
+} Anf;
+
+Anf* anf_compute(Expression* expr);
+Expression* anf_to_expression(Anf* anf);
+void anf_free(Anf* anf);
+
+#endif
@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#define ADAPTIVE_PERIOD 1024
 
 char* string_concat(const char* s1, const char* s2) {
     size_t len1 = strlen(s1);
@@ -20,6 +23,7 @@ char* string_concat(const char* s1, const char* s2) {
     return result;
 }
 
+// See Expression.eval: reaching an unbound variable here is a caller error
 bool eval_identifier(Expression* expr, Environment* env) {
     IdentifierExpression* ident = (IdentifierExpression*)expr->node;
     bool value;
@@ -31,6 +35,7 @@ bool eval_identifier(Expression* expr, Environment* env) {
 }
 
 bool eval_boolean(Expression* expr, Environment* env) {
+    (void)env;
     BooleanExpression* boolean = (BooleanExpression*)expr->node;
     return boolean->value;
 }
@@ -41,21 +46,498 @@ bool eval_prefix(Expression* expr, Environment* env) {
     return !right;  // Only NOT operator is supported as prefix
 }
 
+// Read from the node, so adaptive evaluation can weigh operands without
+// walking them
+int expression_size(Expression* expr) {
+    return expr->size;
+}
+
+// Every ADAPTIVE_PERIOD evaluations of a commutative node, compare the
+// expected cost of evaluating each side first (its size, plus the size of
+// the other side weighted by how often the first side fails to decide)
+// and swap the operands if the other order is cheaper.
+static void adapt_infix(InfixExpression* infix) {
+    double left_cost = expression_size(infix->left);
+    double right_cost = expression_size(infix->right);
+    unsigned long right_evaluations = infix->evaluations - infix->left_decided;
+    double p_left = (double)infix->left_decided / infix->evaluations;
+    double p_right = right_evaluations
+        ? (double)infix->right_decided / right_evaluations : 0.0;
+
+    double left_first = left_cost + (1.0 - p_left) * right_cost;
+    double right_first = right_cost + (1.0 - p_right) * left_cost;
+    if (right_first < left_first) {
+        Expression* tmp = infix->left;
+        infix->left = infix->right;
+        infix->right = tmp;
+    }
+    infix->evaluations = 0;
+    infix->left_decided = 0;
+    infix->right_decided = 0;
+}
+
+// & and | are evaluated with short-circuit semantics, as is -> on a false
+// antecedent. The operator is taken from the token type rather than
+// compared as a string since this is the hottest path in the interpreter.
+// Profile counters are only kept while environment_adaptive_eval holds.
 bool eval_infix(Expression* expr, Environment* env) {
     InfixExpression* infix = (InfixExpression*)expr->node;
     bool left = infix->left->eval(infix->left, env);
-    bool right = infix->right->eval(infix->right, env);
+    bool right;
 
-    if (strcmp(infix->operator, "&") == 0) return left && right;
-    if (strcmp(infix->operator, "|") == 0) return left || right;
-    if (strcmp(infix->operator, "^") == 0) return left != right;
-    if (strcmp(infix->operator, "->") == 0) return !left || right;
-    if (strcmp(infix->operator, "<->") == 0) return left == right;
+    switch (infix->token->type) {
+        case T_AND:
+        case T_OR: {
+            bool controlling = infix->token->type == T_OR;
+            if (!environment_adaptive_eval(env)) {
+                if (left == controlling) return controlling;
+                return infix->right->eval(infix->right, env);
+            }
+            bool result;
+            if (left == controlling) {
+                infix->left_decided++;
+                result = controlling;
+            } else {
+                right = infix->right->eval(infix->right, env);
+                if (right == controlling) infix->right_decided++;
+                result = right;
+            }
+            if (++infix->evaluations >= ADAPTIVE_PERIOD) {
+                adapt_infix(infix);
+            }
+            return result;
+        }
+        case T_IMPLIES:
+            if (!left) return true;
+            return infix->right->eval(infix->right, env);
+        case T_XOR:
+            right = infix->right->eval(infix->right, env);
+            return left != right;
+        case T_IFF:
+            right = infix->right->eval(infix->right, env);
+            return left == right;
+        default:
+            break;
+    }
 
     fprintf(stderr, "unknown operator: %s\n", infix->operator);
     exit(1);
 }
 
+// The n-ary form of adapt_infix: operands are ordered by their size
+// divided by how often they decide the result when reached (smoothed so
+// an operand never reached is not ruled out), so cheap, decisive
+// operands are evaluated first.
+static void adapt_nary(NaryExpression* nary) {
+    double* scores = malloc(sizeof(double) * nary->count);
+    for (int i = 0; i < nary->count; i++) {
+        scores[i] = expression_size(nary->operands[i]) *
+                    (nary->reached[i] + 2.0) / (nary->decided[i] + 1.0);
+    }
+    for (int i = 1; i < nary->count; i++) {
+        Expression* operand = nary->operands[i];
+        double score = scores[i];
+        int j = i;
+        for (; j > 0 && scores[j - 1] > score; j--) {
+            nary->operands[j] = nary->operands[j - 1];
+            scores[j] = scores[j - 1];
+        }
+        nary->operands[j] = operand;
+        scores[j] = score;
+    }
+    free(scores);
+    nary->evaluations = 0;
+    memset(nary->reached, 0, sizeof(unsigned long) * nary->count);
+    memset(nary->decided, 0, sizeof(unsigned long) * nary->count);
+}
+
+// Whether a cardinality constraint is decided once count operands are
+// known to be true and remaining operands are still unknown
+bool cardinality_decided(TokenType op, int k, int count, int remaining, bool* value) {
+    switch (op) {
+        case T_ATMOST:
+            if (count > k || count + remaining <= k) {
+                *value = count <= k;
+                return true;
+            }
+            return false;
+        case T_ATLEAST:
+            if (count >= k || count + remaining < k) {
+                *value = count >= k;
+                return true;
+            }
+            return false;
+        case T_EXACTLY:
+            if (count > k || count + remaining < k || remaining == 0) {
+                *value = count == k && remaining == 0;
+                return true;
+            }
+            return false;
+        default:
+            *value = false;
+            return false;
+    }
+}
+
+// & and | stop at the first operand that decides the result. Cardinality
+// operands are packed 64 to a word and counted with popcount, and the
+// count is checked after each word so a decided constraint stops early.
+bool eval_nary(Expression* expr, Environment* env) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    TokenType op = nary->token->type;
+
+    if (op == T_AND || op == T_OR) {
+        bool controlling = op == T_OR;
+        bool result = !controlling;
+        if (!environment_adaptive_eval(env)) {
+            for (int i = 0; i < nary->count; i++) {
+                Expression* operand = nary->operands[i];
+                if (operand->eval(operand, env) == controlling) return controlling;
+            }
+            return result;
+        }
+        for (int i = 0; i < nary->count; i++) {
+            Expression* operand = nary->operands[i];
+            nary->reached[i]++;
+            if (operand->eval(operand, env) == controlling) {
+                nary->decided[i]++;
+                result = controlling;
+                break;
+            }
+        }
+        if (++nary->evaluations >= ADAPTIVE_PERIOD) {
+            adapt_nary(nary);
+        }
+        return result;
+    }
+
+    int count = 0;
+    bool value = false;
+    for (int base = 0; base < nary->count; base += 64) {
+        int end = nary->count - base < 64 ? nary->count : base + 64;
+        uint64_t word = 0;
+        for (int i = base; i < end; i++) {
+            Expression* operand = nary->operands[i];
+            word |= (uint64_t)operand->eval(operand, env) << (i - base);
+        }
+        count += __builtin_popcountll(word);
+        if (cardinality_decided(op, nary->k, count, nary->count - end, &value)) break;
+    }
+    return value;
+}
+
+// Expands the quantified variables from index onwards by trying both
+// values, restoring whatever binding the variable had outside the scope.
+// This is exponential in the number of variables; see qbf.c for the
+// memoised evaluator used by the REPL.
+static bool expand_quantifier(QuantifierExpression* quantifier, int index, Environment* env) {
+    if (index == quantifier->var_count) {
+        return quantifier->body->eval(quantifier->body, env);
+    }
+
+    const char* var = quantifier->vars[index];
+    bool outer;
+    bool bound = environment_get(env, var, &outer);
+    bool universal = quantifier->token->type == T_FORALL;
+
+    environment_set(env, var, true);
+    bool result = expand_quantifier(quantifier, index + 1, env);
+    // A false branch decides forall and a true branch decides exists
+    if (result == universal) {
+        environment_set(env, var, false);
+        result = expand_quantifier(quantifier, index + 1, env);
+    }
+
+    if (bound) {
+        environment_set(env, var, outer);
+    } else {
+        environment_unset(env, var);
+    }
+    return result;
+}
+
+bool eval_quantifier(Expression* expr, Environment* env) {
+    return expand_quantifier((QuantifierExpression*)expr->node, 0, env);
+}
+
+// Partial evaluation returns a new expression in which every bound
+// variable has been replaced by its value and constants have been folded
+// away. The result is a Boolean literal when env determines the value,
+// and otherwise a residual expression over the unbound variables only.
+
+bool expression_is_constant(Expression* expr, bool* value) {
+    if (expr->type != EXPR_BOOLEAN) return false;
+    *value = ((BooleanExpression*)expr->node)->value;
+    return true;
+}
+
+static Expression* make_boolean(bool value) {
+    return new_boolean(token_new(value ? T_TRUE : T_FALSE, value ? "true" : "false"), value);
+}
+
+static Expression* make_not(Expression* right) {
+    bool value;
+    if (expression_is_constant(right, &value)) {
+        right->free(right);
+        return make_boolean(!value);
+    }
+    if (right->type == EXPR_PREFIX) {
+        PrefixExpression* prefix = (PrefixExpression*)right->node;
+        Expression* inner = prefix->right;
+        prefix->right = new_boolean(NULL, false);  // Detach before freeing
+        right->free(right);
+        return inner;
+    }
+    return new_prefix(token_new(T_NOT, "~"), "~", right);
+}
+
+Expression* partial_eval_identifier(Expression* expr, Environment* env) {
+    IdentifierExpression* ident = (IdentifierExpression*)expr->node;
+    bool value;
+    if (environment_get(env, ident->value, &value)) {
+        return make_boolean(value);
+    }
+    return new_identifier(token_new(ident->token->type, ident->token->literal), ident->value);
+}
+
+Expression* partial_eval_boolean(Expression* expr, Environment* env) {
+    (void)env;
+    BooleanExpression* boolean = (BooleanExpression*)expr->node;
+    return make_boolean(boolean->value);
+}
+
+Expression* partial_eval_prefix(Expression* expr, Environment* env) {
+    PrefixExpression* prefix = (PrefixExpression*)expr->node;
+    return make_not(prefix->right->partial_eval(prefix->right, env));
+}
+
+// Simplifies "constant op other" (or "other op constant" when
+// constant_on_left is false), taking ownership of other.
+static Expression* fold_infix(TokenType op, bool constant, bool constant_on_left, Expression* other) {
+    switch (op) {
+        case T_AND:
+            if (!constant) break;
+            return other;
+        case T_OR:
+            if (constant) break;
+            return other;
+        case T_XOR:
+            return constant ? make_not(other) : other;
+        case T_IFF:
+            return constant ? other : make_not(other);
+        case T_IMPLIES:
+            if (constant_on_left) {
+                if (!constant) break;
+                return other;
+            }
+            if (constant) break;
+            return make_not(other);
+        default:
+            return other;
+    }
+    // The constant decides the result on its own
+    other->free(other);
+    return make_boolean(op == T_AND ? false : true);
+}
+
+Expression* partial_eval_infix(Expression* expr, Environment* env) {
+    InfixExpression* infix = (InfixExpression*)expr->node;
+    TokenType op = infix->token->type;
+    Expression* left = infix->left->partial_eval(infix->left, env);
+    bool left_value, right_value;
+
+    // Short-circuit before the right operand is even specialised
+    if (expression_is_constant(left, &left_value) &&
+        ((op == T_AND && !left_value) || (op == T_OR && left_value) ||
+         (op == T_IMPLIES && !left_value))) {
+        left->free(left);
+        return make_boolean(op != T_AND);
+    }
+
+    Expression* right = infix->right->partial_eval(infix->right, env);
+
+    if (expression_is_constant(left, &left_value)) {
+        left->free(left);
+        return fold_infix(op, left_value, true, right);
+    }
+    if (expression_is_constant(right, &right_value)) {
+        right->free(right);
+        return fold_infix(op, right_value, false, left);
+    }
+
+    return new_infix(token_new(op, infix->token->literal), left, infix->operator, right);
+}
+
+static const char* operator_literal(TokenType op) {
+    switch (op) {
+        case T_AND: return "&";
+        case T_OR: return "|";
+        case T_ATMOST: return "ATMOST";
+        case T_ATLEAST: return "ATLEAST";
+        default: return "EXACTLY";
+    }
+}
+
+// Joins operands (taking ownership of each) with & or |, using the
+// binary form for two and the n-ary form for more
+static Expression* make_chain(TokenType op, Expression** operands, int count) {
+    const char* literal = operator_literal(op);
+    if (count == 0) return make_boolean(op == T_AND);
+    if (count == 1) return operands[0];
+    if (count == 2) return new_infix(token_new(op, literal), operands[0], literal, operands[1]);
+    return new_nary(token_new(op, literal), literal, 0, operands, count);
+}
+
+// Rewrites constraints that are plain conjunctions or disjunctions in
+// disguise; k is strictly between the trivial bounds
+static Expression* make_cardinality(TokenType op, int k, Expression** operands, int count) {
+    if ((op == T_ATLEAST || op == T_EXACTLY) && k == count) {
+        return make_chain(T_AND, operands, count);
+    }
+    if (op == T_ATLEAST && k == 1) {
+        return make_chain(T_OR, operands, count);
+    }
+    if ((op == T_ATMOST || op == T_EXACTLY) && k == 0) {
+        return make_not(make_chain(T_OR, operands, count));
+    }
+    if (op == T_ATMOST && k == count - 1) {
+        return make_not(make_chain(T_AND, operands, count));
+    }
+    const char* literal = operator_literal(op);
+    return new_nary(token_new(op, literal), literal, k, operands, count);
+}
+
+// Constant operands are folded away: they decide & and |, or lower the
+// bound of a cardinality constraint, which may then be decided as well
+Expression* partial_eval_nary(Expression* expr, Environment* env) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    TokenType op = nary->token->type;
+    bool cardinality = op != T_AND && op != T_OR;
+    Expression** residuals = malloc(sizeof(Expression*) * nary->count);
+    int count = 0;
+    int trues = 0;
+    bool value;
+
+    for (int i = 0; i < nary->count; i++) {
+        Expression* residual = nary->operands[i]->partial_eval(nary->operands[i], env);
+        bool decided = false;
+        if (!expression_is_constant(residual, &value)) {
+            residuals[count++] = residual;
+        } else {
+            residual->free(residual);
+            if (cardinality) {
+                trues += value;
+            } else {
+                decided = value == (op == T_OR);
+            }
+        }
+        if (cardinality) {
+            decided = cardinality_decided(op, nary->k, trues, count + nary->count - i - 1, &value);
+        }
+        if (decided) {
+            for (int j = 0; j < count; j++) {
+                residuals[j]->free(residuals[j]);
+            }
+            free(residuals);
+            return make_boolean(value);
+        }
+    }
+
+    Expression* result = cardinality ? make_cardinality(op, nary->k - trues, residuals, count)
+                                     : make_chain(op, residuals, count);
+    free(residuals);
+    return result;
+}
+
+static bool mentions(Expression* expr, const char* var) {
+    switch (expr->type) {
+        case EXPR_IDENTIFIER:
+            return strcmp(((IdentifierExpression*)expr->node)->value, var) == 0;
+        case EXPR_PREFIX:
+            return mentions(((PrefixExpression*)expr->node)->right, var);
+        case EXPR_INFIX: {
+            InfixExpression* infix = (InfixExpression*)expr->node;
+            return mentions(infix->left, var) || mentions(infix->right, var);
+        }
+        case EXPR_QUANTIFIER: {
+            QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+            for (int i = 0; i < quantifier->var_count; i++) {
+                if (strcmp(quantifier->vars[i], var) == 0) return false;
+            }
+            return mentions(quantifier->body, var);
+        }
+        case EXPR_NARY: {
+            NaryExpression* nary = (NaryExpression*)expr->node;
+            for (int i = 0; i < nary->count; i++) {
+                if (mentions(nary->operands[i], var)) return true;
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+static Expression* cofactor(Expression* expr, const char* var, bool value) {
+    Environment* env = environment_new();
+    environment_set(env, var, value);
+    Expression* result = expr->partial_eval(expr, env);
+    environment_free(env);
+    return result;
+}
+
+// Eliminates one quantified variable from a residual (taking ownership of
+// it) by Shannon expansion: forall X . f is f[X:=true] & f[X:=false]
+static Expression* eliminate(Expression* residual, const char* var, bool universal) {
+    if (!mentions(residual, var)) return residual;
+
+    TokenType op = universal ? T_AND : T_OR;
+    Expression* positive = cofactor(residual, var, true);
+    bool value;
+    if (expression_is_constant(positive, &value) && value != universal) {
+        residual->free(residual);
+        return positive;
+    }
+    Expression* negative = cofactor(residual, var, false);
+    residual->free(residual);
+
+    if (expression_is_constant(positive, &value)) {
+        positive->free(positive);
+        return fold_infix(op, value, true, negative);
+    }
+    if (expression_is_constant(negative, &value)) {
+        negative->free(negative);
+        return fold_infix(op, value, false, positive);
+    }
+    return new_infix(token_new(op, universal ? "&" : "|"), positive, universal ? "&" : "|", negative);
+}
+
+// Quantified variables shadow any outer binding, so they are unbound
+// while the body is specialised and then eliminated innermost first
+Expression* partial_eval_quantifier(Expression* expr, Environment* env) {
+    QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+    bool* bound = malloc(sizeof(bool) * quantifier->var_count);
+    bool* outer = malloc(sizeof(bool) * quantifier->var_count);
+    for (int i = 0; i < quantifier->var_count; i++) {
+        bound[i] = environment_get(env, quantifier->vars[i], &outer[i]);
+        if (bound[i]) environment_unset(env, quantifier->vars[i]);
+    }
+
+    Expression* residual = quantifier->body->partial_eval(quantifier->body, env);
+
+    for (int i = 0; i < quantifier->var_count; i++) {
+        if (bound[i]) environment_set(env, quantifier->vars[i], outer[i]);
+    }
+    free(bound);
+    free(outer);
+
+    bool universal = quantifier->token->type == T_FORALL;
+    for (int i = quantifier->var_count - 1; i >= 0; i--) {
+        residual = eliminate(residual, quantifier->vars[i], universal);
+    }
+    return residual;
+}
+
 char* string_identifier(Expression* expr) {
     IdentifierExpression* ident = (IdentifierExpression*)expr->node;
     return strdup(ident->value);
@@ -86,6 +568,60 @@ char* string_infix(Expression* expr) {
     return result;
 }
 
+char* string_quantifier(Expression* expr) {
+    QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+    char* body_str = quantifier->body->string(quantifier->body);
+    size_t length = strlen(quantifier->token->literal) + strlen(body_str) + 8;
+    for (int i = 0; i < quantifier->var_count; i++) {
+        length += strlen(quantifier->vars[i]) + 1;
+    }
+
+    char* result = malloc(length);
+    sprintf(result, "(%s", quantifier->token->literal);
+    for (int i = 0; i < quantifier->var_count; i++) {
+        strcat(result, " ");
+        strcat(result, quantifier->vars[i]);
+    }
+    strcat(result, " . ");
+    strcat(result, body_str);
+    strcat(result, ")");
+    free(body_str);
+    return result;
+}
+
+// (A & B & C) for chains and ATMOST(2, A, B, C) for cardinality
+char* string_nary(Expression* expr) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    bool cardinality = nary->token->type != T_AND && nary->token->type != T_OR;
+    char** operand_strs = malloc(sizeof(char*) * nary->count);
+    size_t length = strlen(nary->operator) + 32;
+    for (int i = 0; i < nary->count; i++) {
+        operand_strs[i] = nary->operands[i]->string(nary->operands[i]);
+        length += strlen(operand_strs[i]) + strlen(nary->operator) + 3;
+    }
+
+    char* result = malloc(length);
+    if (cardinality) {
+        sprintf(result, "%s(%d", nary->operator, nary->k);
+    } else {
+        strcpy(result, "(");
+    }
+    for (int i = 0; i < nary->count; i++) {
+        if (cardinality) {
+            strcat(result, ", ");
+        } else if (i > 0) {
+            strcat(result, " ");
+            strcat(result, nary->operator);
+            strcat(result, " ");
+        }
+        strcat(result, operand_strs[i]);
+        free(operand_strs[i]);
+    }
+    strcat(result, ")");
+    free(operand_strs);
+    return result;
+}
+
 // Pretty print functions
 char* pretty_print_identifier(Expression* expr, const char* indent) {
     IdentifierExpression* ident = (IdentifierExpression*)expr->node;
@@ -132,6 +668,62 @@ char* pretty_print_infix(Expression* expr, const char* indent) {
     return result;
 }
 
+char* pretty_print_quantifier(Expression* expr, const char* indent) {
+    QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+    char* new_indent = string_concat(indent, "    ");
+    char* body_str = quantifier->body->pretty_print(quantifier->body, new_indent);
+
+    size_t vars_length = 1;
+    for (int i = 0; i < quantifier->var_count; i++) {
+        vars_length += strlen(quantifier->vars[i]) + 1;
+    }
+    char* vars = malloc(vars_length);
+    vars[0] = '\0';
+    for (int i = 0; i < quantifier->var_count; i++) {
+        if (i > 0) strcat(vars, " ");
+        strcat(vars, quantifier->vars[i]);
+    }
+
+    char* result = malloc(4 * strlen(indent) + strlen(quantifier->token->literal) +
+                          vars_length + strlen(body_str) + 100);
+    sprintf(result, "%sQuantifier[\n%s  Operator: %s\n%s  Variables: %s\n%s  Body:\n%s\n%s]",
+            indent, indent, quantifier->token->literal, indent, vars, indent, body_str, indent);
+
+    free(vars);
+    free(new_indent);
+    free(body_str);
+    return result;
+}
+
+char* pretty_print_nary(Expression* expr, const char* indent) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    char* new_indent = string_concat(indent, "    ");
+    char** operand_strs = malloc(sizeof(char*) * nary->count);
+    size_t length = 4 * strlen(indent) + strlen(nary->operator) + 100;
+    for (int i = 0; i < nary->count; i++) {
+        operand_strs[i] = nary->operands[i]->pretty_print(nary->operands[i], new_indent);
+        length += strlen(operand_strs[i]) + 1;
+    }
+
+    char* result = malloc(length);
+    if (nary->token->type == T_AND || nary->token->type == T_OR) {
+        sprintf(result, "%sNary[\n%s  Operator: %s\n%s  Operands:", indent, indent, nary->operator, indent);
+    } else {
+        sprintf(result, "%sNary[\n%s  Operator: %s %d\n%s  Operands:",
+                indent, indent, nary->operator, nary->k, indent);
+    }
+    for (int i = 0; i < nary->count; i++) {
+        strcat(result, "\n");
+        strcat(result, operand_strs[i]);
+        free(operand_strs[i]);
+    }
+    sprintf(result + strlen(result), "\n%s]", indent);
+
+    free(operand_strs);
+    free(new_indent);
+    return result;
+}
+
 void free_identifier(Expression* expr) {
     IdentifierExpression* ident = (IdentifierExpression*)expr->node;
     token_free(ident->token);
@@ -166,6 +758,38 @@ void free_infix(Expression* expr) {
     free(expr);
 }
 
+void free_quantifier(Expression* expr) {
+    QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+    token_free(quantifier->token);
+    for (int i = 0; i < quantifier->var_count; i++) {
+        free(quantifier->vars[i]);
+    }
+    free(quantifier->vars);
+    quantifier->body->free(quantifier->body);
+    free(quantifier);
+    free(expr);
+}
+
+// Frees the node itself but not its operands
+static void free_nary_shell(Expression* expr) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    token_free(nary->token);
+    free(nary->operator);
+    free(nary->operands);
+    free(nary->reached);
+    free(nary->decided);
+    free(nary);
+    free(expr);
+}
+
+void free_nary(Expression* expr) {
+    NaryExpression* nary = (NaryExpression*)expr->node;
+    for (int i = 0; i < nary->count; i++) {
+        nary->operands[i]->free(nary->operands[i]);
+    }
+    free_nary_shell(expr);
+}
+
 Expression* new_identifier(Token* token, const char* value) {
     Expression* expr = malloc(sizeof(Expression));
     IdentifierExpression* ident = malloc(sizeof(IdentifierExpression));
@@ -175,7 +799,9 @@ Expression* new_identifier(Token* token, const char* value) {
     
     expr->type = EXPR_IDENTIFIER;
     expr->node = ident;
+    expr->size = 1;
     expr->eval = eval_identifier;
+    expr->partial_eval = partial_eval_identifier;
     expr->string = string_identifier;
     expr->pretty_print = pretty_print_identifier;
     expr->free = free_identifier;
@@ -192,7 +818,9 @@ Expression* new_boolean(Token* token, bool value) {
     
     expr->type = EXPR_BOOLEAN;
     expr->node = boolean;
+    expr->size = 1;
     expr->eval = eval_boolean;
+    expr->partial_eval = partial_eval_boolean;
     expr->string = string_boolean;
     expr->pretty_print = pretty_print_boolean;
     expr->free = free_boolean;
@@ -210,7 +838,9 @@ Expression* new_prefix(Token* token, const char* operator, Expression* right) {
     
     expr->type = EXPR_PREFIX;
     expr->node = prefix;
+    expr->size = 1 + right->size;
     expr->eval = eval_prefix;
+    expr->partial_eval = partial_eval_prefix;
     expr->string = string_prefix;
     expr->pretty_print = pretty_print_prefix;
     expr->free = free_prefix;
@@ -226,13 +856,140 @@ Expression* new_infix(Token* token, Expression* left, const char* operator, Expr
     infix->left = left;
     infix->operator = strdup(operator);
     infix->right = right;
+    infix->evaluations = 0;
+    infix->left_decided = 0;
+    infix->right_decided = 0;
     
     expr->type = EXPR_INFIX;
     expr->node = infix;
+    expr->size = 1 + left->size + right->size;
     expr->eval = eval_infix;
+    expr->partial_eval = partial_eval_infix;
     expr->string = string_infix;
     expr->pretty_print = pretty_print_infix;
     expr->free = free_infix;
     
     return expr;
-}
\ No newline at end of file
+}
+Expression* new_quantifier(Token* token, char** vars, int var_count, Expression* body) {
+    Expression* expr = malloc(sizeof(Expression));
+    QuantifierExpression* quantifier = malloc(sizeof(QuantifierExpression));
+
+    quantifier->token = token;
+    quantifier->vars = malloc(sizeof(char*) * var_count);
+    for (int i = 0; i < var_count; i++) {
+        quantifier->vars[i] = strdup(vars[i]);
+    }
+    quantifier->var_count = var_count;
+    quantifier->body = body;
+
+    expr->type = EXPR_QUANTIFIER;
+    expr->node = quantifier;
+    expr->size = 1 + body->size;
+    expr->eval = eval_quantifier;
+    expr->partial_eval = partial_eval_quantifier;
+    expr->string = string_quantifier;
+    expr->pretty_print = pretty_print_quantifier;
+    expr->free = free_quantifier;
+
+    return expr;
+}
+
+// Takes ownership of the operands but not of the array holding them
+Expression* new_nary(Token* token, const char* operator, int k, Expression** operands, int count) {
+    Expression* expr = malloc(sizeof(Expression));
+    NaryExpression* nary = malloc(sizeof(NaryExpression));
+
+    nary->token = token;
+    nary->operator = strdup(operator);
+    nary->k = k;
+    nary->capacity = count > 4 ? count : 4;
+    nary->operands = malloc(sizeof(Expression*) * nary->capacity);
+    if (count > 0) memcpy(nary->operands, operands, sizeof(Expression*) * count);
+    nary->count = count;
+    nary->evaluations = 0;
+    nary->reached = calloc(nary->capacity, sizeof(unsigned long));
+    nary->decided = calloc(nary->capacity, sizeof(unsigned long));
+
+    expr->type = EXPR_NARY;
+    expr->node = nary;
+    expr->size = 1;
+    for (int i = 0; i < count; i++) {
+        expr->size += operands[i]->size;
+    }
+    expr->eval = eval_nary;
+    expr->partial_eval = partial_eval_nary;
+    expr->string = string_nary;
+    expr->pretty_print = pretty_print_nary;
+    expr->free = free_nary;
+
+    return expr;
+}
+
+static void append_operand(NaryExpression* nary, Expression* operand) {
+    if (nary->count >= nary->capacity) {
+        nary->capacity *= 2;
+        nary->operands = realloc(nary->operands, sizeof(Expression*) * nary->capacity);
+        nary->reached = realloc(nary->reached, sizeof(unsigned long) * nary->capacity);
+        nary->decided = realloc(nary->decided, sizeof(unsigned long) * nary->capacity);
+    }
+    nary->operands[nary->count] = operand;
+    nary->reached[nary->count] = 0;
+    nary->decided[nary->count] = 0;
+    nary->count++;
+}
+
+// Appends the operands of expr to chain, taking apart (and freeing) any
+// & or | node with the same operator as the chain. Returns the total size
+// of the operands appended.
+static int flatten_chain(NaryExpression* chain, Expression* expr) {
+    TokenType op = chain->token->type;
+    if (expr->type == EXPR_INFIX && ((InfixExpression*)expr->node)->token->type == op) {
+        InfixExpression* infix = (InfixExpression*)expr->node;
+        int size = flatten_chain(chain, infix->left) + flatten_chain(chain, infix->right);
+        token_free(infix->token);
+        free(infix->operator);
+        free(infix);
+        free(expr);
+        return size;
+    }
+    if (expr->type == EXPR_NARY && ((NaryExpression*)expr->node)->token->type == op) {
+        NaryExpression* nary = (NaryExpression*)expr->node;
+        int size = 0;
+        for (int i = 0; i < nary->count; i++) {
+            size += flatten_chain(chain, nary->operands[i]);
+        }
+        free_nary_shell(expr);
+        return size;
+    }
+    append_operand(chain, expr);
+    return expr->size;
+}
+
+// Joins operands with & or | (the type of token, which is taken over).
+// Both are associative, so operands that are chains of the same operator
+// are merged in and A & B & C becomes one n-ary node rather than a tree
+// of binary ones. A chain in first position is extended in place, which
+// keeps parsing a long chain linear. Two operands stay a binary node.
+Expression* new_chain(Token* token, Expression** operands, int count) {
+    Expression* chain;
+    int first = 0;
+    if (operands[0]->type == EXPR_NARY && ((NaryExpression*)operands[0]->node)->token->type == token->type) {
+        chain = operands[0];
+        first = 1;
+        token_free(token);
+    } else {
+        chain = new_nary(token, token->literal, 0, NULL, 0);
+    }
+
+    NaryExpression* nary = (NaryExpression*)chain->node;
+    for (int i = first; i < count; i++) {
+        chain->size += flatten_chain(nary, operands[i]);
+    }
+    if (nary->count > 2) return chain;
+
+    Expression* pair = new_infix(token_new(nary->token->type, nary->operator),
+                                 nary->operands[0], nary->operator, nary->operands[1]);
+    free_nary_shell(chain);
+    return pair;
+}
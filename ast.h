@@ -17,7 +17,9 @@ typedef enum {
     EXPR_IDENTIFIER,
     EXPR_BOOLEAN,
     EXPR_PREFIX,
-    EXPR_INFIX
+    EXPR_INFIX,
+    EXPR_QUANTIFIER,
+    EXPR_NARY
 } ExpressionType;
 
 typedef struct Expression Expression;
@@ -25,7 +27,12 @@ typedef struct Expression Expression;
 struct Expression {
     ExpressionType type;
     void* node;  // Points to the specific expression type
+    int size;    // Nodes in the subtree, counted when it is built
+    // Every variable must be bound in env: an unbound one is reported on
+    // stderr and exits the process. Callers that may see unbound variables
+    // use partial_eval, which returns the residual formula instead.
     bool (*eval)(Expression* expr, Environment* env);
+    Expression* (*partial_eval)(Expression* expr, Environment* env);
     char* (*string)(Expression* expr);
     char* (*pretty_print)(Expression* expr, const char* indent);
     void (*free)(Expression* expr);
@@ -52,11 +59,44 @@ typedef struct {
     Expression* left;
     char* operator;
     Expression* right;
+    // Profile counters used by adaptive evaluation (see eval_infix)
+    unsigned long evaluations;
+    unsigned long left_decided;
+    unsigned long right_decided;
 } InfixExpression;
 
+// forall X Y . body or exists X Y . body
+typedef struct {
+    Token* token;  // T_FORALL or T_EXISTS
+    char** vars;
+    int var_count;
+    Expression* body;
+} QuantifierExpression;
+
+// A & B & C ... or A | B | C ... with three or more operands, and the
+// cardinality operators ATMOST(k, ...), ATLEAST(k, ...) and EXACTLY(k, ...)
+typedef struct {
+    Token* token;  // T_AND, T_OR, T_ATMOST, T_ATLEAST or T_EXACTLY
+    char* operator;
+    int k;  // Bound of a cardinality operator, unused for & and |
+    Expression** operands;
+    int count;
+    int capacity;
+    // Profile counters used by adaptive evaluation of & and | (see eval_nary)
+    unsigned long evaluations;
+    unsigned long* reached;  // Per operand: times it was evaluated
+    unsigned long* decided;  // Per operand: times it decided the result
+} NaryExpression;
+
 Expression* new_identifier(Token* token, const char* value);
 Expression* new_boolean(Token* token, bool value);
 Expression* new_prefix(Token* token, const char* operator, Expression* right);
 Expression* new_infix(Token* token, Expression* left, const char* operator, Expression* right);
+Expression* new_quantifier(Token* token, char** vars, int var_count, Expression* body);
+Expression* new_nary(Token* token, const char* operator, int k, Expression** operands, int count);
+Expression* new_chain(Token* token, Expression** operands, int count);
+bool cardinality_decided(TokenType op, int k, int count, int remaining, bool* value);
+int expression_size(Expression* expr);
+bool expression_is_constant(Expression* expr, bool* value);
 
 #endif
\ No newline at end of file
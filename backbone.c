@@ -0,0 +1,121 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "backbone.h"
+#include "circuit.h"
+#include "cnf.h"
+#include "sat.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SIMULATION_ROUNDS 16
+
+static uint64_t next_random(uint64_t* state) {
+    uint64_t x = (*state += 0x9E3779B97F4A7C15ULL);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// Drops every candidate that takes the other value in some model, given
+// 64 assignments at once with bit i of models set when assignment i is a
+// model
+static void drop_candidates(signed char* values, const uint64_t* var_words, uint64_t models, int n) {
+    for (int v = 0; v < n; v++) {
+        if (values[v] < 0) continue;
+        uint64_t disagree = values[v] ? ~var_words[v] : var_words[v];
+        if (disagree & models) values[v] = -1;
+    }
+}
+
+// Computes the backbone in three steps. A first model fixes the only
+// possible value of each variable. Random simulation, 64 assignments per
+// pass, then rules out every candidate that flips in any model it finds.
+// Each remaining candidate is checked with one solver call assuming the
+// opposite value: unsatisfiable proves it, and it is added as a unit
+// clause to speed up later checks; otherwise the new model rules out the
+// candidates it disagrees with. All checks share one incremental solver,
+// so learnt clauses carry over.
+Backbone* backbone_compute(Expression* expr) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+
+    Backbone* backbone = malloc(sizeof(Backbone));
+    backbone->var_count = n;
+    backbone->vars = malloc(sizeof(char*) * (n > 0 ? n : 1));
+    backbone->values = malloc(n > 0 ? n : 1);
+    for (int v = 0; v < n; v++) {
+        backbone->vars[v] = strdup(c->vars[v]);
+        backbone->values[v] = -1;
+    }
+
+    Cnf* cnf = cnf_from_circuit(c);
+    int* node_literals = calloc(c->size, sizeof(int));
+    int literal = cnf_encode(cnf, c, root, node_literals);
+    cnf_add_clause(cnf, &literal, 1);
+
+    SatSolver* solver = sat_new();
+    sat_reserve_vars(solver, n);
+    sat_add_cnf(solver, cnf, 0);
+
+    backbone->sat_calls = 1;
+    backbone->satisfiable = sat_solve(solver, NULL, 0);
+    if (backbone->satisfiable) {
+        signed char* values = backbone->values;
+        for (int v = 0; v < n; v++) {
+            values[v] = sat_model_value(solver, v + 1);
+        }
+
+        uint64_t* var_words = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+        uint64_t* node_values = malloc(sizeof(uint64_t) * c->size);
+        uint64_t state = 0x2545F4914F6CDD1DULL;
+        for (int round = 0; round < SIMULATION_ROUNDS; round++) {
+            for (int v = 0; v < n; v++) {
+                var_words[v] = next_random(&state);
+            }
+            circuit_simulate(c, var_words, node_values);
+            drop_candidates(values, var_words, node_values[root], n);
+        }
+
+        for (int v = 0; v < n; v++) {
+            if (values[v] < 0) continue;
+            int flipped = values[v] ? -(v + 1) : v + 1;
+            backbone->sat_calls++;
+            if (!sat_solve(solver, &flipped, 1)) {
+                int forced = -flipped;
+                sat_add_clause(solver, &forced, 1);
+                continue;
+            }
+            for (int u = v; u < n; u++) {
+                if (values[u] >= 0 && values[u] != sat_model_value(solver, u + 1)) {
+                    values[u] = -1;
+                }
+            }
+        }
+
+        free(node_values);
+        free(var_words);
+    }
+
+    sat_free(solver);
+    free(node_literals);
+    cnf_free(cnf);
+    circuit_free(c);
+    return backbone;
+}
+
+void backbone_free(Backbone* backbone) {
+    if (!backbone) return;
+
+    for (int v = 0; v < backbone->var_count; v++) {
+        free(backbone->vars[v]);
+    }
+    free(backbone->vars);
+    free(backbone->values);
+    free(backbone);
+}
@@ -0,0 +1,27 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef BACKBONE_H
+#define BACKBONE_H
+
+#include "ast.h"
+#include <stdbool.h>
+
+// The backbone of a formula: the variables that take the same value in
+// every model
+typedef struct {
+    char** vars;
+    signed char* values;  // 1 or 0 if forced to true or false, -1 if free
+    int var_count;
+    bool satisfiable;
+    int sat_calls;
+} Backbone;
+
+Backbone* backbone_compute(Expression* expr);
+void backbone_free(Backbone* backbone);
+
+#endif
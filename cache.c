@@ -0,0 +1,545 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+// For F_OFD_SETLKW
+#define _GNU_SOURCE
+
+#include "cache.h"
+#include "circuit.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CACHE_MAGIC "LOGOSRC"
+#define INITIAL_SLOTS 1024
+
+// The file starts with a header, followed by records and index tables in
+// the order they were appended. Only the index named by the header is
+// live; an outgrown one is left in place.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t end;           // Bytes in use; anything past it is zero
+    uint64_t index_offset;
+    uint64_t index_slots;   // A power of two
+    uint64_t index_used;
+} CacheHeader;
+
+// Followed by length bytes of payload, padded to a multiple of 8
+typedef struct {
+    uint64_t hash[2];
+    uint32_t kind;
+    uint32_t length;
+} CacheRecord;
+
+typedef struct {
+    uint64_t hash;    // hash[0] of the record's key
+    uint64_t record;  // Offset of the record, 0 for an empty slot
+} CacheSlot;
+
+static uint64_t splitmix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t mix(uint64_t seed, uint64_t tag, uint64_t a, uint64_t b) {
+    return splitmix(splitmix(splitmix(seed ^ tag) ^ a) ^ b);
+}
+
+static uint64_t name_hash(const char* name) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+// Each half of a key is computed with its own seed
+static const uint64_t seeds[2] = { 0x6C6F676F73636163ULL, 0x9B05688C2B3E6C1FULL };
+
+// Hashes every node of a circuit from its operator and its children.
+// The circuit has already folded constants and shared equal subterms,
+// variables are hashed by name rather than by index, and the operands of
+// commutative operators are ordered by hash, so A & B and B & A, for
+// instance, hash alike.
+static void hash_circuit(Circuit* c, uint64_t seed, uint64_t* hashes) {
+    for (int i = 0; i < c->size; i++) {
+        CircuitNode* node = &c->nodes[i];
+        switch (node->op) {
+            case CIRCUIT_CONST:
+                hashes[i] = mix(seed, CIRCUIT_CONST, node->a, 0);
+                break;
+            case CIRCUIT_VAR:
+                hashes[i] = mix(seed, CIRCUIT_VAR, name_hash(c->vars[node->a]), 0);
+                break;
+            case CIRCUIT_NOT:
+                hashes[i] = mix(seed, CIRCUIT_NOT, hashes[node->a], 0);
+                break;
+            case CIRCUIT_IMPLIES:
+                hashes[i] = mix(seed, CIRCUIT_IMPLIES, hashes[node->a], hashes[node->b]);
+                break;
+            default: {
+                uint64_t a = hashes[node->a];
+                uint64_t b = hashes[node->b];
+                hashes[i] = mix(seed, node->op, a < b ? a : b, a < b ? b : a);
+                break;
+            }
+        }
+    }
+}
+
+// The key of a query of the given kind over exprs, in order
+CacheKey cache_key(Expression** exprs, int count, CacheKind kind) {
+    Circuit* c = circuit_new();
+    int* roots = malloc(sizeof(int) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        roots[i] = circuit_add_expression(c, exprs[i]);
+    }
+
+    CacheKey key;
+    key.kind = kind;
+    uint64_t* hashes = malloc(sizeof(uint64_t) * (c->size > 0 ? c->size : 1));
+    for (int lane = 0; lane < 2; lane++) {
+        hash_circuit(c, seeds[lane], hashes);
+        key.hash[lane] = mix(seeds[lane], kind, count, 0);
+        for (int i = 0; i < count; i++) {
+            key.hash[lane] = mix(seeds[lane], key.hash[lane], hashes[roots[i]], i);
+        }
+    }
+    free(hashes);
+    free(roots);
+    circuit_free(c);
+    return key;
+}
+
+// Makes key depend on the weights of the variables of expr as well
+void cache_key_add_weights(CacheKey* key, Expression* expr, Environment* env) {
+    Circuit* c = circuit_new();
+    circuit_add_expression(c, expr);
+    for (int lane = 0; lane < 2; lane++) {
+        uint64_t sum = 0;  // Independent of the order of the variables
+        for (int v = 0; v < c->var_count; v++) {
+            long long weight = environment_get_weight(env, c->vars[v]);
+            if (weight) sum += mix(seeds[lane], name_hash(c->vars[v]), (uint64_t)weight, 0);
+        }
+        key->hash[lane] = mix(seeds[lane], key->hash[lane], sum, 1);
+    }
+    circuit_free(c);
+}
+
+#ifndef F_OFD_SETLKW
+// Without open file description locks, fcntl locks belong to the process:
+// two handles in one process would both be granted the lock, and closing
+// either descriptor would release it for both. The handles of a process
+// then take turns through this mutex instead.
+static pthread_mutex_t process_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+// Locks are taken on the open file description, so every handle, in this
+// process or another, excludes the others
+static bool lock(ResultCache* cache, short type) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = type;
+    fl.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLKW
+    return fcntl(cache->fd, F_OFD_SETLKW, &fl) == 0;
+#else
+    pthread_mutex_lock(&process_lock);
+    if (fcntl(cache->fd, F_SETLKW, &fl) == 0) return true;
+    pthread_mutex_unlock(&process_lock);
+    return false;
+#endif
+}
+
+static void unlock(ResultCache* cache) {
+    struct flock fl;
+    memset(&fl, 0, sizeof(fl));
+    fl.l_type = F_UNLCK;
+    fl.l_whence = SEEK_SET;
+#ifdef F_OFD_SETLKW
+    fcntl(cache->fd, F_OFD_SETLK, &fl);
+#else
+    fcntl(cache->fd, F_SETLK, &fl);
+    pthread_mutex_unlock(&process_lock);
+#endif
+}
+
+// Grows the file to size with its blocks allocated, so that a full disk
+// fails here instead of raising SIGBUS on the first write to the mapping.
+// On failure the file keeps its old size.
+static bool allocate(ResultCache* cache, size_t old_size, size_t size) {
+#ifdef __APPLE__
+    // No posix_fallocate: writing zeros allocates the blocks as well
+    static const char zeros[4096];
+    for (size_t at = old_size; at < size;) {
+        size_t chunk = size - at < sizeof(zeros) ? size - at : sizeof(zeros);
+        ssize_t written = pwrite(cache->fd, zeros, chunk, at);
+        if (written <= 0) {
+            if (written < 0 && errno == EINTR) continue;
+            ftruncate(cache->fd, old_size);
+            return false;
+        }
+        at += written;
+    }
+    return true;
+#else
+    if (posix_fallocate(cache->fd, old_size, size - old_size) == 0) return true;
+    // The file may have grown partway before the disk filled up
+    ftruncate(cache->fd, old_size);
+    return false;
+#endif
+}
+
+// Maps the whole file again if it has changed size, which another
+// process may have done since the last call. Called with a lock held.
+static bool remap(ResultCache* cache) {
+    struct stat st;
+    if (fstat(cache->fd, &st) != 0) return false;
+    if ((size_t)st.st_size == cache->map_size) return true;
+
+    if (cache->map) munmap(cache->map, cache->map_size);
+    cache->map = NULL;
+    cache->map_size = 0;
+    if (st.st_size == 0) return true;
+
+    void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+    if (map == MAP_FAILED) return false;
+    cache->map = map;
+    cache->map_size = st.st_size;
+    return true;
+}
+
+static CacheHeader* header(ResultCache* cache) {
+    return (CacheHeader*)cache->map;
+}
+
+static bool valid(ResultCache* cache) {
+    if (cache->map_size < sizeof(CacheHeader)) return false;
+    CacheHeader* h = header(cache);
+    return memcmp(h->magic, CACHE_MAGIC, sizeof(h->magic)) == 0 && h->version == CACHE_VERSION &&
+           h->end <= cache->map_size &&
+           h->index_offset + h->index_slots * sizeof(CacheSlot) <= h->end;
+}
+
+// Empties the file and writes a fresh header. Called with the write lock
+// held, when the file is new or was written by another version.
+static bool initialize(ResultCache* cache) {
+    uint64_t end = sizeof(CacheHeader) + INITIAL_SLOTS * sizeof(CacheSlot);
+    if (ftruncate(cache->fd, 0) != 0 || !allocate(cache, 0, end * 16) || !remap(cache)) {
+        return false;
+    }
+    memset(cache->map, 0, cache->map_size);
+
+    CacheHeader* h = header(cache);
+    memcpy(h->magic, CACHE_MAGIC, sizeof(h->magic));
+    h->version = CACHE_VERSION;
+    h->end = end;
+    h->index_offset = sizeof(CacheHeader);
+    h->index_slots = INITIAL_SLOTS;
+    h->index_used = 0;
+    return true;
+}
+
+// Returns NULL if the file cannot be opened; callers then simply run
+// without a cache
+ResultCache* cache_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) return NULL;
+
+    ResultCache* cache = calloc(1, sizeof(ResultCache));
+    cache->fd = fd;
+    if (!lock(cache, F_WRLCK)) {
+        cache_close(cache);
+        return NULL;
+    }
+    bool ok = remap(cache) && (valid(cache) || initialize(cache));
+    unlock(cache);
+    if (!ok) {
+        cache_close(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void cache_close(ResultCache* cache) {
+    if (!cache) return;
+    if (cache->map) munmap(cache->map, cache->map_size);
+#ifdef F_OFD_SETLKW
+    close(cache->fd);
+#else
+    // Closing any descriptor of the file drops the locks of the process
+    pthread_mutex_lock(&process_lock);
+    close(cache->fd);
+    pthread_mutex_unlock(&process_lock);
+#endif
+    free(cache);
+}
+
+static CacheSlot* slots(ResultCache* cache) {
+    return (CacheSlot*)(cache->map + header(cache)->index_offset);
+}
+
+// Returns the offset of the record for key, or 0 with *empty set to the
+// slot where it would go. Called with a lock held.
+static uint64_t find(ResultCache* cache, const CacheKey* key, uint64_t* empty) {
+    CacheSlot* table = slots(cache);
+    uint64_t mask = header(cache)->index_slots - 1;
+    for (uint64_t i = key->hash[1] & mask;; i = (i + 1) & mask) {
+        if (!table[i].record) {
+            if (empty) *empty = i;
+            return 0;
+        }
+        if (table[i].hash != key->hash[0]) continue;
+        CacheRecord* record = (CacheRecord*)(cache->map + table[i].record);
+        if (record->hash[1] == key->hash[1] && record->kind == key->kind) {
+            return table[i].record;
+        }
+    }
+}
+
+bool cache_get(ResultCache* cache, const CacheKey* key, unsigned char** payload, size_t* length) {
+    if (!cache || !lock(cache, F_RDLCK)) return false;
+
+    bool found = false;
+    if (remap(cache) && valid(cache)) {
+        uint64_t offset = find(cache, key, NULL);
+        if (offset) {
+            CacheRecord* record = (CacheRecord*)(cache->map + offset);
+            *length = record->length;
+            *payload = malloc(record->length > 0 ? record->length : 1);
+            memcpy(*payload, record + 1, record->length);
+            found = true;
+        }
+    }
+    unlock(cache);
+    return found;
+}
+
+// Makes room for bytes more past the end, doubling the file if needed
+static bool reserve(ResultCache* cache, size_t bytes) {
+    uint64_t end = header(cache)->end;
+    if (end + bytes <= cache->map_size) return true;
+    size_t size = cache->map_size * 2;
+    if (size < end + bytes) size = end + bytes;
+    return allocate(cache, cache->map_size, size) && remap(cache);
+}
+
+// Appends an index twice the size of the current one, which must have
+// room reserved, and moves every entry into it
+static void grow_index(ResultCache* cache) {
+    CacheHeader* h = header(cache);
+    CacheSlot* old = slots(cache);
+    uint64_t old_slots = h->index_slots;
+
+    uint64_t offset = h->end;
+    uint64_t count = old_slots * 2;
+    CacheSlot* table = (CacheSlot*)(cache->map + offset);
+    memset(table, 0, count * sizeof(CacheSlot));
+    for (uint64_t i = 0; i < old_slots; i++) {
+        if (!old[i].record) continue;
+        CacheRecord* record = (CacheRecord*)(cache->map + old[i].record);
+        uint64_t j = record->hash[1] & (count - 1);
+        while (table[j].record) j = (j + 1) & (count - 1);
+        table[j] = old[i];
+    }
+
+    h->end += count * sizeof(CacheSlot);
+    h->index_offset = offset;
+    h->index_slots = count;
+}
+
+void cache_put(ResultCache* cache, const CacheKey* key, const unsigned char* payload, size_t length) {
+    if (!cache || length > UINT32_MAX || !lock(cache, F_WRLCK)) return;
+
+    uint64_t empty;
+    if (remap(cache) && (valid(cache) || initialize(cache)) && !find(cache, key, &empty)) {
+        // The index is kept at most half full
+        size_t record_size = sizeof(CacheRecord) + ((length + 7) & ~(size_t)7);
+        bool grow = (header(cache)->index_used + 1) * 2 > header(cache)->index_slots;
+        size_t index_size = grow ? header(cache)->index_slots * 2 * sizeof(CacheSlot) : 0;
+
+        if (reserve(cache, record_size + index_size)) {
+            CacheHeader* h = header(cache);
+            uint64_t offset = h->end;
+            CacheRecord* record = (CacheRecord*)(cache->map + offset);
+            record->hash[0] = key->hash[0];
+            record->hash[1] = key->hash[1];
+            record->kind = key->kind;
+            record->length = length;
+            memcpy(record + 1, payload, length);
+            h->end += record_size;
+
+            if (grow) {
+                grow_index(cache);
+                find(cache, key, &empty);
+            }
+            slots(cache)[empty].hash = key->hash[0];
+            slots(cache)[empty].record = offset;
+            h->index_used++;
+        }
+    }
+    unlock(cache);
+}
+
+// Payloads of the typed entries are built and read field by field
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static void buffer_add(Buffer* b, const void* data, size_t length) {
+    if (b->size + length > b->capacity) {
+        b->capacity = (b->size + length) * 2;
+        b->data = realloc(b->data, b->capacity);
+    }
+    memcpy(b->data + b->size, data, length);
+    b->size += length;
+}
+
+typedef struct {
+    const unsigned char* data;
+    size_t size;
+    size_t pos;
+} PayloadReader;
+
+static bool read_bytes(PayloadReader* r, void* out, size_t length) {
+    if (r->size - r->pos < length) return false;
+    memcpy(out, r->data + r->pos, length);
+    r->pos += length;
+    return true;
+}
+
+static char* read_string(PayloadReader* r) {
+    const unsigned char* end = memchr(r->data + r->pos, '\0', r->size - r->pos);
+    if (!end) return NULL;
+    char* s = strdup((const char*)r->data + r->pos);
+    r->pos = end - r->data + 1;
+    return s;
+}
+
+// Backbone: satisfiable (1 byte), variable count (4 bytes), then each
+// variable's name and value (-1, 0 or 1)
+void cache_put_backbone(ResultCache* cache, const CacheKey* key, Backbone* backbone) {
+    if (!cache) return;
+    Buffer b = { NULL, 0, 0 };
+    unsigned char satisfiable = backbone->satisfiable;
+    int32_t count = backbone->var_count;
+    buffer_add(&b, &satisfiable, 1);
+    buffer_add(&b, &count, sizeof(count));
+    for (int v = 0; v < backbone->var_count; v++) {
+        buffer_add(&b, backbone->vars[v], strlen(backbone->vars[v]) + 1);
+        buffer_add(&b, &backbone->values[v], 1);
+    }
+    cache_put(cache, key, b.data, b.size);
+    free(b.data);
+}
+
+Backbone* cache_get_backbone(ResultCache* cache, const CacheKey* key) {
+    unsigned char* payload;
+    size_t length;
+    if (!cache_get(cache, key, &payload, &length)) return NULL;
+
+    PayloadReader r = { payload, length, 0 };
+    unsigned char satisfiable = 0;
+    int32_t count = -1;
+    read_bytes(&r, &satisfiable, 1);
+    if (!read_bytes(&r, &count, sizeof(count)) || count < 0) {
+        free(payload);
+        return NULL;
+    }
+
+    Backbone* backbone = malloc(sizeof(Backbone));
+    backbone->satisfiable = satisfiable;
+    backbone->sat_calls = 0;
+    backbone->var_count = 0;
+    backbone->vars = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    backbone->values = malloc(count > 0 ? count : 1);
+    for (int v = 0; v < count; v++) {
+        char* name = read_string(&r);
+        if (!name) break;
+        backbone->vars[v] = name;
+        backbone->var_count++;
+        if (!read_bytes(&r, &backbone->values[v], 1)) break;
+    }
+    free(payload);
+    if (backbone->var_count != count) {
+        backbone_free(backbone);
+        return NULL;
+    }
+    return backbone;
+}
+
+// Optimum: satisfiable (1 byte), cost (8 bytes), variable count (4
+// bytes), then each variable's name and value
+void cache_put_optimum(ResultCache* cache, const CacheKey* key, Optimum* optimum) {
+    if (!cache) return;
+    Buffer b = { NULL, 0, 0 };
+    unsigned char satisfiable = optimum->satisfiable;
+    int64_t cost = optimum->cost;
+    int32_t count = optimum->var_count;
+    buffer_add(&b, &satisfiable, 1);
+    buffer_add(&b, &cost, sizeof(cost));
+    buffer_add(&b, &count, sizeof(count));
+    for (int v = 0; v < optimum->var_count; v++) {
+        unsigned char value = optimum->values[v];
+        buffer_add(&b, optimum->vars[v], strlen(optimum->vars[v]) + 1);
+        buffer_add(&b, &value, 1);
+    }
+    cache_put(cache, key, b.data, b.size);
+    free(b.data);
+}
+
+Optimum* cache_get_optimum(ResultCache* cache, const CacheKey* key) {
+    unsigned char* payload;
+    size_t length;
+    if (!cache_get(cache, key, &payload, &length)) return NULL;
+
+    PayloadReader r = { payload, length, 0 };
+    unsigned char satisfiable = 0;
+    int64_t cost = 0;
+    int32_t count = -1;
+    read_bytes(&r, &satisfiable, 1);
+    read_bytes(&r, &cost, sizeof(cost));
+    if (!read_bytes(&r, &count, sizeof(count)) || count < 0) {
+        free(payload);
+        return NULL;
+    }
+
+    Optimum* optimum = malloc(sizeof(Optimum));
+    optimum->satisfiable = satisfiable;
+    optimum->cost = cost;
+    optimum->sat_calls = 0;
+    optimum->var_count = 0;
+    optimum->vars = malloc(sizeof(char*) * (count > 0 ? count : 1));
+    optimum->values = malloc(sizeof(bool) * (count > 0 ? count : 1));
+    for (int v = 0; v < count; v++) {
+        char* name = read_string(&r);
+        if (!name) break;
+        optimum->vars[v] = name;
+        optimum->var_count++;
+        unsigned char value;
+        if (!read_bytes(&r, &value, 1)) break;
+        optimum->values[v] = value;
+    }
+    free(payload);
+    if (optimum->var_count != count) {
+        optimum_free(optimum);
+        return NULL;
+    }
+    return optimum;
+}
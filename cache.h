@@ -0,0 +1,62 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "ast.h"
+#include "environment.h"
+#include "backbone.h"
+#include "optimize.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bumped whenever the file layout or the meaning of a stored result
+// changes; a file written with another version is discarded
+#define CACHE_VERSION 1
+
+// A persistent store of query results, shared by every logos process
+// that opens the same file. Results are appended to a memory-mapped file
+// and found through an open-addressing index kept in the same file.
+// Writers hold an exclusive lock on the file and readers a shared one, so
+// no handle ever sees a half-written entry. A ResultCache belongs to one
+// thread; threads that share a file each open their own.
+
+typedef enum {
+    CACHE_BACKBONE = 1,
+    CACHE_OPTIMUM,
+    CACHE_DEDUP
+} CacheKind;
+
+// 128 bits of a canonical hash of the query, plus its kind
+typedef struct {
+    uint64_t hash[2];
+    uint32_t kind;
+} CacheKey;
+
+typedef struct {
+    int fd;
+    unsigned char* map;
+    size_t map_size;
+} ResultCache;
+
+ResultCache* cache_open(const char* path);
+void cache_close(ResultCache* cache);
+
+CacheKey cache_key(Expression** exprs, int count, CacheKind kind);
+void cache_key_add_weights(CacheKey* key, Expression* expr, Environment* env);
+
+bool cache_get(ResultCache* cache, const CacheKey* key, unsigned char** payload, size_t* length);
+void cache_put(ResultCache* cache, const CacheKey* key, const unsigned char* payload, size_t length);
+
+Backbone* cache_get_backbone(ResultCache* cache, const CacheKey* key);
+void cache_put_backbone(ResultCache* cache, const CacheKey* key, Backbone* backbone);
+Optimum* cache_get_optimum(ResultCache* cache, const CacheKey* key);
+void cache_put_optimum(ResultCache* cache, const CacheKey* key, Optimum* optimum);
+
+#endif
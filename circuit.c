@@ -0,0 +1,412 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "circuit.h"
+#include "qbf.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define INITIAL_CAPACITY 64
+
+Circuit* circuit_new(void) {
+    Circuit* c = malloc(sizeof(Circuit));
+    c->nodes = malloc(sizeof(CircuitNode) * INITIAL_CAPACITY);
+    c->size = 0;
+    c->capacity = INITIAL_CAPACITY;
+
+    c->vars = malloc(sizeof(char*) * INITIAL_CAPACITY);
+    c->var_count = 0;
+    c->var_capacity = INITIAL_CAPACITY;
+
+    c->table_capacity = INITIAL_CAPACITY * 2;
+    c->table = malloc(sizeof(int) * c->table_capacity);
+    memset(c->table, -1, sizeof(int) * c->table_capacity);
+
+    return c;
+}
+
+void circuit_free(Circuit* c) {
+    if (!c) return;
+
+    for (int i = 0; i < c->var_count; i++) {
+        free(c->vars[i]);
+    }
+    free(c->vars);
+    free(c->nodes);
+    free(c->table);
+    free(c);
+}
+
+int circuit_find_var(Circuit* c, const char* name) {
+    for (int i = 0; i < c->var_count; i++) {
+        if (strcmp(c->vars[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int circuit_var(Circuit* c, const char* name) {
+    int index = circuit_find_var(c, name);
+    if (index >= 0) return index;
+
+    if (c->var_count >= c->var_capacity) {
+        c->var_capacity *= 2;
+        c->vars = realloc(c->vars, sizeof(char*) * c->var_capacity);
+    }
+    c->vars[c->var_count] = strdup(name);
+    return c->var_count++;
+}
+
+static unsigned int hash_node(CircuitOp op, int a, int b) {
+    uint64_t h = ((uint64_t)(unsigned int)a << 32 | (unsigned int)b) ^ ((uint64_t)op << 59);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+static void rehash(Circuit* c) {
+    c->table_capacity *= 2;
+    c->table = realloc(c->table, sizeof(int) * c->table_capacity);
+    memset(c->table, -1, sizeof(int) * c->table_capacity);
+
+    unsigned int mask = c->table_capacity - 1;
+    for (int i = 0; i < c->size; i++) {
+        CircuitNode* n = &c->nodes[i];
+        unsigned int slot = hash_node(n->op, n->a, n->b) & mask;
+        while (c->table[slot] >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        c->table[slot] = i;
+    }
+}
+
+static int intern(Circuit* c, CircuitOp op, int a, int b) {
+    unsigned int mask = c->table_capacity - 1;
+    unsigned int slot = hash_node(op, a, b) & mask;
+    while (c->table[slot] >= 0) {
+        CircuitNode* n = &c->nodes[c->table[slot]];
+        if (n->op == op && n->a == a && n->b == b) {
+            return c->table[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    if (c->size >= c->capacity) {
+        c->capacity *= 2;
+        c->nodes = realloc(c->nodes, sizeof(CircuitNode) * c->capacity);
+    }
+    c->nodes[c->size].op = op;
+    c->nodes[c->size].a = a;
+    c->nodes[c->size].b = b;
+    c->table[slot] = c->size;
+    c->size++;
+
+    if (c->size * 2 > c->table_capacity) {
+        rehash(c);
+    }
+    return c->size - 1;
+}
+
+static int const_value(Circuit* c, int node) {
+    return c->nodes[node].op == CIRCUIT_CONST ? c->nodes[node].a : -1;
+}
+
+static bool is_negation(Circuit* c, int a, int b) {
+    return (c->nodes[a].op == CIRCUIT_NOT && c->nodes[a].a == b) ||
+           (c->nodes[b].op == CIRCUIT_NOT && c->nodes[b].a == a);
+}
+
+// Creates (or finds) a node, folding constants and trivial identities so
+// that equivalent subterms are more likely to share a node.
+int circuit_node(Circuit* c, CircuitOp op, int a, int b) {
+    if (op == CIRCUIT_CONST || op == CIRCUIT_VAR) {
+        return intern(c, op, a, 0);
+    }
+
+    int ca = const_value(c, a);
+    if (op == CIRCUIT_NOT) {
+        if (ca >= 0) return circuit_node(c, CIRCUIT_CONST, !ca, 0);
+        if (c->nodes[a].op == CIRCUIT_NOT) return c->nodes[a].a;
+        return intern(c, op, a, 0);
+    }
+
+    int cb = const_value(c, b);
+    if (ca >= 0 && cb >= 0) {
+        uint64_t value = circuit_apply(op, ca ? ~0ULL : 0, cb ? ~0ULL : 0);
+        return circuit_node(c, CIRCUIT_CONST, value & 1, 0);
+    }
+
+    switch (op) {
+        case CIRCUIT_AND:
+            if (ca == 0 || cb == 0) return circuit_node(c, CIRCUIT_CONST, 0, 0);
+            if (ca == 1) return b;
+            if (cb == 1 || a == b) return a;
+            if (is_negation(c, a, b)) return circuit_node(c, CIRCUIT_CONST, 0, 0);
+            break;
+        case CIRCUIT_OR:
+            if (ca == 1 || cb == 1) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+            if (ca == 0) return b;
+            if (cb == 0 || a == b) return a;
+            if (is_negation(c, a, b)) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+            break;
+        case CIRCUIT_XOR:
+            if (ca == 0) return b;
+            if (cb == 0) return a;
+            if (ca == 1) return circuit_node(c, CIRCUIT_NOT, b, 0);
+            if (cb == 1) return circuit_node(c, CIRCUIT_NOT, a, 0);
+            if (a == b) return circuit_node(c, CIRCUIT_CONST, 0, 0);
+            if (is_negation(c, a, b)) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+            break;
+        case CIRCUIT_IFF:
+            if (ca == 1) return b;
+            if (cb == 1) return a;
+            if (ca == 0) return circuit_node(c, CIRCUIT_NOT, b, 0);
+            if (cb == 0) return circuit_node(c, CIRCUIT_NOT, a, 0);
+            if (a == b) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+            if (is_negation(c, a, b)) return circuit_node(c, CIRCUIT_CONST, 0, 0);
+            break;
+        case CIRCUIT_IMPLIES:
+            if (ca == 0 || cb == 1 || a == b) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+            if (ca == 1) return b;
+            if (cb == 0) return circuit_node(c, CIRCUIT_NOT, a, 0);
+            return intern(c, op, a, b);
+        default:
+            break;
+    }
+
+    // Commutative operators are stored with ordered operands
+    if (a > b) {
+        int tmp = a;
+        a = b;
+        b = tmp;
+    }
+    return intern(c, op, a, b);
+}
+
+static CircuitOp op_for_token(TokenType type) {
+    switch (type) {
+        case T_AND: return CIRCUIT_AND;
+        case T_OR: return CIRCUIT_OR;
+        case T_XOR: return CIRCUIT_XOR;
+        case T_IMPLIES: return CIRCUIT_IMPLIES;
+        case T_IFF: return CIRCUIT_IFF;
+        default:
+            fprintf(stderr, "unknown operator token: %d\n", type);
+            exit(1);
+    }
+}
+
+// A balanced tree of op over inputs (count >= 1), so an n-ary chain
+// stays shallow in the circuit
+int circuit_nary(Circuit* c, CircuitOp op, const int* inputs, int count) {
+    if (count == 1) return inputs[0];
+    int half = count / 2;
+    return circuit_node(c, op, circuit_nary(c, op, inputs, half),
+                        circuit_nary(c, op, inputs + half, count - half));
+}
+
+// Totalizer: sets out[j] to "at least j + 1 of inputs are true" for every
+// j < limit (limit <= count). Each half is counted in unary recursively
+// and the two counts are merged; cutting the counts off at limit keeps
+// the network at O(count * limit) gates per level.
+static void totalize(Circuit* c, const int* inputs, int count, int limit, int* out) {
+    if (count == 1) {
+        out[0] = inputs[0];
+        return;
+    }
+
+    int half = count / 2;
+    int left_limit = half < limit ? half : limit;
+    int right_limit = count - half < limit ? count - half : limit;
+    int* left = malloc(sizeof(int) * (left_limit + right_limit));
+    int* right = left + left_limit;
+    totalize(c, inputs, half, left_limit, left);
+    totalize(c, inputs + half, count - half, right_limit, right);
+
+    int truth = circuit_node(c, CIRCUIT_CONST, 1, 0);
+    for (int j = 0; j < limit; j++) {
+        // At least a on the left and j + 1 - a on the right, for some a
+        int node = circuit_node(c, CIRCUIT_CONST, 0, 0);
+        for (int a = 0; a <= left_limit; a++) {
+            int b = j + 1 - a;
+            if (b < 0 || b > right_limit) continue;
+            int x = a ? left[a - 1] : truth;
+            int y = b ? right[b - 1] : truth;
+            node = circuit_node(c, CIRCUIT_OR, node, circuit_node(c, CIRCUIT_AND, x, y));
+        }
+        out[j] = node;
+    }
+    free(left);
+}
+
+static int at_least(Circuit* c, const int* totals, int count, int j) {
+    if (j <= 0) return circuit_node(c, CIRCUIT_CONST, 1, 0);
+    if (j > count) return circuit_node(c, CIRCUIT_CONST, 0, 0);
+    return totals[j - 1];
+}
+
+// ATMOST, ATLEAST or EXACTLY k of inputs, encoded with a totalizer so
+// that the CNF sent to a solver grows with count * k rather than with
+// the number of subsets
+int circuit_cardinality(Circuit* c, TokenType op, int k, const int* inputs, int count) {
+    int limit = op == T_ATLEAST ? k : k + 1;
+    if (limit > count) limit = count;
+    int* totals = malloc(sizeof(int) * (limit > 0 ? limit : 1));
+    if (limit > 0) totalize(c, inputs, count, limit, totals);
+
+    int result;
+    switch (op) {
+        case T_ATLEAST:
+            result = at_least(c, totals, count, k);
+            break;
+        case T_ATMOST:
+            result = circuit_node(c, CIRCUIT_NOT, at_least(c, totals, count, k + 1), 0);
+            break;
+        default:
+            result = circuit_node(c, CIRCUIT_AND, at_least(c, totals, count, k),
+                                  circuit_node(c, CIRCUIT_NOT, at_least(c, totals, count, k + 1), 0));
+            break;
+    }
+    free(totals);
+    return result;
+}
+
+// inputs holds the node of each operand of nary
+int circuit_add_nary(Circuit* c, NaryExpression* nary, const int* inputs) {
+    switch (nary->token->type) {
+        case T_AND: return circuit_nary(c, CIRCUIT_AND, inputs, nary->count);
+        case T_OR: return circuit_nary(c, CIRCUIT_OR, inputs, nary->count);
+        default: return circuit_cardinality(c, nary->token->type, nary->k, inputs, nary->count);
+    }
+}
+
+int circuit_add_expression(Circuit* c, Expression* expr) {
+    switch (expr->type) {
+        case EXPR_IDENTIFIER: {
+            IdentifierExpression* ident = (IdentifierExpression*)expr->node;
+            return circuit_node(c, CIRCUIT_VAR, circuit_var(c, ident->value), 0);
+        }
+        case EXPR_BOOLEAN: {
+            BooleanExpression* boolean = (BooleanExpression*)expr->node;
+            return circuit_node(c, CIRCUIT_CONST, boolean->value, 0);
+        }
+        case EXPR_PREFIX: {
+            PrefixExpression* prefix = (PrefixExpression*)expr->node;
+            return circuit_node(c, CIRCUIT_NOT, circuit_add_expression(c, prefix->right), 0);
+        }
+        case EXPR_INFIX: {
+            InfixExpression* infix = (InfixExpression*)expr->node;
+            int left = circuit_add_expression(c, infix->left);
+            int right = circuit_add_expression(c, infix->right);
+            return circuit_node(c, op_for_token(infix->token->type), left, right);
+        }
+        case EXPR_QUANTIFIER:
+            return qbf_add_expression(c, expr, NULL, NULL);
+        case EXPR_NARY: {
+            NaryExpression* nary = (NaryExpression*)expr->node;
+            int* inputs = malloc(sizeof(int) * nary->count);
+            for (int i = 0; i < nary->count; i++) {
+                inputs[i] = circuit_add_expression(c, nary->operands[i]);
+            }
+            int node = circuit_add_nary(c, nary, inputs);
+            free(inputs);
+            return node;
+        }
+    }
+    return -1;
+}
+
+uint64_t circuit_apply(CircuitOp op, uint64_t a, uint64_t b) {
+    switch (op) {
+        case CIRCUIT_NOT: return ~a;
+        case CIRCUIT_AND: return a & b;
+        case CIRCUIT_OR: return a | b;
+        case CIRCUIT_XOR: return a ^ b;
+        case CIRCUIT_IMPLIES: return ~a | b;
+        case CIRCUIT_IFF: return ~(a ^ b);
+        default: return 0;
+    }
+}
+
+// Evaluates every node for 64 assignments at once: bit i of var_words[v]
+// is the value of variable v in assignment i.
+void circuit_simulate(Circuit* c, const uint64_t* var_words, uint64_t* values) {
+    for (int i = 0; i < c->size; i++) {
+        CircuitNode* n = &c->nodes[i];
+        switch (n->op) {
+            case CIRCUIT_CONST:
+                values[i] = n->a ? ~0ULL : 0;
+                break;
+            case CIRCUIT_VAR:
+                values[i] = var_words[n->a];
+                break;
+            default:
+                values[i] = circuit_apply(n->op, values[n->a], values[n->b]);
+                break;
+        }
+    }
+}
+
+// Three-valued version of circuit_simulate: in each of the 64 lanes a
+// variable is known true (its bit set in var_true), known false (set in
+// var_false) or unknown (set in neither). A node's bit is set in
+// node_true or node_false only when the known variables alone decide it.
+void circuit_simulate_ternary(Circuit* c, const uint64_t* var_true, const uint64_t* var_false,
+                              uint64_t* node_true, uint64_t* node_false) {
+    for (int i = 0; i < c->size; i++) {
+        CircuitNode* n = &c->nodes[i];
+        uint64_t ta = 0, fa = 0, tb = 0, fb = 0;
+        if (n->op >= CIRCUIT_NOT) {
+            ta = node_true[n->a];
+            fa = node_false[n->a];
+        }
+        if (n->op > CIRCUIT_NOT) {
+            tb = node_true[n->b];
+            fb = node_false[n->b];
+        }
+
+        switch (n->op) {
+            case CIRCUIT_CONST:
+                node_true[i] = n->a ? ~0ULL : 0;
+                node_false[i] = ~node_true[i];
+                break;
+            case CIRCUIT_VAR:
+                node_true[i] = var_true[n->a];
+                node_false[i] = var_false[n->a];
+                break;
+            case CIRCUIT_NOT:
+                node_true[i] = fa;
+                node_false[i] = ta;
+                break;
+            case CIRCUIT_AND:
+                node_true[i] = ta & tb;
+                node_false[i] = fa | fb;
+                break;
+            case CIRCUIT_OR:
+                node_true[i] = ta | tb;
+                node_false[i] = fa & fb;
+                break;
+            case CIRCUIT_XOR:
+                node_true[i] = (ta & fb) | (fa & tb);
+                node_false[i] = (ta & tb) | (fa & fb);
+                break;
+            case CIRCUIT_IMPLIES:
+                node_true[i] = fa | tb;
+                node_false[i] = ta & fb;
+                break;
+            case CIRCUIT_IFF:
+                node_true[i] = (ta & tb) | (fa & fb);
+                node_false[i] = (ta & fb) | (fa & tb);
+                break;
+        }
+    }
+}
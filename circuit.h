@@ -0,0 +1,64 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef CIRCUIT_H
+#define CIRCUIT_H
+
+#include "ast.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// A circuit is a flat, hash-consed form of one or more expressions.
+// Nodes are stored in topological order (children always have a lower
+// index than their parents) and structurally equal subterms share a
+// single node, so the circuit is a DAG rather than a tree.
+
+typedef enum {
+    CIRCUIT_CONST,   // a holds the value (0 or 1)
+    CIRCUIT_VAR,     // a holds the variable index
+    CIRCUIT_NOT,     // a is the operand
+    CIRCUIT_AND,
+    CIRCUIT_OR,
+    CIRCUIT_XOR,
+    CIRCUIT_IMPLIES,
+    CIRCUIT_IFF
+} CircuitOp;
+
+typedef struct {
+    CircuitOp op;
+    int a;
+    int b;
+} CircuitNode;
+
+typedef struct Circuit {
+    CircuitNode* nodes;
+    int size;
+    int capacity;
+
+    char** vars;
+    int var_count;
+    int var_capacity;
+
+    int* table;  // Hash-consing index into nodes, -1 when empty
+    int table_capacity;
+} Circuit;
+
+Circuit* circuit_new(void);
+void circuit_free(Circuit* c);
+int circuit_var(Circuit* c, const char* name);
+int circuit_find_var(Circuit* c, const char* name);
+int circuit_node(Circuit* c, CircuitOp op, int a, int b);
+int circuit_add_expression(Circuit* c, Expression* expr);
+int circuit_nary(Circuit* c, CircuitOp op, const int* inputs, int count);
+int circuit_cardinality(Circuit* c, TokenType op, int k, const int* inputs, int count);
+int circuit_add_nary(Circuit* c, NaryExpression* nary, const int* inputs);
+uint64_t circuit_apply(CircuitOp op, uint64_t a, uint64_t b);
+void circuit_simulate(Circuit* c, const uint64_t* var_words, uint64_t* values);
+void circuit_simulate_ternary(Circuit* c, const uint64_t* var_true, const uint64_t* var_false,
+                              uint64_t* node_true, uint64_t* node_false);
+
+#endif
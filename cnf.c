@@ -0,0 +1,437 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "cnf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INITIAL_CAPACITY 1024
+#define WRITE_BUFFER_SIZE (1 << 20)
+#define MAX_VARS (1 << 26)  // Variable names are allocated up front
+
+Cnf* cnf_new(void) {
+    Cnf* cnf = malloc(sizeof(Cnf));
+    cnf->literals = malloc(sizeof(int) * INITIAL_CAPACITY);
+    cnf->literal_count = 0;
+    cnf->literal_capacity = INITIAL_CAPACITY;
+    cnf->clause_count = 0;
+    cnf->var_names = malloc(sizeof(char*) * INITIAL_CAPACITY);
+    cnf->var_count = 0;
+    cnf->var_capacity = INITIAL_CAPACITY;
+    cnf->true_var = 0;
+    return cnf;
+}
+
+void cnf_free(Cnf* cnf) {
+    if (!cnf) return;
+
+    for (int v = 0; v < cnf->var_count; v++) {
+        free(cnf->var_names[v]);
+    }
+    free(cnf->var_names);
+    free(cnf->literals);
+    free(cnf);
+}
+
+static void reserve_vars(Cnf* cnf, int count) {
+    if (count > cnf->var_capacity) {
+        while (cnf->var_capacity < count) cnf->var_capacity *= 2;
+        cnf->var_names = realloc(cnf->var_names, sizeof(char*) * cnf->var_capacity);
+    }
+    while (cnf->var_count < count) {
+        cnf->var_names[cnf->var_count++] = NULL;
+    }
+}
+
+// Adds a variable and returns its DIMACS index. A NULL name leaves the
+// variable unnamed (it is an auxiliary variable of an encoding).
+int cnf_new_var(Cnf* cnf, const char* name) {
+    reserve_vars(cnf, cnf->var_count + 1);
+    cnf->var_names[cnf->var_count - 1] = name ? strdup(name) : NULL;
+    return cnf->var_count;
+}
+
+static void push_literal(Cnf* cnf, int literal) {
+    if (cnf->literal_count >= cnf->literal_capacity) {
+        cnf->literal_capacity *= 2;
+        cnf->literals = realloc(cnf->literals, sizeof(int) * cnf->literal_capacity);
+    }
+    cnf->literals[cnf->literal_count++] = literal;
+}
+
+void cnf_add_clause(Cnf* cnf, const int* literals, int count) {
+    for (int i = 0; i < count; i++) {
+        push_literal(cnf, literals[i]);
+    }
+    push_literal(cnf, 0);
+    cnf->clause_count++;
+}
+
+static const char* skip_spaces(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static const char* skip_line(const char* p, const char* end) {
+    const char* newline = memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+// Returns NULL if there are no digits. Values too large for an int
+// saturate, so range checks against int limits stay simple.
+static const char* parse_int(const char* p, const char* end, long* value) {
+    bool negative = false;
+    if (p < end && *p == '-') {
+        negative = true;
+        p++;
+    }
+    const char* digits = p;
+    long n = 0;
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (n <= INT_MAX) n = n * 10 + (*p - '0');
+        p++;
+    }
+    if (p == digits) return NULL;
+    *value = negative ? -n : n;
+    return p;
+}
+
+// "c var <n> <name>" comments written by cnf_write restore variable names.
+// Other comments are ignored; false means a malformed variable index.
+static bool parse_comment(Cnf* cnf, const char* p, const char* end) {
+    const char* line_end = memchr(p, '\n', end - p);
+    if (!line_end) line_end = end;
+    p = skip_spaces(p + 1, line_end);
+    if (line_end - p < 4 || strncmp(p, "var ", 4) != 0) return true;
+
+    long v;
+    p = parse_int(skip_spaces(p + 4, line_end), line_end, &v);
+    if (!p || v < 1 || v > MAX_VARS) return false;
+    p = skip_spaces(p, line_end);
+    const char* name_end = p;
+    while (name_end < line_end && *name_end != ' ' && *name_end != '\t' && *name_end != '\r') {
+        name_end++;
+    }
+    if (name_end == p) return true;
+
+    reserve_vars(cnf, v);
+    free(cnf->var_names[v - 1]);
+    cnf->var_names[v - 1] = strndup(p, name_end - p);
+    return true;
+}
+
+// Unnamed variables get names starting with an underscore, which the
+// lexer never produces, so they cannot clash with a formula's variables
+static void name_unnamed_vars(Cnf* cnf) {
+    char name[32];
+    for (int v = 0; v < cnf->var_count; v++) {
+        if (!cnf->var_names[v]) {
+            snprintf(name, sizeof(name), "_x%d", v + 1);
+            cnf->var_names[v] = strdup(name);
+        }
+    }
+}
+
+// Parses a DIMACS file straight out of a read-only mapping of it: no line
+// buffers or intermediate copies, just one pass producing the literal
+// array. The literal array is sized up front from the problem line.
+Cnf* cnf_load(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "could not open CNF file: %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        fprintf(stderr, "could not stat CNF file: %s\n", path);
+        return NULL;
+    }
+
+    Cnf* cnf = cnf_new();
+    if (st.st_size == 0) {
+        close(fd);
+        return cnf;
+    }
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "could not map CNF file: %s\n", path);
+        cnf_free(cnf);
+        return NULL;
+    }
+    posix_madvise(data, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    const char* p = data;
+    const char* end = data + st.st_size;
+    long declared_vars = -1;
+    long declared_clauses = 0;
+    bool in_clause = false;
+    bool ok = true;
+
+    while (p < end) {
+        char ch = *p;
+        if (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n') {
+            p++;
+        } else if (ch == 'c' && !in_clause) {
+            if (!parse_comment(cnf, p, end)) {
+                fprintf(stderr, "%s: invalid variable index in 'c var' comment\n", path);
+                ok = false;
+                break;
+            }
+            p = skip_line(p, end);
+        } else if (ch == 'p' && !in_clause) {
+            p = skip_spaces(p + 1, end);
+            if (end - p < 3 || strncmp(p, "cnf", 3) != 0) {
+                fprintf(stderr, "%s: expected 'p cnf' problem line\n", path);
+                ok = false;
+                break;
+            }
+            p = parse_int(skip_spaces(p + 3, end), end, &declared_vars);
+            if (p) p = parse_int(skip_spaces(p, end), end, &declared_clauses);
+            if (!p || declared_vars < 0 || declared_vars > MAX_VARS ||
+                declared_clauses < 0 || declared_clauses > INT_MAX) {
+                fprintf(stderr, "%s: invalid counts in problem line\n", path);
+                ok = false;
+                break;
+            }
+            reserve_vars(cnf, declared_vars);
+
+            // Most clauses in benchmark instances have only a few literals,
+            // and none can take less than two bytes of the file
+            size_t estimate = (size_t)declared_clauses * 4;
+            if (estimate > (size_t)st.st_size / 2) estimate = st.st_size / 2;
+            if (estimate > cnf->literal_capacity) {
+                cnf->literal_capacity = estimate;
+                cnf->literals = realloc(cnf->literals, sizeof(int) * estimate);
+            }
+            p = skip_line(p, end);
+        } else if (ch == '%') {
+            break;  // SATLIB end-of-data marker
+        } else if (ch == '-' || (ch >= '0' && ch <= '9')) {
+            if (declared_vars < 0) {
+                fprintf(stderr, "%s: clause before problem line\n", path);
+                ok = false;
+                break;
+            }
+            long literal;
+            p = parse_int(p, end, &literal);
+            if (!p) {
+                fprintf(stderr, "%s: '-' without a variable\n", path);
+                ok = false;
+                break;
+            }
+            long v = literal < 0 ? -literal : literal;
+            if (v > declared_vars) {
+                fprintf(stderr, "%s: literal %ld exceeds declared variable count\n", path, literal);
+                ok = false;
+                break;
+            }
+            push_literal(cnf, (int)literal);
+            if (literal == 0) {
+                cnf->clause_count++;
+                in_clause = false;
+            } else {
+                in_clause = true;
+            }
+        } else {
+            fprintf(stderr, "%s: unexpected character '%c'\n", path, ch);
+            ok = false;
+            break;
+        }
+    }
+
+    munmap(data, st.st_size);
+
+    if (ok && in_clause) {
+        push_literal(cnf, 0);  // Tolerate a missing final terminator
+        cnf->clause_count++;
+    }
+    if (ok && cnf->clause_count != declared_clauses) {
+        fprintf(stderr, "%s: warning: %d clauses found, %ld declared\n",
+                path, cnf->clause_count, declared_clauses);
+    }
+    if (!ok) {
+        cnf_free(cnf);
+        return NULL;
+    }
+
+    name_unnamed_vars(cnf);
+    return cnf;
+}
+
+int cnf_write(Cnf* cnf, const char* path) {
+    FILE* out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "could not write CNF file: %s\n", path);
+        return 1;
+    }
+    setvbuf(out, NULL, _IOFBF, WRITE_BUFFER_SIZE);
+
+    for (int v = 0; v < cnf->var_count; v++) {
+        if (cnf->var_names[v]) {
+            fprintf(out, "c var %d %s\n", v + 1, cnf->var_names[v]);
+        }
+    }
+    fprintf(out, "p cnf %d %d\n", cnf->var_count, cnf->clause_count);
+
+    for (size_t i = 0; i < cnf->literal_count; i++) {
+        int literal = cnf->literals[i];
+        if (literal == 0) {
+            fputs("0\n", out);
+        } else {
+            fprintf(out, "%d ", literal);
+        }
+    }
+
+    return fclose(out) != 0;
+}
+
+// Creates a CNF whose first variables are the circuit's variables, in the
+// same order and with the same names.
+Cnf* cnf_from_circuit(Circuit* c) {
+    Cnf* cnf = cnf_new();
+    for (int v = 0; v < c->var_count; v++) {
+        cnf_new_var(cnf, c->vars[v]);
+    }
+    return cnf;
+}
+
+static int const_literal(Cnf* cnf, bool value) {
+    if (!cnf->true_var) {
+        cnf->true_var = cnf_new_var(cnf, NULL);
+        cnf_add_clause(cnf, &cnf->true_var, 1);
+    }
+    return value ? cnf->true_var : -cnf->true_var;
+}
+
+// Tseitin-encodes the cone of node and returns the literal equivalent to
+// it. node_literals caches the literal of every encoded node (0 when not
+// yet encoded) so that repeated calls share gates; it must have one slot
+// per circuit node. Each gate costs one variable and at most four
+// clauses, and negation costs nothing, so the encoding is linear.
+int cnf_encode(Cnf* cnf, Circuit* c, int node, int* node_literals) {
+    if (node_literals[node]) return node_literals[node];
+
+    bool* needed = calloc(node + 1, sizeof(bool));
+    needed[node] = true;
+    for (int i = node; i >= 0; i--) {
+        if (!needed[i] || node_literals[i]) continue;
+        CircuitNode* n = &c->nodes[i];
+        if (n->op == CIRCUIT_CONST || n->op == CIRCUIT_VAR) continue;
+        needed[n->a] = true;
+        if (n->op != CIRCUIT_NOT) needed[n->b] = true;
+    }
+
+    for (int i = 0; i <= node; i++) {
+        if (!needed[i] || node_literals[i]) continue;
+        CircuitNode* n = &c->nodes[i];
+        int a = n->op >= CIRCUIT_NOT ? node_literals[n->a] : 0;
+        int b = n->op > CIRCUIT_NOT ? node_literals[n->b] : 0;
+        int g = 0;
+
+        switch (n->op) {
+            case CIRCUIT_CONST:
+                node_literals[i] = const_literal(cnf, n->a);
+                continue;
+            case CIRCUIT_VAR:
+                node_literals[i] = n->a + 1;
+                continue;
+            case CIRCUIT_NOT:
+                node_literals[i] = -a;
+                continue;
+            case CIRCUIT_IMPLIES:
+                a = -a;  // a -> b is ~a | b
+                /* fall through */
+            case CIRCUIT_OR: {
+                g = cnf_new_var(cnf, NULL);
+                int c1[] = { g, -a }, c2[] = { g, -b }, c3[] = { -g, a, b };
+                cnf_add_clause(cnf, c1, 2);
+                cnf_add_clause(cnf, c2, 2);
+                cnf_add_clause(cnf, c3, 3);
+                break;
+            }
+            case CIRCUIT_AND: {
+                g = cnf_new_var(cnf, NULL);
+                int c1[] = { -g, a }, c2[] = { -g, b }, c3[] = { g, -a, -b };
+                cnf_add_clause(cnf, c1, 2);
+                cnf_add_clause(cnf, c2, 2);
+                cnf_add_clause(cnf, c3, 3);
+                break;
+            }
+            case CIRCUIT_XOR:
+            case CIRCUIT_IFF: {
+                g = cnf_new_var(cnf, NULL);
+                int c1[] = { -g, a, b }, c2[] = { -g, -a, -b };
+                int c3[] = { g, -a, b }, c4[] = { g, a, -b };
+                cnf_add_clause(cnf, c1, 3);
+                cnf_add_clause(cnf, c2, 3);
+                cnf_add_clause(cnf, c3, 3);
+                cnf_add_clause(cnf, c4, 3);
+                if (n->op == CIRCUIT_IFF) g = -g;  // a <-> b is ~(a ^ b)
+                break;
+            }
+        }
+        node_literals[i] = g;
+    }
+
+    free(needed);
+    return node_literals[node];
+}
+
+// Evaluates the clauses against the variables bound in env. Returns 1 if
+// every clause is satisfied, 0 if some clause is falsified, and -1 if the
+// result depends on unbound variables, whose count is stored in unbound.
+int cnf_eval(Cnf* cnf, Environment* env, int* unbound) {
+    signed char* values = malloc(cnf->var_count + 1);
+    *unbound = 0;
+    for (int v = 1; v <= cnf->var_count; v++) {
+        bool value;
+        if (cnf->var_names[v - 1] && environment_get(env, cnf->var_names[v - 1], &value)) {
+            values[v] = value;
+        } else {
+            values[v] = -1;
+            (*unbound)++;
+        }
+    }
+
+    int result = 1;
+    bool satisfied = false;
+    bool open = false;
+    for (size_t i = 0; i < cnf->literal_count; i++) {
+        int literal = cnf->literals[i];
+        if (literal == 0) {
+            if (!satisfied) {
+                if (!open) {
+                    result = 0;
+                    break;
+                }
+                result = -1;
+            }
+            satisfied = false;
+            open = false;
+            continue;
+        }
+        signed char value = values[literal < 0 ? -literal : literal];
+        if (value < 0) {
+            open = true;
+        } else if ((value == 1) == (literal > 0)) {
+            satisfied = true;
+        }
+    }
+
+    free(values);
+    return result;
+}
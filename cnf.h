@@ -0,0 +1,40 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef CNF_H
+#define CNF_H
+
+#include "circuit.h"
+#include "environment.h"
+#include <stddef.h>
+
+// A formula in conjunctive normal form. Clauses are stored back to back
+// as DIMACS literals (v or -v for variable v >= 1), each terminated by 0.
+// Variable v is named var_names[v - 1], which is the name it is looked up
+// by in an Environment; variables without a name are called _x<v>.
+typedef struct {
+    int* literals;
+    size_t literal_count;
+    size_t literal_capacity;
+    int clause_count;
+    int var_count;
+    int var_capacity;
+    char** var_names;
+    int true_var;  // Variable fixed to true for encoding constants, 0 if none
+} Cnf;
+
+Cnf* cnf_new(void);
+void cnf_free(Cnf* cnf);
+int cnf_new_var(Cnf* cnf, const char* name);
+void cnf_add_clause(Cnf* cnf, const int* literals, int count);
+Cnf* cnf_load(const char* path);
+int cnf_write(Cnf* cnf, const char* path);
+Cnf* cnf_from_circuit(Circuit* c);
+int cnf_encode(Cnf* cnf, Circuit* c, int node, int* node_literals);
+int cnf_eval(Cnf* cnf, Environment* env, int* unbound);
+
+#endif
@@ -0,0 +1,345 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "codegen.h"
+#include "circuit.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define SELF_TEST_ROUNDS 1024
+
+// Output paths are the stem (by default the input path with its
+// extension removed) plus a suffix, and generated identifiers are
+// prefixed with the sanitised base name of the stem.
+static char* input_stem(const char* input_path) {
+    const char* slash = strrchr(input_path, '/');
+    const char* dot = strrchr(input_path, '.');
+    size_t stem_len = (dot && (!slash || dot > slash)) ? (size_t)(dot - input_path)
+                                                      : strlen(input_path);
+    char* stem = malloc(stem_len + 1);
+    memcpy(stem, input_path, stem_len);
+    stem[stem_len] = '\0';
+    return stem;
+}
+
+static char* output_path(const char* stem, const char* suffix) {
+    char* path = malloc(strlen(stem) + strlen(suffix) + 1);
+    strcpy(path, stem);
+    strcat(path, suffix);
+    return path;
+}
+
+static char* identifier_prefix(const char* stem, bool upper) {
+    const char* slash = strrchr(stem, '/');
+    const char* base = slash ? slash + 1 : stem;
+    size_t len = strlen(base);
+
+    char* prefix = malloc(len + 2);
+    size_t j = 0;
+    if (len == 0 || isdigit((unsigned char)base[0])) prefix[j++] = '_';
+    for (size_t i = 0; i < len; i++) {
+        char ch = isalnum((unsigned char)base[i]) ? base[i] : '_';
+        prefix[j++] = upper ? toupper((unsigned char)ch) : tolower((unsigned char)ch);
+    }
+    prefix[j] = '\0';
+    return prefix;
+}
+
+static void emit_comment(FILE* out, const char* s) {
+    fprintf(out, "/* ");
+    for (; *s; s++) {
+        fputc(*s, out);
+        if (s[0] == '*' && s[1] == '/') fputc(' ', out);
+    }
+    fprintf(out, " */\n");
+}
+
+static void emit_string_literal(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// Emits one temporary per node in the cone of root. When sliced is set
+// each temporary holds 64 independent assignments, otherwise only bit 0
+// is meaningful. Every operator maps to a bitwise instruction, so the
+// generated code has no branches.
+static void emit_body(FILE* out, Circuit* c, int root, const bool* in_cone, bool sliced) {
+    const char* one = sliced ? "~UINT64_C(0)" : "UINT64_C(1)";
+
+    for (int i = 0; i <= root; i++) {
+        if (!in_cone[i]) continue;
+        CircuitNode* n = &c->nodes[i];
+
+        fprintf(out, "    const uint64_t n%d = ", i);
+        switch (n->op) {
+            case CIRCUIT_CONST:
+                fprintf(out, "%s", n->a ? one : "UINT64_C(0)");
+                break;
+            case CIRCUIT_VAR:
+                if (sliced) {
+                    fprintf(out, "vars[%d]", n->a);
+                } else {
+                    fprintf(out, "(vars[%d] >> %d) & 1", n->a / 64, n->a % 64);
+                }
+                break;
+            case CIRCUIT_NOT:
+                fprintf(out, "n%d ^ %s", n->a, one);
+                break;
+            case CIRCUIT_AND:
+                fprintf(out, "n%d & n%d", n->a, n->b);
+                break;
+            case CIRCUIT_OR:
+                fprintf(out, "n%d | n%d", n->a, n->b);
+                break;
+            case CIRCUIT_XOR:
+                fprintf(out, "n%d ^ n%d", n->a, n->b);
+                break;
+            case CIRCUIT_IMPLIES:
+                fprintf(out, "(n%d ^ %s) | n%d", n->a, one, n->b);
+                break;
+            case CIRCUIT_IFF:
+                fprintf(out, "n%d ^ n%d ^ %s", n->a, n->b, one);
+                break;
+        }
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "    return %sn%d;\n", sliced ? "" : "(bool)", root);
+}
+
+static void mark_cone(Circuit* c, int root, bool* in_cone) {
+    memset(in_cone, 0, sizeof(bool) * c->size);
+    in_cone[root] = true;
+    for (int i = root; i >= 0; i--) {
+        if (!in_cone[i]) continue;
+        CircuitNode* n = &c->nodes[i];
+        if (n->op == CIRCUIT_CONST || n->op == CIRCUIT_VAR) continue;
+        in_cone[n->a] = true;
+        if (n->op != CIRCUIT_NOT) in_cone[n->b] = true;
+    }
+}
+
+static void emit_header(FILE* out, RuleSet* rules, Circuit* c, const int* roots,
+                        const char* source_name, const char* lower, const char* upper) {
+    fprintf(out, "/* Generated by logos --emit-c from %s. Do not edit. */\n\n", source_name);
+    fprintf(out, "#ifndef %s_LOGOS_H\n#define %s_LOGOS_H\n\n", upper, upper);
+    fprintf(out, "#include <stdbool.h>\n#include <stdint.h>\n\n");
+    fprintf(out, "#define %s_VAR_COUNT %d\n", upper, c->var_count);
+    fprintf(out, "#define %s_VAR_WORDS %d\n", upper, (c->var_count + 63) / 64);
+    fprintf(out, "#define %s_RULE_COUNT %d\n\n", upper, rules->count);
+    for (int v = 0; v < c->var_count; v++) {
+        fprintf(out, "#define %s_VAR_%s %d\n", upper, c->vars[v], v);
+    }
+
+    fprintf(out, "\nextern const char* const %s_var_names[];\n", lower);
+    fprintf(out, "extern const char* const %s_rule_sources[];\n\n", lower);
+    fprintf(out, "bool %s_eval(int rule, const uint64_t* vars);\n", lower);
+    fprintf(out, "void %s_eval_all(const uint64_t* vars, uint64_t* results);\n\n", lower);
+
+    bool* in_cone = malloc(sizeof(bool) * c->size);
+    for (int r = 0; r < rules->count; r++) {
+        mark_cone(c, roots[r], in_cone);
+
+        emit_comment(out, rules->sources[r]);
+        fprintf(out, "/* Bit v of vars[v / 64] holds variable v. */\n");
+        fprintf(out, "static inline bool %s_rule_%d(const uint64_t* vars) {\n", lower, r);
+        fprintf(out, "    (void)vars;\n");
+        emit_body(out, c, roots[r], in_cone, false);
+        fprintf(out, "}\n\n");
+
+        fprintf(out, "/* vars[v] holds variable v in 64 independent assignments. */\n");
+        fprintf(out, "static inline uint64_t %s_rule_%d_x64(const uint64_t* vars) {\n", lower, r);
+        fprintf(out, "    (void)vars;\n");
+        emit_body(out, c, roots[r], in_cone, true);
+        fprintf(out, "}\n\n");
+    }
+    free(in_cone);
+
+    fprintf(out, "#endif\n");
+}
+
+static void emit_source(FILE* out, RuleSet* rules, Circuit* c, const char* header_name,
+                        const char* source_name, const char* lower) {
+    fprintf(out, "/* Generated by logos --emit-c from %s. Do not edit. */\n\n", source_name);
+    fprintf(out, "#include \"%s\"\n\n", header_name);
+
+    fprintf(out, "const char* const %s_var_names[] = {\n", lower);
+    for (int v = 0; v < c->var_count; v++) {
+        fprintf(out, "    \"%s\",\n", c->vars[v]);
+    }
+    fprintf(out, "    0\n};\n\n");
+
+    fprintf(out, "const char* const %s_rule_sources[] = {\n", lower);
+    for (int r = 0; r < rules->count; r++) {
+        fprintf(out, "    ");
+        emit_string_literal(out, rules->sources[r]);
+        fprintf(out, ",\n");
+    }
+    fprintf(out, "    0\n};\n\n");
+
+    fprintf(out, "bool %s_eval(int rule, const uint64_t* vars) {\n", lower);
+    fprintf(out, "    switch (rule) {\n");
+    for (int r = 0; r < rules->count; r++) {
+        fprintf(out, "        case %d: return %s_rule_%d(vars);\n", r, lower, r);
+    }
+    fprintf(out, "        default: return false;\n    }\n}\n\n");
+
+    fprintf(out, "/* Sets bit r of results[r / 64] to the value of rule r. */\n");
+    fprintf(out, "void %s_eval_all(const uint64_t* vars, uint64_t* results) {\n", lower);
+    for (int w = 0; w < (rules->count + 63) / 64; w++) {
+        fprintf(out, "    results[%d] = 0", w);
+        for (int r = w * 64; r < rules->count && r < (w + 1) * 64; r++) {
+            fprintf(out, "\n        | ((uint64_t)%s_rule_%d(vars) << %d)", lower, r, r % 64);
+        }
+        fprintf(out, ";\n");
+    }
+    fprintf(out, "    (void)vars;\n    (void)results;\n}\n");
+}
+
+// The self-test links against the interpreter sources and checks both
+// generated variants against Expression.eval on pseudo-random assignments.
+static void emit_self_test(FILE* out, RuleSet* rules, const char* header_name,
+                           const char* source_name, const char* stem_name,
+                           const char* lower, const char* upper) {
+    fprintf(out, "/* Generated by logos --emit-c from %s. Do not edit.\n", source_name);
+    fprintf(out, "   Build together with the generated source and the logos sources:\n");
+    fprintf(out, "   cc -std=c11 -D_POSIX_C_SOURCE=200809L -pthread -I<logos> %s_test.c %s.c \\\n", stem_name, stem_name);
+    fprintf(out, "      token.c lexer.c ast.c parser.c environment.c */\n\n");
+    fprintf(out, "#include \"%s\"\n", header_name);
+    fprintf(out, "#include \"lexer.h\"\n#include \"parser.h\"\n#include \"environment.h\"\n");
+    fprintf(out, "#include <stdio.h>\n\n");
+
+    fprintf(out, "static uint64_t next_random(uint64_t* state) {\n");
+    fprintf(out, "    *state ^= *state << 13;\n    *state ^= *state >> 7;\n    *state ^= *state << 17;\n");
+    fprintf(out, "    return *state;\n}\n\n");
+
+    fprintf(out, "static uint64_t eval_x64(int rule, const uint64_t* vars) {\n");
+    fprintf(out, "    switch (rule) {\n");
+    for (int r = 0; r < rules->count; r++) {
+        fprintf(out, "        case %d: return %s_rule_%d_x64(vars);\n", r, lower, r);
+    }
+    fprintf(out, "        default: return 0;\n    }\n}\n\n");
+
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    uint64_t state = UINT64_C(0x9E3779B97F4A7C15);\n");
+    fprintf(out, "    uint64_t sliced[%s_VAR_COUNT + 1];\n", upper);
+    fprintf(out, "    int failures = 0;\n\n");
+    fprintf(out, "    for (int r = 0; r < %s_RULE_COUNT; r++) {\n", upper);
+    fprintf(out, "        Lexer* l = lexer_new(%s_rule_sources[r]);\n", lower);
+    fprintf(out, "        Parser* p = parser_new(l);\n");
+    fprintf(out, "        Expression* expr = parser_parse_expression(p, PREC_LOWEST);\n\n");
+    fprintf(out, "        for (int round = 0; round < %d; round++) {\n", SELF_TEST_ROUNDS / 64);
+    fprintf(out, "            for (int v = 0; v < %s_VAR_COUNT; v++) {\n", upper);
+    fprintf(out, "                sliced[v] = next_random(&state);\n            }\n");
+    fprintf(out, "            uint64_t lanes = eval_x64(r, sliced);\n\n");
+    fprintf(out, "            for (int lane = 0; lane < 64; lane++) {\n");
+    fprintf(out, "                uint64_t packed[%s_VAR_WORDS + 1] = {0};\n", upper);
+    fprintf(out, "                Environment* env = environment_new();\n");
+    fprintf(out, "                for (int v = 0; v < %s_VAR_COUNT; v++) {\n", upper);
+    fprintf(out, "                    bool value = (sliced[v] >> lane) & 1;\n");
+    fprintf(out, "                    packed[v / 64] |= (uint64_t)value << (v %% 64);\n");
+    fprintf(out, "                    environment_set(env, %s_var_names[v], value);\n", lower);
+    fprintf(out, "                }\n");
+    fprintf(out, "                bool expected = expr->eval(expr, env);\n");
+    fprintf(out, "                bool scalar = %s_eval(r, packed);\n", lower);
+    fprintf(out, "                bool lane_value = (lanes >> lane) & 1;\n");
+    fprintf(out, "                if (scalar != expected || lane_value != expected) {\n");
+    fprintf(out, "                    printf(\"FAIL: rule %%d (%%s)\\n\", r, %s_rule_sources[r]);\n", lower);
+    fprintf(out, "                    failures++;\n");
+    fprintf(out, "                }\n");
+    fprintf(out, "                environment_free(env);\n");
+    fprintf(out, "            }\n        }\n\n");
+    fprintf(out, "        expr->free(expr);\n        parser_free(p);\n        lexer_free(l);\n    }\n\n");
+    fprintf(out, "    printf(\"%%d failure(s)\\n\", failures);\n");
+    fprintf(out, "    return failures > 0;\n}\n");
+}
+
+// Without an explicit stem an existing file is never replaced, since the
+// default names may well clash with hand-written sources
+static FILE* open_output(const char* path, bool overwrite) {
+    FILE* out = fopen(path, overwrite ? "w" : "wx");
+    if (!out) {
+        fprintf(stderr, "could not write %s\n", path);
+    }
+    return out;
+}
+
+// Writes <stem>.h, <stem>.c and <stem>_test.c, where the stem is
+// output_stem if given and otherwise the rules file's path without its
+// extension. All rules share one hash-consed circuit, so common subterms
+// get the same temporaries and variable indices across functions.
+int codegen_emit_c(RuleSet* rules, const char* input_path, const char* output_stem) {
+    Circuit* c = circuit_new();
+    int* roots = malloc(sizeof(int) * (rules->count > 0 ? rules->count : 1));
+    for (int r = 0; r < rules->count; r++) {
+        roots[r] = circuit_add_expression(c, rules->formulas[r]);
+    }
+
+    bool overwrite = output_stem != NULL;
+    char* stem = output_stem ? strdup(output_stem) : input_stem(input_path);
+    char* header_path = output_path(stem, ".h");
+    char* source_path = output_path(stem, ".c");
+    char* test_path = output_path(stem, "_test.c");
+    const char* header_slash = strrchr(header_path, '/');
+    const char* header_name = header_slash ? header_slash + 1 : header_path;
+    const char* stem_slash = strrchr(stem, '/');
+    const char* stem_name = stem_slash ? stem_slash + 1 : stem;
+    const char* input_slash = strrchr(input_path, '/');
+    const char* source_name = input_slash ? input_slash + 1 : input_path;
+    char* lower = identifier_prefix(stem, false);
+    char* upper = identifier_prefix(stem, true);
+
+    int status = 0;
+    FILE* out;
+    // Checked up front so a clash does not leave a partial set of files
+    const char* paths[] = { header_path, source_path, test_path };
+    for (int i = 0; i < 3 && !overwrite && !status; i++) {
+        if ((out = fopen(paths[i], "r"))) {
+            fclose(out);
+            fprintf(stderr, "%s already exists; choose other names with -o\n", paths[i]);
+            status = 1;
+        }
+    }
+    if (!status && (out = open_output(header_path, overwrite))) {
+        emit_header(out, rules, c, roots, source_name, lower, upper);
+        fclose(out);
+    } else {
+        status = 1;
+    }
+    if (!status && (out = open_output(source_path, overwrite))) {
+        emit_source(out, rules, c, header_name, source_name, lower);
+        fclose(out);
+    } else {
+        status = 1;
+    }
+    if (!status && (out = open_output(test_path, overwrite))) {
+        emit_self_test(out, rules, header_name, source_name, stem_name, lower, upper);
+        fclose(out);
+    } else {
+        status = 1;
+    }
+
+    if (!status) {
+        printf("Wrote %s, %s and %s (%d rules, %d variables)\n",
+               header_path, source_path, test_path, rules->count, c->var_count);
+    }
+
+    free(lower);
+    free(upper);
+    free(stem);
+    free(header_path);
+    free(source_path);
+    free(test_path);
+    free(roots);
+    circuit_free(c);
+    return status;
+}
@@ -0,0 +1,15 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef CODEGEN_H
+#define CODEGEN_H
+
+#include "rules.h"
+
+int codegen_emit_c(RuleSet* rules, const char* input_path, const char* output_stem);
+
+#endif
@@ -0,0 +1,158 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "dedup.h"
+#include "circuit.h"
+#include "cnf.h"
+#include "sat.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t splitmix(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// The random words of a variable depend only on its name, so a formula
+// gets the same signature whatever else is loaded alongside it
+static uint64_t name_hash(const char* name) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (; *name; name++) {
+        h = (h ^ (unsigned char)*name) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+// qsort has no user pointer, so each entry carries its own signature
+typedef struct {
+    const uint64_t* signature;
+    int index;
+} SortedFormula;
+
+static int compare_signatures(const void* a, const void* b) {
+    const SortedFormula* fa = a;
+    const SortedFormula* fb = b;
+    for (int w = 0; w < DEDUP_SIGNATURE_WORDS; w++) {
+        if (fa->signature[w] != fb->signature[w]) return fa->signature[w] < fb->signature[w] ? -1 : 1;
+    }
+    return (fa->index > fb->index) - (fa->index < fb->index);
+}
+
+typedef struct {
+    Circuit* circuit;
+    Cnf* cnf;
+    SatSolver* solver;
+    int* node_literals;
+    size_t fed;  // Offset of the first CNF literal not yet given to the solver
+} Checker;
+
+// a and b are equivalent iff neither a & ~b nor ~a & b is satisfiable.
+// Every check shares one incremental solver, so gates and learnt clauses
+// carry over from one pair to the next.
+static bool equivalent(Checker* checker, int a, int b) {
+    if (a == b) return true;
+
+    int la = cnf_encode(checker->cnf, checker->circuit, a, checker->node_literals);
+    int lb = cnf_encode(checker->cnf, checker->circuit, b, checker->node_literals);
+    checker->fed = sat_add_cnf(checker->solver, checker->cnf, checker->fed);
+
+    int differ[] = { la, -lb };
+    if (sat_solve(checker->solver, differ, 2)) return false;
+    differ[0] = -la;
+    differ[1] = lb;
+    return !sat_solve(checker->solver, differ, 2);
+}
+
+// Groups logically equivalent formulas. Each formula is simulated on
+// DEDUP_SIGNATURE_WORDS * 64 pseudo-random assignments at once; formulas
+// with different signatures cannot be equivalent, and only those that
+// share a signature are confirmed with SAT. representative[i] receives
+// the index of the first formula equivalent to formula i. Returns the
+// number of equivalence classes.
+int dedup_formulas(Expression** formulas, int count, int* representative) {
+    Circuit* c = circuit_new();
+    int* roots = malloc(sizeof(int) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        roots[i] = circuit_add_expression(c, formulas[i]);
+    }
+
+    uint64_t* signatures = malloc(sizeof(uint64_t) * DEDUP_SIGNATURE_WORDS * (count > 0 ? count : 1));
+    uint64_t* var_words = malloc(sizeof(uint64_t) * (c->var_count > 0 ? c->var_count : 1));
+    uint64_t* values = malloc(sizeof(uint64_t) * (c->size > 0 ? c->size : 1));
+    uint64_t* hashes = malloc(sizeof(uint64_t) * (c->var_count > 0 ? c->var_count : 1));
+    for (int v = 0; v < c->var_count; v++) {
+        hashes[v] = name_hash(c->vars[v]);
+    }
+    for (int w = 0; w < DEDUP_SIGNATURE_WORDS; w++) {
+        for (int v = 0; v < c->var_count; v++) {
+            var_words[v] = splitmix(hashes[v] + (uint64_t)w * 0x632BE59BD9B4E019ULL);
+        }
+        circuit_simulate(c, var_words, values);
+        for (int i = 0; i < count; i++) {
+            signatures[(size_t)i * DEDUP_SIGNATURE_WORDS + w] = values[roots[i]];
+        }
+    }
+    free(hashes);
+    free(values);
+    free(var_words);
+
+    SortedFormula* order = malloc(sizeof(SortedFormula) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        order[i].signature = &signatures[(size_t)i * DEDUP_SIGNATURE_WORDS];
+        order[i].index = i;
+    }
+    qsort(order, count, sizeof(SortedFormula), compare_signatures);
+
+    Checker checker;
+    checker.circuit = c;
+    checker.cnf = cnf_from_circuit(c);
+    checker.solver = sat_new();
+    checker.node_literals = calloc(c->size > 0 ? c->size : 1, sizeof(int));
+    checker.fed = 0;
+
+    // Within a bucket of equal signatures, formulas arrive in index order,
+    // so the first member of each class found is its representative
+    int* candidates = malloc(sizeof(int) * (count > 0 ? count : 1));
+    int class_count = 0;
+    for (int start = 0; start < count;) {
+        int end = start + 1;
+        while (end < count &&
+               memcmp(order[start].signature, order[end].signature,
+                      sizeof(uint64_t) * DEDUP_SIGNATURE_WORDS) == 0) {
+            end++;
+        }
+
+        int candidate_count = 0;
+        for (int k = start; k < end; k++) {
+            int i = order[k].index;
+            representative[i] = i;
+            for (int r = 0; r < candidate_count; r++) {
+                if (equivalent(&checker, roots[candidates[r]], roots[i])) {
+                    representative[i] = candidates[r];
+                    break;
+                }
+            }
+            if (representative[i] == i) {
+                candidates[candidate_count++] = i;
+                class_count++;
+            }
+        }
+        start = end;
+    }
+
+    free(candidates);
+    free(checker.node_literals);
+    sat_free(checker.solver);
+    cnf_free(checker.cnf);
+    free(order);
+    free(signatures);
+    free(roots);
+    circuit_free(c);
+    return class_count;
+}
@@ -0,0 +1,19 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "ast.h"
+
+// Signatures are this many 64-bit words of simulation under fixed
+// pseudo-random assignments (512 bits)
+#define DEDUP_SIGNATURE_WORDS 8
+
+int dedup_formulas(Expression** formulas, int count, int* representative);
+
+#endif
@@ -6,97 +6,418 @@
    (at your option) any later version. */
    
 #include "environment.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define INITIAL_CAPACITY 16
 
+static EnvironmentVersion* version_new(void) {
+    EnvironmentVersion* version = calloc(1, sizeof(EnvironmentVersion));
+    return version;
+}
+
+static void chunk_release(EnvironmentChunk* chunk) {
+    if (atomic_fetch_sub(&chunk->refs, 1) != 1) return;
+    for (int i = 0; i < chunk->size; i++) {
+        free(chunk->entries[i].key);
+    }
+    free(chunk);
+}
+
+static void store_release(EnvironmentStore* store) {
+    for (int i = 0; i < store->chunk_count; i++) {
+        chunk_release(store->chunks[i]);
+    }
+    free(store->chunks);
+}
+
+static void version_release(EnvironmentVersion* version) {
+    store_release(&version->vars);
+    store_release(&version->settings);
+    store_release(&version->suggestions);
+    free(version);
+}
+
+// The copy shares every chunk with the original
+static void store_share(EnvironmentStore* copy, const EnvironmentStore* store) {
+    copy->chunk_count = store->chunk_count;
+    copy->chunks = malloc(sizeof(EnvironmentChunk*) * (store->chunk_count + 1));
+    for (int i = 0; i < store->chunk_count; i++) {
+        copy->chunks[i] = store->chunks[i];
+        atomic_fetch_add(&copy->chunks[i]->refs, 1);
+    }
+}
+
+static EnvironmentVersion* version_clone(const EnvironmentVersion* version) {
+    EnvironmentVersion* copy = version_new();
+    copy->number = version->number + 1;
+    copy->adaptive_eval = version->adaptive_eval;
+    store_share(&copy->vars, &version->vars);
+    store_share(&copy->settings, &version->settings);
+    store_share(&copy->suggestions, &version->suggestions);
+    return copy;
+}
+
+// Make chunk i private to this store before it is modified
+static EnvironmentChunk* store_own_chunk(EnvironmentStore* store, int i) {
+    EnvironmentChunk* chunk = store->chunks[i];
+    if (atomic_load(&chunk->refs) == 1) return chunk;
+    
+    EnvironmentChunk* copy = malloc(sizeof(EnvironmentChunk));
+    atomic_init(&copy->refs, 1);
+    copy->size = chunk->size;
+    for (int j = 0; j < chunk->size; j++) {
+        copy->entries[j].key = strdup(chunk->entries[j].key);
+        copy->entries[j].value = chunk->entries[j].value;
+    }
+    chunk_release(chunk);
+    store->chunks[i] = copy;
+    return copy;
+}
+
+static bool store_find(const EnvironmentStore* store, const char* name, int* chunk, int* entry) {
+    for (int i = 0; i < store->chunk_count; i++) {
+        EnvironmentChunk* c = store->chunks[i];
+        for (int j = 0; j < c->size; j++) {
+            if (strcmp(c->entries[j].key, name) == 0) {
+                *chunk = i;
+                *entry = j;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Stores are only modified while unpublished or owned by a single writer
+static void store_set(EnvironmentStore* store, const char* name, bool value) {
+    int i, j;
+    if (store_find(store, name, &i, &j)) {
+        if (store->chunks[i]->entries[j].value == value) return;
+        store_own_chunk(store, i)->entries[j].value = value;
+        return;
+    }
+    
+    int last = store->chunk_count - 1;
+    if (last < 0 || store->chunks[last]->size == ENVIRONMENT_CHUNK_SIZE) {
+        EnvironmentChunk* chunk = malloc(sizeof(EnvironmentChunk));
+        atomic_init(&chunk->refs, 1);
+        chunk->size = 0;
+        store->chunks = realloc(store->chunks, sizeof(EnvironmentChunk*) * (store->chunk_count + 1));
+        store->chunks[store->chunk_count++] = chunk;
+        last++;
+    }
+    
+    EnvironmentChunk* chunk = store_own_chunk(store, last);
+    chunk->entries[chunk->size].key = strdup(name);
+    chunk->entries[chunk->size].value = value;
+    chunk->size++;
+}
+
+// The last entry of the last chunk fills the gap, so at most two chunks
+// are copied
+static void store_unset(EnvironmentStore* store, const char* name) {
+    int i, j;
+    if (!store_find(store, name, &i, &j)) return;
+    
+    int last = store->chunk_count - 1;
+    EnvironmentChunk* chunk = store_own_chunk(store, i);
+    EnvironmentChunk* tail = store_own_chunk(store, last);
+    free(chunk->entries[j].key);
+    chunk->entries[j] = tail->entries[--tail->size];
+    
+    if (tail->size == 0) {
+        chunk_release(tail);
+        store->chunk_count--;
+    }
+}
+
+static void store_clear(EnvironmentStore* store) {
+    store_release(store);
+    store->chunks = NULL;
+    store->chunk_count = 0;
+}
+
+static bool store_get(const EnvironmentStore* store, const char* name, bool* value) {
+    int i, j;
+    if (!store_find(store, name, &i, &j)) return false;
+    *value = store->chunks[i]->entries[j].value;
+    return true;
+}
+
 Environment* environment_new(void) {
-    Environment* env = malloc(sizeof(Environment));
-    env->store = malloc(sizeof(*env->store) * INITIAL_CAPACITY);
-    env->capacity = INITIAL_CAPACITY;
-    env->size = 0;
+    Environment* env = calloc(1, sizeof(Environment));
+    atomic_init(&env->current, version_new());
+    pthread_mutex_init(&env->write_lock, NULL);
+    atomic_init(&env->epoch, 1);
+    atomic_init(&env->reader_count, 0);
     
-    env->settings = malloc(sizeof(*env->settings) * INITIAL_CAPACITY);
-    env->settings_capacity = INITIAL_CAPACITY;
-    env->settings_size = 0;
+    env->weights = malloc(sizeof(*env->weights) * INITIAL_CAPACITY);
+    env->weights_capacity = INITIAL_CAPACITY;
+    env->weights_size = 0;
     
     return env;
 }
 
+// All readers must have been freed
 void environment_free(Environment* env) {
     if (!env) return;
     
-    for (int i = 0; i < env->size; i++) {
-        free(env->store[i].key);
+    version_release(atomic_load(&env->current));
+    while (env->retired) {
+        EnvironmentVersion* next = env->retired->next_retired;
+        version_release(env->retired);
+        env->retired = next;
     }
-    free(env->store);
+    pthread_mutex_destroy(&env->write_lock);
     
-    for (int i = 0; i < env->settings_size; i++) {
-        free(env->settings[i].key);
+    for (int i = 0; i < env->weights_size; i++) {
+        free(env->weights[i].key);
     }
-    free(env->settings);
+    free(env->weights);
     
     free(env);
 }
 
-static void expand_if_needed(Environment* env) {
-    if (env->size >= env->capacity) {
-        env->capacity *= 2;
-        env->store = realloc(env->store, sizeof(*env->store) * env->capacity);
+// Called with write_lock held. A retired version is freed once every
+// reader that is still pinned pinned it after the version was replaced.
+static void reclaim(Environment* env) {
+    unsigned long oldest = 0;
+    for (EnvironmentReader* r = env->readers; r; r = r->next) {
+        unsigned long epoch = atomic_load(&r->epoch);
+        if (epoch && (!oldest || epoch < oldest)) oldest = epoch;
+    }
+    
+    EnvironmentVersion** link = &env->retired;
+    while (*link) {
+        EnvironmentVersion* version = *link;
+        if (!oldest || version->retired_epoch < oldest) {
+            *link = version->next_retired;
+            version_release(version);
+        } else {
+            link = &version->next_retired;
+        }
     }
 }
 
-static void expand_settings_if_needed(Environment* env) {
-    if (env->settings_size >= env->settings_capacity) {
-        env->settings_capacity *= 2;
-        env->settings = realloc(env->settings, sizeof(*env->settings) * env->settings_capacity);
+typedef enum {
+    SET_VAR,
+    UNSET_VAR,
+    SET_SETTING,
+    SET_SUGGESTION,
+    CLEAR_SUGGESTIONS
+} WriteKind;
+
+static void apply(EnvironmentVersion* version, WriteKind kind, const char* name, bool value) {
+    switch (kind) {
+        case SET_VAR: store_set(&version->vars, name, value); break;
+        case UNSET_VAR: store_unset(&version->vars, name); break;
+        case SET_SETTING:
+            store_set(&version->settings, name, value);
+            if (strcmp(name, ADAPTIVE_EVAL) == 0) version->adaptive_eval = value;
+            break;
+        case SET_SUGGESTION: store_set(&version->suggestions, name, value); break;
+        case CLEAR_SUGGESTIONS: store_clear(&version->suggestions); break;
     }
 }
 
-void environment_set(Environment* env, const char* name, bool value) {
-    for (int i = 0; i < env->size; i++) {
-        if (strcmp(env->store[i].key, name) == 0) {
-            env->store[i].value = value;
-            return;
+static void update(Environment* env, WriteKind kind, const char* name, bool value) {
+    // A reader's view gets its own unpublished version on the first write
+    if (env->view) {
+        if (!env->private_view) {
+            env->view = version_clone(env->view);
+            env->private_view = true;
         }
+        apply(env->view, kind, name, value);
+        return;
+    }
+    
+    pthread_mutex_lock(&env->write_lock);
+    EnvironmentVersion* old = atomic_load(&env->current);
+    
+    // Readers register under the lock, so with none registered nothing
+    // else can see the current version and it is updated in place
+    if (!env->readers) {
+        old->number++;
+        apply(old, kind, name, value);
+        pthread_mutex_unlock(&env->write_lock);
+        return;
     }
     
-    expand_if_needed(env);
-    env->store[env->size].key = strdup(name);
-    env->store[env->size].value = value;
-    env->size++;
+    EnvironmentVersion* version = version_clone(old);
+    apply(version, kind, name, value);
+    atomic_store(&env->current, version);
+    old->retired_epoch = atomic_fetch_add(&env->epoch, 1);
+    old->next_retired = env->retired;
+    env->retired = old;
+    reclaim(env);
+    pthread_mutex_unlock(&env->write_lock);
+}
+
+static EnvironmentVersion* visible(Environment* env) {
+    return env->view ? env->view : atomic_load(&env->current);
+}
+
+void environment_set(Environment* env, const char* name, bool value) {
+    update(env, SET_VAR, name, value);
 }
 
 bool environment_get(Environment* env, const char* name, bool* value) {
-    for (int i = 0; i < env->size; i++) {
-        if (strcmp(env->store[i].key, name) == 0) {
-            *value = env->store[i].value;
-            return true;
+    return store_get(&visible(env)->vars, name, value);
+}
+
+void environment_unset(Environment* env, const char* name) {
+    update(env, UNSET_VAR, name, false);
+}
+
+void environment_set_setting(Environment* env, const char* name, bool value) {
+    update(env, SET_SETTING, name, value);
+}
+
+bool environment_get_setting(Environment* env, const char* name) {
+    bool value = false;
+    store_get(&visible(env)->settings, name, &value);
+    return value;
+}
+
+// Suggestions are kept apart from the variables, so they never change
+// an evaluation until they are accepted
+void environment_suggest(Environment* env, const char* name, bool value) {
+    update(env, SET_SUGGESTION, name, value);
+}
+
+bool environment_get_suggestion(Environment* env, const char* name, bool* value) {
+    return store_get(&visible(env)->suggestions, name, value);
+}
+
+void environment_clear_suggestions(Environment* env) {
+    update(env, CLEAR_SUGGESTIONS, NULL, false);
+}
+
+// Sets every suggested variable that is not set yet, clears the
+// suggestions and returns the number of variables set
+int environment_accept_suggestions(Environment* env) {
+    EnvironmentStore* store = &visible(env)->suggestions;
+    int chunk_count = store->chunk_count;
+    EnvironmentChunk** chunks = malloc(sizeof(EnvironmentChunk*) * (chunk_count + 1));
+    for (int i = 0; i < chunk_count; i++) {
+        chunks[i] = store->chunks[i];
+        atomic_fetch_add(&chunks[i]->refs, 1);  // Kept alive across the writes below
+    }
+
+    int accepted = 0;
+    for (int i = 0; i < chunk_count; i++) {
+        for (int j = 0; j < chunks[i]->size; j++) {
+            bool value;
+            if (environment_get(env, chunks[i]->entries[j].key, &value)) continue;
+            environment_set(env, chunks[i]->entries[j].key, chunks[i]->entries[j].value);
+            accepted++;
         }
+        chunk_release(chunks[i]);
     }
-    return false;
+    free(chunks);
+    environment_clear_suggestions(env);
+    return accepted;
 }
 
-void environment_set_setting(Environment* env, const char* name, bool value) {
-    for (int i = 0; i < env->settings_size; i++) {
-        if (strcmp(env->settings[i].key, name) == 0) {
-            env->settings[i].value = value;
+// Same as environment_get_setting(env, ADAPTIVE_EVAL) without the lookup,
+// except that it is false in a reader's view and while any reader is
+// registered: profiling and reordering write to the expression, which
+// other threads may be evaluating at the same time
+bool environment_adaptive_eval(Environment* env) {
+    if (env->view || atomic_load(&env->reader_count) > 0) return false;
+    return visible(env)->adaptive_eval;
+}
+
+// Increases with every write; two reads of the same number saw the same
+// variables and settings
+unsigned long environment_version(Environment* env) {
+    return visible(env)->number;
+}
+
+// Weights belong to the writing thread, so a reader's view, which has no
+// weight table of its own, cannot take them
+void environment_set_weight(Environment* env, const char* name, long long weight) {
+    assert(!env->view && "weights cannot be set through a reader's view");
+    if (env->view) return;
+
+    for (int i = 0; i < env->weights_size; i++) {
+        if (strcmp(env->weights[i].key, name) == 0) {
+            env->weights[i].value = weight;
             return;
         }
     }
     
-    expand_settings_if_needed(env);
-    env->settings[env->settings_size].key = strdup(name);
-    env->settings[env->settings_size].value = value;
-    env->settings_size++;
+    if (env->weights_size >= env->weights_capacity) {
+        env->weights_capacity *= 2;
+        env->weights = realloc(env->weights, sizeof(*env->weights) * env->weights_capacity);
+    }
+    env->weights[env->weights_size].key = strdup(name);
+    env->weights[env->weights_size].value = weight;
+    env->weights_size++;
 }
 
-bool environment_get_setting(Environment* env, const char* name) {
-    for (int i = 0; i < env->settings_size; i++) {
-        if (strcmp(env->settings[i].key, name) == 0) {
-            return env->settings[i].value;
+// Variables without a weight cost nothing. Weights are not part of a
+// reader's view.
+long long environment_get_weight(Environment* env, const char* name) {
+    for (int i = 0; i < env->weights_size; i++) {
+        if (strcmp(env->weights[i].key, name) == 0) {
+            return env->weights[i].value;
         }
     }
-    return false;
-}
\ No newline at end of file
+    return 0;
+}
+
+EnvironmentReader* environment_reader_new(Environment* env) {
+    EnvironmentReader* reader = calloc(1, sizeof(EnvironmentReader));
+    reader->env = env;
+    atomic_init(&reader->epoch, 0);
+    
+    pthread_mutex_lock(&env->write_lock);
+    reader->next = env->readers;
+    env->readers = reader;
+    atomic_fetch_add(&env->reader_count, 1);
+    pthread_mutex_unlock(&env->write_lock);
+    return reader;
+}
+
+void environment_reader_free(EnvironmentReader* reader) {
+    if (!reader) return;
+    environment_reader_unpin(reader);
+    
+    Environment* env = reader->env;
+    pthread_mutex_lock(&env->write_lock);
+    EnvironmentReader** link = &env->readers;
+    while (*link != reader) link = &(*link)->next;
+    *link = reader->next;
+    atomic_fetch_sub(&env->reader_count, 1);
+    reclaim(env);
+    pthread_mutex_unlock(&env->write_lock);
+    free(reader);
+}
+
+// The returned Environment sees the variables and settings as they were
+// when it was pinned, whatever is written meanwhile, until the reader is
+// unpinned. Writes to it stay private to the view.
+Environment* environment_reader_pin(EnvironmentReader* reader) {
+    // Announcing the epoch before loading the pointer keeps the loaded
+    // version from being reclaimed: it can only have been retired at this
+    // epoch or later
+    if (reader->view.private_view) {
+        version_release(reader->view.view);
+    }
+    atomic_store(&reader->epoch, atomic_load(&reader->env->epoch));
+    reader->view.view = atomic_load(&reader->env->current);
+    reader->view.private_view = false;
+    return &reader->view;
+}
+
+void environment_reader_unpin(EnvironmentReader* reader) {
+    if (reader->view.private_view) {
+        version_release(reader->view.view);
+    }
+    reader->view.view = NULL;
+    reader->view.private_view = false;
+    atomic_store(&reader->epoch, 0);
+}
@@ -9,28 +9,98 @@
 #define ENVIRONMENT_H
 
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
-typedef struct Environment {
+#define ADAPTIVE_EVAL "ADAPTIVE_EVAL"
+#define ENVIRONMENT_CHUNK_SIZE 32
+
+// Variables and settings live in immutable versions. A change never
+// modifies a published version: it copies the one chunk it touches,
+// shares every other chunk with the previous version, and publishes the
+// result with a single atomic pointer store. Other threads read through
+// an EnvironmentReader, which pins the current version for as long as it
+// needs a consistent view, and old versions are freed once no reader
+// can still see them (epoch-based reclamation).
+
+typedef struct {
+    atomic_int refs;  // Versions (published or private) sharing this chunk
+    int size;
     struct {
         char* key;
         bool value;
-    } *store;
-    int capacity;
-    int size;
+    } entries[ENVIRONMENT_CHUNK_SIZE];
+} EnvironmentChunk;
+
+typedef struct {
+    EnvironmentChunk** chunks;  // Every chunk but the last is full
+    int chunk_count;
+} EnvironmentStore;
+
+typedef struct EnvironmentVersion {
+    unsigned long number;
+    EnvironmentStore vars;
+    EnvironmentStore settings;
+    EnvironmentStore suggestions;  // Values proposed by analyses, not yet set
+    bool adaptive_eval;  // The ADAPTIVE_EVAL setting, read on every evaluation
+    unsigned long retired_epoch;
+    struct EnvironmentVersion* next_retired;
+} EnvironmentVersion;
+
+typedef struct EnvironmentReader EnvironmentReader;
+
+typedef struct Environment {
+    _Atomic(EnvironmentVersion*) current;
+    pthread_mutex_t write_lock;  // Serialises writers and reader registration
+    atomic_ulong epoch;
+    EnvironmentVersion* retired;  // Replaced versions not yet freed
+    EnvironmentReader* readers;
+    atomic_int reader_count;  // Length of readers, read without the lock
     
+    // Costs used by OPTIMIZE, charged when the variable is true. They are
+    // not versioned and belong to the writing thread; a reader's view has
+    // none and cannot be given any.
     struct {
         char* key;
-        bool value;
-    } *settings;
-    int settings_capacity;
-    int settings_size;
+        long long value;
+    } *weights;
+    int weights_capacity;
+    int weights_size;
+    
+    // Set only in a reader's view: the pinned version, replaced by a
+    // private one if the view itself is written to
+    EnvironmentVersion* view;
+    bool private_view;
 } Environment;
 
+struct EnvironmentReader {
+    Environment* env;
+    atomic_ulong epoch;  // Epoch at which the view was pinned, 0 when unpinned
+    Environment view;
+    EnvironmentReader* next;
+};
+
+// Outside a reader, an Environment must only be read by the thread that
+// writes to it
 Environment* environment_new(void);
 void environment_free(Environment* env);
 void environment_set(Environment* env, const char* name, bool value);
 bool environment_get(Environment* env, const char* name, bool* value);
+void environment_unset(Environment* env, const char* name);
 void environment_set_setting(Environment* env, const char* name, bool value);
 bool environment_get_setting(Environment* env, const char* name);
+bool environment_adaptive_eval(Environment* env);
+void environment_suggest(Environment* env, const char* name, bool value);
+bool environment_get_suggestion(Environment* env, const char* name, bool* value);
+void environment_clear_suggestions(Environment* env);
+int environment_accept_suggestions(Environment* env);
+void environment_set_weight(Environment* env, const char* name, long long weight);
+long long environment_get_weight(Environment* env, const char* name);
+unsigned long environment_version(Environment* env);
+
+EnvironmentReader* environment_reader_new(Environment* env);
+void environment_reader_free(EnvironmentReader* reader);
+Environment* environment_reader_pin(EnvironmentReader* reader);
+void environment_reader_unpin(EnvironmentReader* reader);
 
 #endif
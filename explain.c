@@ -0,0 +1,178 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "explain.h"
+#include "circuit.h"
+#include "cnf.h"
+#include "sat.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint64_t lane_mask(int lanes) {
+    return lanes >= 64 ? ~0ULL : (1ULL << lanes) - 1;
+}
+
+// Explains the value of expr under env, which must bind all of its
+// variables; otherwise NULL is returned and *unbound receives the name of
+// a missing variable, to be freed by the caller.
+//
+// Critical variables are found 64 at a time: lane i of a pass flips
+// variable start + i, so a single circuit simulation tests 64 flips.
+// The minimal sufficient set is the greedy one (drop each variable in
+// turn if the rest still fix the result), computed with three-valued
+// simulation in which dropped variables are unknown. Lane j of a pass
+// drops the next j + 1 candidates on top of those dropped so far, so the
+// first lane that loses the result names the next variable to keep and
+// every lane before it is accepted at once. Three-valued simulation can
+// lose a result that is in fact fixed (A | ~A is unknown when A is), so
+// a variable it would keep is dropped anyway if a SAT solver shows that
+// the values still known cannot give the other result.
+Explanation* explain(Expression* expr, Environment* env, char** unbound) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+    int slots = n > 0 ? n : 1;
+
+    *unbound = NULL;
+    bool* values = malloc(sizeof(bool) * slots);
+    for (int v = 0; v < n; v++) {
+        if (!environment_get(env, c->vars[v], &values[v])) {
+            *unbound = strdup(c->vars[v]);
+            free(values);
+            circuit_free(c);
+            return NULL;
+        }
+    }
+
+    Explanation* e = malloc(sizeof(Explanation));
+    e->var_count = n;
+    e->values = values;
+    e->vars = malloc(sizeof(char*) * slots);
+    e->critical = calloc(slots, sizeof(bool));
+    e->sufficient = calloc(slots, sizeof(bool));
+    e->passes = 0;
+    e->sat_calls = 0;
+    for (int v = 0; v < n; v++) {
+        e->vars[v] = strdup(c->vars[v]);
+    }
+
+    uint64_t* var_words = malloc(sizeof(uint64_t) * slots);
+    uint64_t* node_values = malloc(sizeof(uint64_t) * c->size);
+    for (int v = 0; v < n; v++) {
+        var_words[v] = values[v] ? ~0ULL : 0;
+    }
+    circuit_simulate(c, var_words, node_values);
+    e->result = node_values[root] & 1;
+    uint64_t result_word = e->result ? ~0ULL : 0;
+
+    for (int start = 0; start < n; start += 64) {
+        int lanes = n - start < 64 ? n - start : 64;
+        for (int i = 0; i < lanes; i++) {
+            var_words[start + i] ^= 1ULL << i;
+        }
+        circuit_simulate(c, var_words, node_values);
+        e->passes++;
+        uint64_t changed = (node_values[root] ^ result_word) & lane_mask(lanes);
+        for (int i = 0; i < lanes; i++) {
+            e->critical[start + i] = (changed >> i) & 1;
+            var_words[start + i] ^= 1ULL << i;
+        }
+    }
+
+    uint64_t* var_true = malloc(sizeof(uint64_t) * slots);
+    uint64_t* var_false = malloc(sizeof(uint64_t) * slots);
+    uint64_t* node_false = malloc(sizeof(uint64_t) * c->size);
+    for (int v = 0; v < n; v++) {
+        var_true[v] = values[v] ? ~0ULL : 0;
+        var_false[v] = ~var_true[v];
+    }
+
+    // Built on the first variable that three-valued simulation keeps
+    SatSolver* solver = NULL;
+    int root_literal = 0;
+    int* assumptions = malloc(sizeof(int) * (n + 1));
+
+    // Variables before pos are settled: known in var_true/var_false if
+    // kept, unknown in every lane if dropped
+    for (int pos = 0; pos < n;) {
+        int lanes = n - pos < 64 ? n - pos : 64;
+        for (int i = 0; i < lanes; i++) {
+            uint64_t known = lane_mask(i);  // Dropped in lane i and every later lane
+            var_true[pos + i] = values[pos + i] ? known : 0;
+            var_false[pos + i] = values[pos + i] ? 0 : known;
+        }
+        circuit_simulate_ternary(c, var_true, var_false, node_values, node_false);
+        e->passes++;
+
+        uint64_t decided = (e->result ? node_values[root] : node_false[root]) & lane_mask(lanes);
+        uint64_t lost = ~decided & lane_mask(lanes);
+        int accepted = lost ? __builtin_ctzll(lost) : lanes;
+
+        for (int i = 0; i < accepted; i++) {
+            var_true[pos + i] = 0;
+            var_false[pos + i] = 0;
+        }
+        if (accepted < lanes) {
+            int kept = pos + accepted;
+            if (!solver) {
+                Cnf* cnf = cnf_from_circuit(c);
+                int* node_literals = calloc(c->size, sizeof(int));
+                root_literal = cnf_encode(cnf, c, root, node_literals);
+                solver = sat_new();
+                sat_reserve_vars(solver, n);
+                sat_add_cnf(solver, cnf, 0);
+                free(node_literals);
+                cnf_free(cnf);
+            }
+            int count = 0;
+            for (int v = 0; v < n; v++) {
+                bool known = v < kept ? e->sufficient[v] : v > kept;
+                if (known) assumptions[count++] = values[v] ? v + 1 : -(v + 1);
+            }
+            assumptions[count++] = e->result ? -root_literal : root_literal;
+            e->sat_calls++;
+            if (sat_solve(solver, assumptions, count)) {
+                e->sufficient[kept] = true;
+                var_true[kept] = values[kept] ? ~0ULL : 0;
+                var_false[kept] = ~var_true[kept];
+            } else {
+                var_true[kept] = 0;
+                var_false[kept] = 0;
+            }
+            accepted++;
+        }
+        // Candidates beyond the accepted prefix are known again
+        for (int i = accepted; i < lanes; i++) {
+            var_true[pos + i] = values[pos + i] ? ~0ULL : 0;
+            var_false[pos + i] = ~var_true[pos + i];
+        }
+        pos += accepted;
+    }
+
+    sat_free(solver);
+    free(assumptions);
+    free(node_false);
+    free(var_false);
+    free(var_true);
+    free(node_values);
+    free(var_words);
+    circuit_free(c);
+    return e;
+}
+
+void explanation_free(Explanation* explanation) {
+    if (!explanation) return;
+
+    for (int v = 0; v < explanation->var_count; v++) {
+        free(explanation->vars[v]);
+    }
+    free(explanation->vars);
+    free(explanation->values);
+    free(explanation->critical);
+    free(explanation->sufficient);
+    free(explanation);
+}
@@ -0,0 +1,29 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include "ast.h"
+#include "environment.h"
+
+// Why an expression has its value under the current environment
+typedef struct {
+    bool result;
+    char** vars;
+    bool* values;
+    int var_count;
+    bool* critical;    // Flipping this variable alone changes the result
+    bool* sufficient;  // Part of a minimal set of values that fixes the result
+    int passes;        // Bit-parallel passes over the circuit
+    int sat_calls;     // Drops that three-valued simulation could not decide
+} Explanation;
+
+Explanation* explain(Expression* expr, Environment* env, char** unbound);
+void explanation_free(Explanation* explanation);
+
+#endif
@@ -10,16 +10,51 @@
 #include <string.h>
 #include <ctype.h>
 
+#define STREAM_BUFFER_SIZE (1 << 16)
+#define INITIAL_IDENTIFIER_CAPACITY 16
+
 Lexer* lexer_new(const char* input) {
     Lexer* l = malloc(sizeof(Lexer));
     l->input = strdup(input);
     l->position = 0;
     l->read_position = 0;
     l->ch = 0;
+    l->length = strlen(input);
+    l->stream = NULL;
+    l->capacity = l->length + 1;
+    lexer_read_char(l);
+    return l;
+}
+
+// A streaming lexer only keeps a fixed-size window of its input in
+// memory, so arbitrarily large inputs can be tokenised in constant space.
+Lexer* lexer_new_stream(FILE* stream) {
+    Lexer* l = malloc(sizeof(Lexer));
+    l->input = malloc(STREAM_BUFFER_SIZE);
+    l->position = 0;
+    l->read_position = 0;
+    l->ch = 0;
+    l->length = 0;
+    l->stream = stream;
+    l->capacity = STREAM_BUFFER_SIZE;
     lexer_read_char(l);
     return l;
 }
 
+// Discards everything before read_position and reads more input behind
+// what is left. Tokens never refer back into the window (identifiers are
+// copied as they are read), so nothing before read_position is needed.
+static void lexer_refill(Lexer* l) {
+    if (l->read_position > (int)l->length) {
+        l->read_position = l->length;  // Already past the end of input
+    }
+    size_t keep = l->length - l->read_position;
+    memmove(l->input, l->input + l->read_position, keep);
+    l->position -= l->read_position;
+    l->read_position = 0;
+    l->length = keep + fread(l->input + keep, 1, l->capacity - keep, l->stream);
+}
+
 void lexer_free(Lexer* l) {
     if (l) {
         free(l->input);
@@ -28,7 +63,10 @@ void lexer_free(Lexer* l) {
 }
 
 void lexer_read_char(Lexer* l) {
-    if (l->read_position >= (int)strlen(l->input)) {
+    if (l->stream && l->read_position >= (int)l->length) {
+        lexer_refill(l);
+    }
+    if (l->read_position >= (int)l->length) {
         l->ch = 0;
     } else {
         l->ch = l->input[l->read_position];
@@ -38,7 +76,10 @@ void lexer_read_char(Lexer* l) {
 }
 
 char lexer_peek_char(Lexer* l) {
-    if (l->read_position >= (int)strlen(l->input)) {
+    if (l->stream && l->read_position >= (int)l->length) {
+        lexer_refill(l);
+    }
+    if (l->read_position >= (int)l->length) {
         return 0;
     }
     return l->input[l->read_position];
@@ -54,14 +95,40 @@ int is_letter(char ch) {
     return isalpha(ch);
 }
 
+// Identifiers start with a letter and may continue with digits and
+// underscores, so DIMACS-style names such as x12 are valid variables.
+int is_identifier_char(char ch) {
+    return isalnum(ch) || ch == '_';
+}
+
+static char* lexer_read_number(Lexer* l) {
+    size_t capacity = INITIAL_IDENTIFIER_CAPACITY;
+    size_t length = 0;
+    char* number = malloc(capacity);
+    while (isdigit(l->ch)) {
+        if (length + 1 >= capacity) {
+            capacity *= 2;
+            number = realloc(number, capacity);
+        }
+        number[length++] = l->ch;
+        lexer_read_char(l);
+    }
+    number[length] = '\0';
+    return number;
+}
+
 char* lexer_read_identifier(Lexer* l) {
-    int start_pos = l->position;
-    while (is_letter(l->ch)) {
+    size_t capacity = INITIAL_IDENTIFIER_CAPACITY;
+    size_t length = 0;
+    char* identifier = malloc(capacity);
+    while (is_identifier_char(l->ch)) {
+        if (length + 1 >= capacity) {
+            capacity *= 2;
+            identifier = realloc(identifier, capacity);
+        }
+        identifier[length++] = l->ch;
         lexer_read_char(l);
     }
-    int length = l->position - start_pos;
-    char* identifier = malloc(length + 1);
-    strncpy(identifier, &l->input[start_pos], length);
     identifier[length] = '\0';
     return identifier;
 }
@@ -91,6 +158,12 @@ Token* lexer_next_token(Lexer* l) {
         case '^':
             tok = token_new(T_XOR, ch_str);
             break;
+        case '.':
+            tok = token_new(T_DOT, ch_str);
+            break;
+        case ',':
+            tok = token_new(T_COMMA, ch_str);
+            break;
         case '-':
             if (lexer_peek_char(l) == '>') {
                 lexer_read_char(l);
@@ -124,11 +197,26 @@ Token* lexer_next_token(Lexer* l) {
                     tok = token_new(T_TRUE, ident);
                 } else if (strcmp(ident, "false") == 0) {
                     tok = token_new(T_FALSE, ident);
+                } else if (strcmp(ident, "forall") == 0) {
+                    tok = token_new(T_FORALL, ident);
+                } else if (strcmp(ident, "exists") == 0) {
+                    tok = token_new(T_EXISTS, ident);
+                } else if (strcmp(ident, "ATMOST") == 0) {
+                    tok = token_new(T_ATMOST, ident);
+                } else if (strcmp(ident, "ATLEAST") == 0) {
+                    tok = token_new(T_ATLEAST, ident);
+                } else if (strcmp(ident, "EXACTLY") == 0) {
+                    tok = token_new(T_EXACTLY, ident);
                 } else {
                     tok = token_new(T_IDENT, ident);
                 }
                 free(ident);
                 return tok;
+            } else if (isdigit(l->ch)) {
+                char* number = lexer_read_number(l);
+                tok = token_new(T_INT, number);
+                free(number);
+                return tok;
             } else {
                 tok = token_new(T_ILLEGAL, ch_str);
             }
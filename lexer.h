@@ -9,15 +9,21 @@
 #define LEXER_H
 
 #include "token.h"
+#include <stdio.h>
+#include <stddef.h>
 
 typedef struct {
     char* input;
     int position;
     int read_position;
     char ch;
+    size_t length;    // Number of valid bytes in input
+    FILE* stream;     // When set, input is a window that is refilled from it
+    size_t capacity;
 } Lexer;
 
 Lexer* lexer_new(const char* input);
+Lexer* lexer_new_stream(FILE* stream);
 void lexer_free(Lexer* l);
 Token* lexer_next_token(Lexer* l);
 void lexer_read_char(Lexer* l);
@@ -25,5 +31,6 @@ char lexer_peek_char(Lexer* l);
 void lexer_skip_whitespace(Lexer* l);
 char* lexer_read_identifier(Lexer* l);
 int is_letter(char ch);
+int is_identifier_char(char ch);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,272 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "lutmap.h"
+#include "circuit.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Cuts kept per node besides the trivial one. Keeping only the best few
+// (priority cuts) bounds the work per node whatever the circuit's shape.
+#define MAX_CUTS 8
+
+// A cut of a node is a set of nodes (leaves) such that every path from
+// the variables to the node passes through one of them. Its table gives
+// the node's value as a function of the leaves.
+typedef struct {
+    int leaves[LUTMAP_MAX_INPUTS];
+    int size;
+    uint64_t table;
+    double flow;  // Estimated LUTs needed to implement the node with this cut
+} Cut;
+
+typedef struct {
+    Cut cuts[MAX_CUTS + 1];
+    int count;
+} CutSet;
+
+// Bit r of projections[j] is bit j of r
+static const uint64_t projections[LUTMAP_MAX_INPUTS] = {
+    0xAAAAAAAAAAAAAAAAULL, 0xCCCCCCCCCCCCCCCCULL, 0xF0F0F0F0F0F0F0F0ULL,
+    0xFF00FF00FF00FF00ULL, 0xFFFF0000FFFF0000ULL, 0xFFFFFFFF00000000ULL
+};
+
+static bool merge_leaves(const Cut* a, const Cut* b, int k, Cut* out) {
+    int i = 0, j = 0;
+    out->size = 0;
+    while (i < a->size || j < b->size) {
+        int next;
+        if (j == b->size || (i < a->size && a->leaves[i] < b->leaves[j])) {
+            next = a->leaves[i++];
+        } else if (i == a->size || b->leaves[j] < a->leaves[i]) {
+            next = b->leaves[j++];
+        } else {
+            next = a->leaves[i++];
+            j++;
+        }
+        if (out->size == k) return false;
+        out->leaves[out->size++] = next;
+    }
+    return true;
+}
+
+// Re-expresses the table of cut over the larger leaf set of into
+static uint64_t expand_table(const Cut* cut, const Cut* into) {
+    int positions[LUTMAP_MAX_INPUTS];
+    for (int j = 0, p = 0; j < cut->size; j++) {
+        while (into->leaves[p] != cut->leaves[j]) p++;
+        positions[j] = p;
+    }
+    uint64_t table = 0;
+    for (int r = 0; r < 64; r++) {
+        int row = 0;
+        for (int j = 0; j < cut->size; j++) {
+            row |= ((r >> positions[j]) & 1) << j;
+        }
+        table |= ((cut->table >> row) & 1) << r;
+    }
+    return table;
+}
+
+static int compare_cuts(const void* x, const void* y) {
+    const Cut* a = x;
+    const Cut* b = y;
+    if (a->flow != b->flow) return a->flow < b->flow ? -1 : 1;
+    return a->size - b->size;
+}
+
+static bool same_leaves(const Cut* a, const Cut* b) {
+    return a->size == b->size && memcmp(a->leaves, b->leaves, sizeof(int) * a->size) == 0;
+}
+
+// Area flow: one LUT for the node plus each gate leaf's own flow, shared
+// between the nodes that use it
+static double cut_flow(const Cut* cut, Circuit* c, const double* flow, const int* fanout) {
+    double total = 1;
+    for (int j = 0; j < cut->size; j++) {
+        int leaf = cut->leaves[j];
+        if (c->nodes[leaf].op == CIRCUIT_VAR) continue;
+        total += flow[leaf] / (fanout[leaf] > 0 ? fanout[leaf] : 1);
+    }
+    return total;
+}
+
+// Fills set with the best cuts of node i, followed by its trivial cut
+// (the node alone), which only its parents may use
+static void enumerate_cuts(Circuit* c, int i, int k, CutSet* sets, double* flow, const int* fanout) {
+    CircuitNode* node = &c->nodes[i];
+    CutSet* set = &sets[i];
+    set->count = 0;
+
+    if (node->op == CIRCUIT_CONST) {
+        set->cuts[0] = (Cut){.size = 0, .table = node->a ? ~0ULL : 0, .flow = 1};
+        set->count = 1;
+        flow[i] = 1;
+    } else if (node->op == CIRCUIT_NOT) {
+        CutSet* child = &sets[node->a];
+        for (int j = 0; j < child->count; j++) {
+            Cut* cut = &set->cuts[j];
+            *cut = child->cuts[j];
+            cut->table = ~cut->table;
+            cut->flow = cut_flow(cut, c, flow, fanout);
+        }
+        qsort(set->cuts, child->count, sizeof(Cut), compare_cuts);
+        set->count = child->count < MAX_CUTS ? child->count : MAX_CUTS;
+    } else if (node->op != CIRCUIT_VAR) {
+        CutSet* left = &sets[node->a];
+        CutSet* right = &sets[node->b];
+        Cut candidates[(MAX_CUTS + 1) * (MAX_CUTS + 1)];
+        int count = 0;
+        for (int x = 0; x < left->count; x++) {
+            for (int y = 0; y < right->count; y++) {
+                Cut cut;
+                if (!merge_leaves(&left->cuts[x], &right->cuts[y], k, &cut)) continue;
+                bool duplicate = false;
+                for (int z = 0; z < count && !duplicate; z++) {
+                    duplicate = same_leaves(&candidates[z], &cut);
+                }
+                if (duplicate) continue;
+                cut.table = circuit_apply(node->op, expand_table(&left->cuts[x], &cut),
+                                          expand_table(&right->cuts[y], &cut));
+                cut.flow = cut_flow(&cut, c, flow, fanout);
+                candidates[count++] = cut;
+            }
+        }
+        qsort(candidates, count, sizeof(Cut), compare_cuts);
+        set->count = count < MAX_CUTS ? count : MAX_CUTS;
+        memcpy(set->cuts, candidates, sizeof(Cut) * set->count);
+    }
+
+    if (node->op != CIRCUIT_CONST) {
+        if (node->op != CIRCUIT_VAR) flow[i] = set->cuts[0].flow;
+        set->cuts[set->count++] = (Cut){.leaves = {i}, .size = 1, .table = projections[0], .flow = 0};
+    }
+}
+
+// Maps expr onto LUTs of at most k inputs (clamped to 2..6). Every gate
+// gets a set of cuts built bottom-up from its children's, each with its
+// truth table; the cover then takes, from the result down, the cut with
+// the least area flow at each node it needs, which keeps the LUT count
+// low while letting shared subterms be implemented once.
+LutNetwork* lutmap(Expression* expr, int k) {
+    if (k < 2) k = 2;
+    if (k > LUTMAP_MAX_INPUTS) k = LUTMAP_MAX_INPUTS;
+
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int size = root + 1;
+
+    // Only the cone of the root is mapped
+    bool* needed = calloc(size, sizeof(bool));
+    int* fanout = calloc(size, sizeof(int));
+    needed[root] = true;
+    int gate_count = 0;
+    for (int i = root; i >= 0; i--) {
+        if (!needed[i]) continue;
+        CircuitNode* node = &c->nodes[i];
+        if (node->op == CIRCUIT_CONST || node->op == CIRCUIT_VAR) continue;
+        gate_count++;
+        needed[node->a] = true;
+        fanout[node->a]++;
+        if (node->op != CIRCUIT_NOT) {
+            needed[node->b] = true;
+            fanout[node->b]++;
+        }
+    }
+
+    CutSet* sets = malloc(sizeof(CutSet) * size);
+    double* flow = calloc(size, sizeof(double));
+    for (int i = 0; i < size; i++) {
+        if (needed[i]) enumerate_cuts(c, i, k, sets, flow, fanout);
+    }
+
+    // Choose the cover: a node is implemented when its output is the
+    // result or a leaf of a chosen cut
+    for (int i = 0; i < size; i++) {
+        needed[i] = false;
+    }
+    needed[root] = true;
+    for (int i = root; i >= 0; i--) {
+        if (!needed[i] || c->nodes[i].op == CIRCUIT_VAR) continue;
+        Cut* best = &sets[i].cuts[0];
+        for (int j = 0; j < best->size; j++) {
+            needed[best->leaves[j]] = true;
+        }
+    }
+
+    LutNetwork* net = malloc(sizeof(LutNetwork));
+    net->var_count = c->var_count;
+    net->vars = malloc(sizeof(char*) * (c->var_count > 0 ? c->var_count : 1));
+    for (int v = 0; v < c->var_count; v++) {
+        net->vars[v] = strdup(c->vars[v]);
+    }
+    net->gate_count = gate_count;
+    net->luts = malloc(sizeof(Lut) * size);
+    net->lut_count = 0;
+    net->depth = 0;
+
+    int* signal = malloc(sizeof(int) * size);
+    int* level = calloc(size, sizeof(int));
+    for (int i = 0; i < size; i++) {
+        if (!needed[i]) continue;
+        if (c->nodes[i].op == CIRCUIT_VAR) {
+            signal[i] = c->nodes[i].a;
+            if (i != root) continue;
+        }
+
+        // A variable at the root still gets a LUT so the result is always
+        // the last one
+        Cut* best = c->nodes[i].op == CIRCUIT_VAR ? &sets[i].cuts[sets[i].count - 1] : &sets[i].cuts[0];
+        Lut* lut = &net->luts[net->lut_count];
+        lut->input_count = best->size;
+        lut->table = best->table;
+        for (int j = 0; j < best->size; j++) {
+            int leaf = best->leaves[j];
+            lut->inputs[j] = signal[leaf];
+            if (level[leaf] > level[i]) level[i] = level[leaf];
+        }
+        level[i]++;
+        if (level[i] > net->depth) net->depth = level[i];
+        signal[i] = net->var_count + net->lut_count++;
+    }
+    net->signals = malloc(sizeof(bool) * (net->var_count + net->lut_count));
+
+    free(level);
+    free(signal);
+    free(flow);
+    free(sets);
+    free(fanout);
+    free(needed);
+    circuit_free(c);
+    return net;
+}
+
+// values holds one value per variable, in the order of net->vars
+bool lutmap_eval(LutNetwork* net, const bool* values) {
+    bool* signals = net->signals;
+    memcpy(signals, values, sizeof(bool) * net->var_count);
+    for (int i = 0; i < net->lut_count; i++) {
+        Lut* lut = &net->luts[i];
+        int row = 0;
+        for (int j = 0; j < lut->input_count; j++) {
+            row |= signals[lut->inputs[j]] << j;
+        }
+        signals[net->var_count + i] = (lut->table >> row) & 1;
+    }
+    return signals[net->var_count + net->lut_count - 1];
+}
+
+void lutmap_free(LutNetwork* net) {
+    if (!net) return;
+    for (int v = 0; v < net->var_count; v++) {
+        free(net->vars[v]);
+    }
+    free(net->vars);
+    free(net->luts);
+    free(net->signals);
+    free(net);
+}
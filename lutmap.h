@@ -0,0 +1,40 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef LUTMAP_H
+#define LUTMAP_H
+
+#include "ast.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LUTMAP_MAX_INPUTS 6
+
+// An expression mapped onto lookup tables of at most k inputs. Signals
+// 0 to var_count - 1 are the variables and var_count + i is the output of
+// LUT i. LUTs are in topological order and the last one is the result.
+typedef struct {
+    int inputs[LUTMAP_MAX_INPUTS];
+    int input_count;
+    uint64_t table;  // Bit i is the output when input j has the value of bit j of i
+} Lut;
+
+typedef struct {
+    char** vars;
+    int var_count;
+    Lut* luts;
+    int lut_count;
+    int gate_count;  // Gates of the circuit the LUTs replace
+    int depth;       // LUTs on the longest path
+    bool* signals;   // Scratch space for lutmap_eval
+} LutNetwork;
+
+LutNetwork* lutmap(Expression* expr, int k);
+bool lutmap_eval(LutNetwork* net, const bool* values);
+void lutmap_free(LutNetwork* net);
+
+#endif
@@ -6,9 +6,38 @@
    (at your option) any later version. */
    
 #include "repl.h"
+#include "rules.h"
+#include "codegen.h"
 #include <stdio.h>
+#include <string.h>
 
-int main(void) {
-    start_repl();
-    return 0;
+static int usage(void) {
+    fprintf(stderr, "Usage: logos [--emit-c <rules-file> [-o <output-stem>]]\n");
+    return 1;
+}
+
+static int emit_c(const char* path, const char* output_stem) {
+    RuleSet* rules = rules_load(path);
+    if (!rules) return 1;
+
+    int status = codegen_emit_c(rules, path, output_stem);
+    rules_free(rules);
+    return status;
+}
+
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        start_repl();
+        return 0;
+    }
+
+    if (argc == 3 && strcmp(argv[1], "--emit-c") == 0) {
+        return emit_c(argv[2], NULL);
+    }
+
+    if (argc == 5 && strcmp(argv[1], "--emit-c") == 0 && strcmp(argv[3], "-o") == 0) {
+        return emit_c(argv[2], argv[4]);
+    }
+
+    return usage();
 }
\ No newline at end of file
@@ -0,0 +1,210 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "optimize.h"
+#include "circuit.h"
+#include "cnf.h"
+#include "sat.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define UNDECIDED -1
+
+typedef struct {
+    SatSolver* solver;
+    Optimum* best;
+    OptimizeCallback improved;
+    void* data;
+
+    int* weighted;  // DIMACS variables with a positive weight, heaviest first
+    long long* weights;  // Indexed like weighted
+    int weighted_count;
+    signed char* decided;  // Branching decision per weighted index, or UNDECIDED
+    char* in_core;
+    int* assumptions;
+} Search;
+
+static long long model_cost(Search* s) {
+    long long cost = 0;
+    for (int i = 0; i < s->weighted_count; i++) {
+        if (sat_model_value(s->solver, s->weighted[i])) cost += s->weights[i];
+    }
+    return cost;
+}
+
+static void record_model(Search* s, long long cost) {
+    Optimum* best = s->best;
+    if (best->satisfiable && cost >= best->cost) return;
+
+    best->satisfiable = true;
+    best->cost = cost;
+    for (int v = 0; v < best->var_count; v++) {
+        best->values[v] = sat_model_value(s->solver, v + 1);
+    }
+    if (s->improved) s->improved(cost, s->data);
+}
+
+// Lower bound on the extra cost of the undecided variables, from disjoint
+// cores: with every undecided weighted variable assumed false, each
+// unsatisfiable core forces at least one of its variables true, so the
+// cheapest of them is added and the whole core is set aside before
+// solving again. The final satisfiable call gives a model that is
+// recorded if it improves the best. Returns -1 when the decisions alone
+// are infeasible.
+static long long lower_bound(Search* s, long long* model_extra) {
+    memset(s->in_core, 0, s->weighted_count);
+    long long bound = 0;
+
+    for (;;) {
+        int count = 0;
+        for (int i = 0; i < s->weighted_count; i++) {
+            if (s->decided[i] != UNDECIDED) {
+                s->assumptions[count++] = s->decided[i] ? s->weighted[i] : -s->weighted[i];
+            }
+        }
+        for (int i = 0; i < s->weighted_count; i++) {
+            if (s->decided[i] == UNDECIDED && !s->in_core[i]) {
+                s->assumptions[count++] = -s->weighted[i];
+            }
+        }
+
+        s->best->sat_calls++;
+        if (sat_solve(s->solver, s->assumptions, count)) {
+            *model_extra = model_cost(s);
+            record_model(s, *model_extra);
+            return bound;
+        }
+
+        // Only the assumed-false undecided variables can be relaxed
+        long long cheapest = -1;
+        for (int k = 0; k < s->solver->core_size; k++) {
+            int literal = s->solver->core[k];
+            for (int i = 0; i < s->weighted_count; i++) {
+                if (s->decided[i] == UNDECIDED && !s->in_core[i] && literal == -s->weighted[i]) {
+                    s->in_core[i] = 1;
+                    if (cheapest < 0 || s->weights[i] < cheapest) cheapest = s->weights[i];
+                }
+            }
+        }
+        if (cheapest < 0) return -1;
+        bound += cheapest;
+    }
+}
+
+// Depth-first branch and bound over the weighted variables, heaviest
+// first, trying the free (false) branch before the costly one. A subtree
+// is cut when its decided cost plus the core lower bound cannot beat the
+// best solution, or when the model found while bounding already meets
+// the bound.
+static void branch(Search* s, int next, long long decided_cost) {
+    long long model_extra;
+    long long bound = lower_bound(s, &model_extra);
+    if (bound < 0) return;
+    if (decided_cost + bound >= s->best->cost) return;
+    if (model_extra == decided_cost + bound) return;
+
+    while (next < s->weighted_count && s->decided[next] != UNDECIDED) next++;
+    if (next == s->weighted_count) return;
+
+    s->decided[next] = 0;
+    branch(s, next + 1, decided_cost);
+    s->decided[next] = 1;
+    branch(s, next + 1, decided_cost + s->weights[next]);
+    s->decided[next] = UNDECIDED;
+}
+
+static int compare_weights(const void* a, const void* b) {
+    long long x = ((const long long*)a)[0];
+    long long y = ((const long long*)b)[0];
+    return (x < y) - (x > y);
+}
+
+// Finds a model of expr minimising the total weight (from env) of the
+// variables set to true
+Optimum* optimize(Expression* expr, Environment* env, OptimizeCallback improved, void* data) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+
+    Optimum* best = malloc(sizeof(Optimum));
+    best->satisfiable = false;
+    best->cost = 0;
+    best->var_count = n;
+    best->sat_calls = 0;
+    best->vars = malloc(sizeof(char*) * (n > 0 ? n : 1));
+    best->values = calloc(n > 0 ? n : 1, sizeof(bool));
+    for (int v = 0; v < n; v++) {
+        best->vars[v] = strdup(c->vars[v]);
+    }
+
+    Cnf* cnf = cnf_from_circuit(c);
+    int* node_literals = calloc(c->size, sizeof(int));
+    int literal = cnf_encode(cnf, c, root, node_literals);
+    cnf_add_clause(cnf, &literal, 1);
+
+    Search s;
+    s.solver = sat_new();
+    sat_reserve_vars(s.solver, n);
+    sat_add_cnf(s.solver, cnf, 0);
+    s.best = best;
+    s.improved = improved;
+    s.data = data;
+
+    // Pairs of (weight, variable), sorted heaviest first
+    long long* pairs = malloc(sizeof(long long) * 2 * (n > 0 ? n : 1));
+    s.weighted_count = 0;
+    for (int v = 0; v < n; v++) {
+        long long weight = environment_get_weight(env, c->vars[v]);
+        if (weight > 0) {
+            pairs[2 * s.weighted_count] = weight;
+            pairs[2 * s.weighted_count + 1] = v + 1;
+            s.weighted_count++;
+        }
+    }
+    qsort(pairs, s.weighted_count, sizeof(long long) * 2, compare_weights);
+
+    int slots = s.weighted_count > 0 ? s.weighted_count : 1;
+    s.weighted = malloc(sizeof(int) * slots);
+    s.weights = malloc(sizeof(long long) * slots);
+    s.decided = malloc(slots);
+    s.in_core = malloc(slots);
+    s.assumptions = malloc(sizeof(int) * slots);
+    for (int i = 0; i < s.weighted_count; i++) {
+        s.weights[i] = pairs[2 * i];
+        s.weighted[i] = (int)pairs[2 * i + 1];
+        s.decided[i] = UNDECIDED;
+    }
+    free(pairs);
+
+    best->sat_calls++;
+    if (sat_solve(s.solver, NULL, 0)) {
+        record_model(&s, model_cost(&s));
+        branch(&s, 0, 0);
+    }
+
+    free(s.assumptions);
+    free(s.in_core);
+    free(s.decided);
+    free(s.weights);
+    free(s.weighted);
+    sat_free(s.solver);
+    free(node_literals);
+    cnf_free(cnf);
+    circuit_free(c);
+    return best;
+}
+
+void optimum_free(Optimum* optimum) {
+    if (!optimum) return;
+
+    for (int v = 0; v < optimum->var_count; v++) {
+        free(optimum->vars[v]);
+    }
+    free(optimum->vars);
+    free(optimum->values);
+    free(optimum);
+}
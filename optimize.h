@@ -0,0 +1,29 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+#include "environment.h"
+
+// Called with every solution that is cheaper than all found before it
+typedef void (*OptimizeCallback)(long long cost, void* data);
+
+typedef struct {
+    bool satisfiable;
+    long long cost;
+    char** vars;
+    bool* values;  // A minimum-cost model, one value per variable
+    int var_count;
+    int sat_calls;
+} Optimum;
+
+Optimum* optimize(Expression* expr, Environment* env, OptimizeCallback improved, void* data);
+void optimum_free(Optimum* optimum);
+
+#endif
@@ -0,0 +1,372 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "parallel.h"
+#include "parser.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_THREADS 64
+
+int parallel_thread_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) return 1;
+    return n > MAX_THREADS ? MAX_THREADS : (int)n;
+}
+
+// Runs work(arg + i * arg_size) for i in [0, threads) on separate threads
+static void run_threads(void* (*work)(void*), void* args, size_t arg_size, int threads) {
+    pthread_t ids[MAX_THREADS];
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&ids[i], NULL, work, (char*)args + i * arg_size);
+    }
+    work(args);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+}
+
+static void parse_job(ParseJob* job, bool require_eof) {
+    char* source = strndup(job->text, job->length);
+    Lexer* l = lexer_new(source);
+    Parser* p = parser_new(l);
+    job->formula = parser_parse_expression(p, PREC_LOWEST);
+
+    if (require_eof && p->error_count == 0 && p->peek_token->type != T_EOF) {
+        parser_add_error(p, "unexpected input after expression");
+    }
+
+    job->error_count = p->error_count;
+    job->errors = NULL;
+    if (p->error_count > 0) {
+        // The parser only returns complete trees, so whatever was parsed
+        // before the error can be freed
+        if (job->formula) job->formula->free(job->formula);
+        job->formula = NULL;
+        job->errors = malloc(sizeof(char*) * p->error_count);
+        for (int i = 0; i < p->error_count; i++) {
+            job->errors[i] = strdup(p->errors[i]);
+        }
+    }
+
+    parser_free(p);
+    lexer_free(l);
+    free(source);
+}
+
+typedef struct {
+    ParseJob* jobs;
+    int begin;
+    int end;
+    bool require_eof;
+} JobRange;
+
+static void* parse_job_range(void* arg) {
+    JobRange* range = arg;
+    for (int i = range->begin; i < range->end; i++) {
+        parse_job(&range->jobs[i], range->require_eof);
+    }
+    return NULL;
+}
+
+static void parse_jobs(ParseJob* jobs, int count, int threads, bool require_eof) {
+    if (threads > count) threads = count;
+    if (threads < 1) threads = 1;
+
+    JobRange ranges[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        ranges[t].jobs = jobs;
+        ranges[t].begin = (int)((long long)count * t / threads);
+        ranges[t].end = (int)((long long)count * (t + 1) / threads);
+        ranges[t].require_eof = require_eof;
+    }
+    run_threads(parse_job_range, ranges, sizeof(JobRange), threads);
+}
+
+// Parses independent lines (e.g. the formulas of a rules file), giving
+// each thread a contiguous block of lines.
+void parallel_parse_lines(ParseJob* jobs, int count, int threads) {
+    parse_jobs(jobs, count, threads, false);
+}
+
+// Operators found outside any parentheses, in the order they occur
+typedef struct {
+    size_t position;
+    int length;
+    TokenType type;
+    int precedence;
+} TopLevelOp;
+
+typedef struct {
+    const char* text;
+    size_t length;
+    size_t begin;
+    size_t end;
+    int depth_delta;    // Phase 1: net change in paren depth over the range
+    int start_depth;    // Phase 2: depth at the start of the range
+    TopLevelOp* ops;    // Phase 2: top-level operators starting in the range
+    int op_count;
+    int op_capacity;
+    int min_precedence;
+    bool quantified;    // Phase 2: a quantifier scope opens at depth 0
+} ScanRange;
+
+static void* scan_depth(void* arg) {
+    ScanRange* range = arg;
+    int delta = 0;
+    for (size_t i = range->begin; i < range->end; i++) {
+        delta += (range->text[i] == '(') - (range->text[i] == ')');
+    }
+    range->depth_delta = delta;
+    return NULL;
+}
+
+// Recognises the operator starting at position i, if any. Multi-byte
+// operators are owned by the range holding their first byte, so a '-'
+// preceded by '<' is the middle of a <-> and is skipped.
+static int operator_at(const char* text, size_t length, size_t i, TokenType* type) {
+    switch (text[i]) {
+        case '&': *type = T_AND; return 1;
+        case '|': *type = T_OR; return 1;
+        case '^': *type = T_XOR; return 1;
+        case '-':
+            if (i + 1 < length && text[i + 1] == '>' && (i == 0 || text[i - 1] != '<')) {
+                *type = T_IMPLIES;
+                return 2;
+            }
+            return 0;
+        case '<':
+            if (i + 2 < length && text[i + 1] == '-' && text[i + 2] == '>') {
+                *type = T_IFF;
+                return 3;
+            }
+            return 0;
+        default:
+            return 0;
+    }
+}
+
+static int precedence_of(TokenType type) {
+    switch (type) {
+        case T_IFF: return PREC_EQUALS;
+        case T_IMPLIES: return PREC_IMPLIES;
+        case T_AND: return PREC_AND;
+        default: return PREC_OR_XOR;
+    }
+}
+
+static void* scan_operators(void* arg) {
+    ScanRange* range = arg;
+    int depth = range->start_depth;
+    range->ops = NULL;
+    range->op_count = 0;
+    range->op_capacity = 0;
+    range->min_precedence = PREC_PREFIX;
+    range->quantified = false;
+
+    for (size_t i = range->begin; i < range->end; i++) {
+        char ch = range->text[i];
+        if (ch == '(') {
+            depth++;
+        } else if (ch == ')') {
+            depth--;
+        } else if (depth == 0 && ch == '.') {
+            range->quantified = true;
+        } else if (depth == 0) {
+            TokenType type;
+            int len = operator_at(range->text, range->length, i, &type);
+            if (len == 0) continue;
+
+            if (range->op_count >= range->op_capacity) {
+                range->op_capacity = range->op_capacity ? range->op_capacity * 2 : 64;
+                range->ops = realloc(range->ops, sizeof(TopLevelOp) * range->op_capacity);
+            }
+            TopLevelOp* op = &range->ops[range->op_count++];
+            op->position = i;
+            op->length = len;
+            op->type = type;
+            op->precedence = precedence_of(type);
+            if (op->precedence < range->min_precedence) {
+                range->min_precedence = op->precedence;
+            }
+        }
+    }
+    return NULL;
+}
+
+static bool is_space(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n';
+}
+
+// Narrows the balanced text [*begin, *end) to the inside of every pair of
+// parentheses enclosing all of it, in one pass. With n leading '(' and m
+// trailing ')', the outermost k = min(n, m) pairs enclose everything
+// unless the depth in between falls below k, in which case it is the
+// lowest depth reached. Returns false if there is nothing to strip.
+static bool strip_parens(const char* text, size_t* begin, size_t* end) {
+    size_t b = *begin, e = *end;
+    int lead = 0, trail = 0;
+    for (; b < e && (text[b] == '(' || is_space(text[b])); b++) lead += text[b] == '(';
+    for (; e > b && (text[e - 1] == ')' || is_space(text[e - 1])); e--) trail += text[e - 1] == ')';
+
+    int depth = lead;
+    int strip = lead < trail ? lead : trail;
+    for (size_t i = b; i < e && strip > 0; i++) {
+        if (text[i] == '(') depth++;
+        else if (text[i] == ')' && --depth < strip) strip = depth;
+    }
+    if (strip <= 0) return false;
+
+    for (int n = 0; n < strip; (*begin)++) n += text[*begin] == '(';
+    for (int n = 0; n < strip; (*end)--) n += text[*end - 1] == ')';
+    return true;
+}
+
+static Expression* parse_serial(const char* text, size_t length, char** error) {
+    ParseJob job = { text, length, NULL, NULL, 0 };
+    parse_job(&job, true);
+    if (job.error_count > 0) {
+        *error = job.errors[0];
+        for (int i = 1; i < job.error_count; i++) free(job.errors[i]);
+        free(job.errors);
+    }
+    return job.formula;
+}
+
+// Parses one very large expression on several threads. A parallel prefix
+// scan of paren depth finds the operators at nesting depth 0; the input
+// is cut at every top-level operator of the loosest precedence present,
+// the pieces are parsed independently, and the resulting trees are
+// joined left to right exactly as the Pratt parser would associate them.
+// On failure NULL is returned and *error holds a message to free.
+Expression* parallel_parse_expression(const char* text, size_t length, int threads, char** error) {
+    *error = NULL;
+    if (threads < 2 || length == 0) {
+        return parse_serial(text, length, error);
+    }
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+    ScanRange ranges[MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        ranges[t].text = text;
+        ranges[t].length = length;
+        ranges[t].begin = length * t / threads;
+        ranges[t].end = length * (t + 1) / threads;
+    }
+    run_threads(scan_depth, ranges, sizeof(ScanRange), threads);
+
+    int depth = 0;
+    for (int t = 0; t < threads; t++) {
+        ranges[t].start_depth = depth;
+        depth += ranges[t].depth_delta;
+    }
+    run_threads(scan_operators, ranges, sizeof(ScanRange), threads);
+
+    // A top-level quantifier body runs to the end of the text, so the
+    // operators after it cannot be split on
+    bool quantified = false;
+    for (int t = 0; t < threads; t++) {
+        quantified |= ranges[t].quantified;
+    }
+    if (quantified) {
+        for (int t = 0; t < threads; t++) free(ranges[t].ops);
+        return parse_serial(text, length, error);
+    }
+
+    int min_precedence = PREC_PREFIX;
+    int total_ops = 0;
+    for (int t = 0; t < threads; t++) {
+        if (ranges[t].min_precedence < min_precedence) min_precedence = ranges[t].min_precedence;
+    }
+    for (int t = 0; t < threads; t++) {
+        for (int i = 0; i < ranges[t].op_count; i++) {
+            total_ops += ranges[t].ops[i].precedence == min_precedence;
+        }
+    }
+
+    if (total_ops == 0 || depth != 0) {
+        for (int t = 0; t < threads; t++) free(ranges[t].ops);
+
+        // A single operand: strip its enclosing parens, after which the
+        // inside may split at top-level operators again
+        size_t begin = 0, end = length;
+        if (depth == 0 && strip_parens(text, &begin, &end)) {
+            return parallel_parse_expression(text + begin, end - begin, threads, error);
+        }
+        return parse_serial(text, length, error);
+    }
+
+    TopLevelOp* ops = malloc(sizeof(TopLevelOp) * total_ops);
+    int op_count = 0;
+    for (int t = 0; t < threads; t++) {
+        for (int i = 0; i < ranges[t].op_count; i++) {
+            if (ranges[t].ops[i].precedence == min_precedence) {
+                ops[op_count++] = ranges[t].ops[i];
+            }
+        }
+        free(ranges[t].ops);
+    }
+
+    int operand_count = op_count + 1;
+    ParseJob* jobs = malloc(sizeof(ParseJob) * operand_count);
+    size_t start = 0;
+    for (int i = 0; i < operand_count; i++) {
+        size_t stop = i < op_count ? ops[i].position : length;
+        jobs[i].text = text + start;
+        jobs[i].length = stop - start;
+        if (i < op_count) start = ops[i].position + ops[i].length;
+    }
+    parse_jobs(jobs, operand_count, threads, true);
+
+    Expression* result = NULL;
+    for (int i = 0; i < operand_count; i++) {
+        if (jobs[i].error_count > 0 && !*error) {
+            *error = strdup(jobs[i].errors[0]);
+        }
+        for (int e = 0; e < jobs[i].error_count; e++) free(jobs[i].errors[e]);
+        free(jobs[i].errors);
+    }
+
+    if (!*error) {
+        static const char* literals[] = {
+            [T_AND] = "&", [T_OR] = "|", [T_XOR] = "^", [T_IMPLIES] = "->", [T_IFF] = "<->"
+        };
+        result = jobs[0].formula;
+        for (int i = 0; i < op_count;) {
+            TokenType type = ops[i].type;
+            const char* literal = literals[type];
+            if (type != T_AND && type != T_OR) {
+                result = new_infix(token_new(type, literal), result, literal, jobs[i + 1].formula);
+                i++;
+                continue;
+            }
+
+            // A run of the same associative operator becomes one chain,
+            // as it does in the serial parser
+            int run = 1;
+            while (i + run < op_count && ops[i + run].type == type) run++;
+            Expression** operands = malloc(sizeof(Expression*) * (run + 1));
+            operands[0] = result;
+            for (int j = 0; j < run; j++) {
+                operands[j + 1] = jobs[i + j + 1].formula;
+            }
+            result = new_chain(token_new(type, literal), operands, run + 1);
+            free(operands);
+            i += run;
+        }
+    } else {
+        for (int i = 0; i < operand_count; i++) {
+            if (jobs[i].formula) jobs[i].formula->free(jobs[i].formula);
+        }
+    }
+
+    free(jobs);
+    free(ops);
+    return result;
+}
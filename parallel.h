@@ -0,0 +1,29 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "ast.h"
+#include <stddef.h>
+
+// Inputs smaller than this are not worth splitting across threads
+#define PARALLEL_MIN_BYTES (1 << 20)
+
+typedef struct {
+    const char* text;
+    size_t length;
+    Expression* formula;  // NULL if the line failed to parse
+    char** errors;
+    int error_count;
+} ParseJob;
+
+int parallel_thread_count(void);
+void parallel_parse_lines(ParseJob* jobs, int count, int threads);
+Expression* parallel_parse_expression(const char* text, size_t length, int threads, char** error);
+
+#endif
@@ -26,6 +26,8 @@ static int get_precedence(TokenType type) {
 Parser* parser_new(Lexer* l) {
     Parser* p = malloc(sizeof(Parser));
     p->lexer = l;
+    p->cur_token = NULL;
+    p->peek_token = NULL;
     p->errors = malloc(sizeof(char*) * INITIAL_ERROR_CAPACITY);
     p->error_count = 0;
     p->error_capacity = INITIAL_ERROR_CAPACITY;
@@ -94,8 +96,10 @@ static Expression* parse_prefix_expression(Parser* p) {
     
     parser_next_token(p);
     Expression* right = parser_parse_expression(p, PREC_PREFIX);
-    
-    return new_prefix(token, operator, right);
+    Expression* exp = right ? new_prefix(token, operator, right) : NULL;
+    if (!right) token_free(token);
+    free(operator);
+    return exp;
 }
 
 static Expression* parse_infix_expression(Parser* p, Expression* left) {
@@ -105,8 +109,112 @@ static Expression* parse_infix_expression(Parser* p, Expression* left) {
     
     parser_next_token(p);
     Expression* right = parser_parse_expression(p, precedence);
+    if (!right) {
+        token_free(token);
+        free(operator);
+        left->free(left);
+        return NULL;
+    }
     
-    return new_infix(token, left, operator, right);
+    // Chains of & and | are flattened into a single n-ary node
+    Expression* exp;
+    if (token->type == T_AND || token->type == T_OR) {
+        Expression* operands[] = {left, right};
+        exp = new_chain(token, operands, 2);
+    } else {
+        exp = new_infix(token, left, operator, right);
+    }
+    free(operator);
+    return exp;
+}
+
+// ATMOST(k, a, b, ...), ATLEAST(k, ...) and EXACTLY(k, ...)
+static Expression* parse_cardinality_expression(Parser* p) {
+    Token* token = token_new(p->cur_token->type, p->cur_token->literal);
+    if (!parser_expect_peek(p, T_LPAREN) || !parser_expect_peek(p, T_INT)) {
+        token_free(token);
+        return NULL;
+    }
+    int k = atoi(p->cur_token->literal);
+
+    int capacity = 4;
+    int count = 0;
+    Expression** operands = malloc(sizeof(Expression*) * capacity);
+    bool ok = true;
+    while (p->peek_token->type == T_COMMA) {
+        parser_next_token(p);
+        parser_next_token(p);
+        Expression* operand = parser_parse_expression(p, PREC_LOWEST);
+        if (!operand) {
+            ok = false;
+            break;
+        }
+        if (count >= capacity) {
+            capacity *= 2;
+            operands = realloc(operands, sizeof(Expression*) * capacity);
+        }
+        operands[count++] = operand;
+    }
+    if (ok && count == 0) {
+        char error[100];
+        snprintf(error, sizeof(error), "expected an operand after %s(%d", token->literal, k);
+        parser_add_error(p, error);
+        ok = false;
+    }
+    if (ok) {
+        ok = parser_expect_peek(p, T_RPAREN);
+    }
+
+    Expression* exp = NULL;
+    if (ok) {
+        exp = new_nary(token, token->literal, k, operands, count);
+    } else {
+        for (int i = 0; i < count; i++) {
+            operands[i]->free(operands[i]);
+        }
+        token_free(token);
+    }
+    free(operands);
+    return exp;
+}
+
+// forall X Y . body: the body extends as far to the right as possible
+static Expression* parse_quantifier_expression(Parser* p) {
+    Token* token = token_new(p->cur_token->type, p->cur_token->literal);
+    int capacity = 4;
+    int count = 0;
+    char** vars = malloc(sizeof(char*) * capacity);
+
+    while (p->peek_token->type == T_IDENT) {
+        parser_next_token(p);
+        if (count >= capacity) {
+            capacity *= 2;
+            vars = realloc(vars, sizeof(char*) * capacity);
+        }
+        vars[count++] = strdup(p->cur_token->literal);
+    }
+
+    Expression* body = NULL;
+    if (count == 0) {
+        char error[100];
+        snprintf(error, sizeof(error), "expected a variable after %s", token->literal);
+        parser_add_error(p, error);
+    } else if (parser_expect_peek(p, T_DOT)) {
+        parser_next_token(p);
+        body = parser_parse_expression(p, PREC_LOWEST);
+    }
+
+    Expression* exp = NULL;
+    if (body) {
+        exp = new_quantifier(token, vars, count, body);
+    } else {
+        token_free(token);
+    }
+    for (int i = 0; i < count; i++) {
+        free(vars[i]);
+    }
+    free(vars);
+    return exp;
 }
 
 static Expression* parse_grouped_expression(Parser* p) {
@@ -114,6 +222,7 @@ static Expression* parse_grouped_expression(Parser* p) {
     
     Expression* exp = parser_parse_expression(p, PREC_LOWEST);
     
+    if (!exp) return NULL;
     if (!parser_expect_peek(p, T_RPAREN)) {
         exp->free(exp);
         return NULL;
@@ -140,6 +249,15 @@ Expression* parser_parse_expression(Parser* p, int precedence) {
         case T_NOT:
             left = parse_prefix_expression(p);
             break;
+        case T_FORALL:
+        case T_EXISTS:
+            left = parse_quantifier_expression(p);
+            break;
+        case T_ATMOST:
+        case T_ATLEAST:
+        case T_EXACTLY:
+            left = parse_cardinality_expression(p);
+            break;
         default:
             {
                 char error[100];
@@ -150,6 +268,8 @@ Expression* parser_parse_expression(Parser* p, int precedence) {
             }
     }
     
+    if (!left) return NULL;
+    
     // Infix
     while (precedence < get_precedence(p->peek_token->type)) {
         switch (p->peek_token->type) {
@@ -160,6 +280,7 @@ Expression* parser_parse_expression(Parser* p, int precedence) {
             case T_IFF:
                 parser_next_token(p);
                 left = parse_infix_expression(p, left);
+                if (!left) return NULL;
                 break;
             default:
                 return left;
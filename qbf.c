@@ -0,0 +1,412 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "qbf.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 256
+
+// Quantifiers are eliminated in the circuit by Shannon expansion,
+// innermost first: forall X . f becomes f[X:=1] & f[X:=0]. Since the
+// circuit is hash-consed, a node stands for one residual formula, and
+// free variables bound in the environment are folded to constants while
+// the circuit is built, so results can be memoised by (node, variable)
+// across the whole query.
+
+typedef enum {
+    MEMO_COFACTOR_FALSE,
+    MEMO_COFACTOR_TRUE,
+    MEMO_FORALL,
+    MEMO_EXISTS
+} MemoKind;
+
+typedef struct {
+    int kind;  // -1 when the slot is empty
+    int node;
+    int var;
+    int result;
+} MemoEntry;
+
+typedef struct {
+    Circuit* circuit;
+    Environment* env;
+    QbfStats* stats;
+
+    const char** scope;  // Names of the quantified variables in scope
+    int scope_count;
+    int scope_capacity;
+
+    MemoEntry* memo;
+    int memo_size;
+    int memo_capacity;
+
+    int* mapped;  // Scratch for cofactoring, one slot per circuit node
+    int mapped_capacity;
+} Qbf;
+
+static unsigned int memo_hash(int kind, int node, int var) {
+    uint64_t h = ((uint64_t)(unsigned int)node << 32 | (unsigned int)var) ^ ((uint64_t)kind << 62);
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return (unsigned int)h;
+}
+
+static MemoEntry* memo_slot(Qbf* q, int kind, int node, int var) {
+    unsigned int mask = q->memo_capacity - 1;
+    unsigned int slot = memo_hash(kind, node, var) & mask;
+    while (q->memo[slot].kind >= 0) {
+        MemoEntry* e = &q->memo[slot];
+        if (e->kind == kind && e->node == node && e->var == var) break;
+        slot = (slot + 1) & mask;
+    }
+    return &q->memo[slot];
+}
+
+static int memo_get(Qbf* q, int kind, int node, int var) {
+    MemoEntry* e = memo_slot(q, kind, node, var);
+    if (e->kind < 0) return -1;
+    q->stats->cache_hits++;
+    return e->result;
+}
+
+static void memo_put(Qbf* q, int kind, int node, int var, int result) {
+    if ((q->memo_size + 1) * 2 > q->memo_capacity) {
+        MemoEntry* old = q->memo;
+        int old_capacity = q->memo_capacity;
+        q->memo_capacity *= 2;
+        q->memo = malloc(sizeof(MemoEntry) * q->memo_capacity);
+        for (int i = 0; i < q->memo_capacity; i++) q->memo[i].kind = -1;
+        for (int i = 0; i < old_capacity; i++) {
+            if (old[i].kind >= 0) *memo_slot(q, old[i].kind, old[i].node, old[i].var) = old[i];
+        }
+        free(old);
+    }
+    MemoEntry* e = memo_slot(q, kind, node, var);
+    if (e->kind < 0) q->memo_size++;
+    e->kind = kind;
+    e->node = node;
+    e->var = var;
+    e->result = result;
+}
+
+static int constant(Qbf* q, bool value) {
+    return circuit_node(q->circuit, CIRCUIT_CONST, value, 0);
+}
+
+// Substitutes value for var in the cone of node. Returns node itself when
+// var is not in its support.
+static int cofactor(Qbf* q, int node, int var, bool value) {
+    int kind = value ? MEMO_COFACTOR_TRUE : MEMO_COFACTOR_FALSE;
+    int result = memo_get(q, kind, node, var);
+    if (result >= 0) return result;
+
+    Circuit* c = q->circuit;
+    if (q->mapped_capacity < node + 1) {
+        q->mapped_capacity = (node + 1) * 2;
+        q->mapped = realloc(q->mapped, sizeof(int) * q->mapped_capacity);
+    }
+    int* mapped = q->mapped;
+
+    // New nodes are appended past node, so the walk only sees old ones
+    for (int i = 0; i <= node; i++) {
+        CircuitNode n = c->nodes[i];
+        switch (n.op) {
+            case CIRCUIT_CONST:
+                mapped[i] = i;
+                break;
+            case CIRCUIT_VAR:
+                mapped[i] = n.a == var ? constant(q, value) : i;
+                break;
+            case CIRCUIT_NOT:
+                mapped[i] = mapped[n.a] == n.a ? i : circuit_node(c, CIRCUIT_NOT, mapped[n.a], 0);
+                break;
+            default:
+                mapped[i] = mapped[n.a] == n.a && mapped[n.b] == n.b
+                    ? i : circuit_node(c, n.op, mapped[n.a], mapped[n.b]);
+                break;
+        }
+    }
+
+    result = mapped[node];
+    memo_put(q, kind, node, var, result);
+    return result;
+}
+
+// Marks the nodes up to node whose cone contains var
+static char* support(Qbf* q, int node, int var) {
+    Circuit* c = q->circuit;
+    char* depends = malloc(node + 1);
+    for (int i = 0; i <= node; i++) {
+        CircuitNode* n = &c->nodes[i];
+        switch (n->op) {
+            case CIRCUIT_CONST:
+                depends[i] = 0;
+                break;
+            case CIRCUIT_VAR:
+                depends[i] = n->a == var;
+                break;
+            case CIRCUIT_NOT:
+                depends[i] = depends[n->a];
+                break;
+            default:
+                depends[i] = depends[n->a] || depends[n->b];
+                break;
+        }
+    }
+    return depends;
+}
+
+static int expand(Qbf* q, int node, int var, bool universal) {
+    Circuit* c = q->circuit;
+    int positive = cofactor(q, node, var, true);
+    if (c->nodes[positive].op == CIRCUIT_CONST && c->nodes[positive].a != universal) {
+        // One branch already decides: false for forall, true for exists
+        q->stats->pruned++;
+        return positive;
+    }
+    q->stats->expansions++;
+    int negative = cofactor(q, node, var, false);
+    return circuit_node(c, universal ? CIRCUIT_AND : CIRCUIT_OR, positive, negative);
+}
+
+// Pushes the quantifier as far down as it goes before expanding: it is
+// dropped on subterms that do not mention var, forall distributes over &
+// and exists over |, and a side of any other & or | (or ->) that does not
+// mention var is kept out of the expansion. Branches that are
+// independent of var therefore cost nothing and never get duplicated.
+static int quantify_node(Qbf* q, int node, int var, bool universal, const char* depends) {
+    if (!depends[node]) {
+        q->stats->pruned++;
+        return node;
+    }
+
+    int kind = universal ? MEMO_FORALL : MEMO_EXISTS;
+    int result = memo_get(q, kind, node, var);
+    if (result >= 0) return result;
+
+    Circuit* c = q->circuit;
+    CircuitNode n = c->nodes[node];
+    switch (n.op) {
+        case CIRCUIT_VAR:
+            // forall X . X is false and exists X . X is true
+            result = constant(q, !universal);
+            break;
+        case CIRCUIT_NOT:
+            result = circuit_node(c, CIRCUIT_NOT, quantify_node(q, n.a, var, !universal, depends), 0);
+            break;
+        case CIRCUIT_AND:
+        case CIRCUIT_OR: {
+            bool distributes = (n.op == CIRCUIT_AND) == universal;
+            if (distributes || !depends[n.a] || !depends[n.b]) {
+                int a = quantify_node(q, n.a, var, universal, depends);
+                int b = quantify_node(q, n.b, var, universal, depends);
+                result = circuit_node(c, n.op, a, b);
+            } else {
+                result = expand(q, node, var, universal);
+            }
+            break;
+        }
+        case CIRCUIT_IMPLIES:
+            // a -> b is ~a | b
+            if (!universal || !depends[n.a] || !depends[n.b]) {
+                int a = quantify_node(q, n.a, var, !universal, depends);
+                int b = quantify_node(q, n.b, var, universal, depends);
+                result = circuit_node(c, CIRCUIT_IMPLIES, a, b);
+            } else {
+                result = expand(q, node, var, universal);
+            }
+            break;
+        default:
+            result = expand(q, node, var, universal);
+            break;
+    }
+
+    memo_put(q, kind, node, var, result);
+    return result;
+}
+
+static int quantify(Qbf* q, int node, int var, bool universal) {
+    char* depends = support(q, node, var);
+    int result = quantify_node(q, node, var, universal, depends);
+    free(depends);
+    return result;
+}
+
+static bool in_scope(Qbf* q, const char* name) {
+    for (int i = 0; i < q->scope_count; i++) {
+        if (strcmp(q->scope[i], name) == 0) return true;
+    }
+    return false;
+}
+
+static int build(Qbf* q, Expression* expr) {
+    Circuit* c = q->circuit;
+    switch (expr->type) {
+        case EXPR_IDENTIFIER: {
+            IdentifierExpression* ident = (IdentifierExpression*)expr->node;
+            bool value;
+            if (q->env && !in_scope(q, ident->value) && environment_get(q->env, ident->value, &value)) {
+                return constant(q, value);
+            }
+            return circuit_node(c, CIRCUIT_VAR, circuit_var(c, ident->value), 0);
+        }
+        case EXPR_BOOLEAN:
+            return constant(q, ((BooleanExpression*)expr->node)->value);
+        case EXPR_PREFIX: {
+            PrefixExpression* prefix = (PrefixExpression*)expr->node;
+            return circuit_node(c, CIRCUIT_NOT, build(q, prefix->right), 0);
+        }
+        case EXPR_INFIX: {
+            InfixExpression* infix = (InfixExpression*)expr->node;
+            int left = build(q, infix->left);
+            int right = build(q, infix->right);
+            CircuitOp op;
+            switch (infix->token->type) {
+                case T_AND: op = CIRCUIT_AND; break;
+                case T_OR: op = CIRCUIT_OR; break;
+                case T_XOR: op = CIRCUIT_XOR; break;
+                case T_IMPLIES: op = CIRCUIT_IMPLIES; break;
+                default: op = CIRCUIT_IFF; break;
+            }
+            return circuit_node(c, op, left, right);
+        }
+        case EXPR_QUANTIFIER: {
+            QuantifierExpression* quantifier = (QuantifierExpression*)expr->node;
+            int saved = q->scope_count;
+            for (int i = 0; i < quantifier->var_count; i++) {
+                if (q->scope_count >= q->scope_capacity) {
+                    q->scope_capacity *= 2;
+                    q->scope = realloc(q->scope, sizeof(char*) * q->scope_capacity);
+                }
+                q->scope[q->scope_count++] = quantifier->vars[i];
+            }
+            int body = build(q, quantifier->body);
+            q->scope_count = saved;
+
+            bool universal = quantifier->token->type == T_FORALL;
+            for (int i = quantifier->var_count - 1; i >= 0; i--) {
+                body = quantify(q, body, circuit_var(c, quantifier->vars[i]), universal);
+            }
+            return body;
+        }
+        case EXPR_NARY: {
+            NaryExpression* nary = (NaryExpression*)expr->node;
+            int* inputs = malloc(sizeof(int) * nary->count);
+            for (int i = 0; i < nary->count; i++) {
+                inputs[i] = build(q, nary->operands[i]);
+            }
+            int node = circuit_add_nary(c, nary, inputs);
+            free(inputs);
+            return node;
+        }
+    }
+    return -1;
+}
+
+bool qbf_is_quantified(Expression* expr) {
+    switch (expr->type) {
+        case EXPR_PREFIX:
+            return qbf_is_quantified(((PrefixExpression*)expr->node)->right);
+        case EXPR_INFIX: {
+            InfixExpression* infix = (InfixExpression*)expr->node;
+            return qbf_is_quantified(infix->left) || qbf_is_quantified(infix->right);
+        }
+        case EXPR_QUANTIFIER:
+            return true;
+        case EXPR_NARY: {
+            NaryExpression* nary = (NaryExpression*)expr->node;
+            for (int i = 0; i < nary->count; i++) {
+                if (qbf_is_quantified(nary->operands[i])) return true;
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+// Copies the cone of node in work into c. Once every quantifier has been
+// eliminated only free variables can be reached from node, so the bound
+// ones, which exist only in work, never enter c->vars.
+static int import_cone(Circuit* c, Circuit* work, int node) {
+    char* reached = calloc(node + 1, 1);
+    int* mapped = malloc(sizeof(int) * (node + 1));
+    reached[node] = 1;
+    for (int i = node; i >= 0; i--) {
+        CircuitNode n = work->nodes[i];
+        if (!reached[i] || n.op == CIRCUIT_CONST || n.op == CIRCUIT_VAR) continue;
+        reached[n.a] = 1;
+        if (n.op != CIRCUIT_NOT) reached[n.b] = 1;
+    }
+
+    for (int i = 0; i <= node; i++) {
+        if (!reached[i]) continue;
+        CircuitNode n = work->nodes[i];
+        switch (n.op) {
+            case CIRCUIT_CONST:
+                mapped[i] = circuit_node(c, CIRCUIT_CONST, n.a, 0);
+                break;
+            case CIRCUIT_VAR:
+                mapped[i] = circuit_node(c, CIRCUIT_VAR, circuit_var(c, work->vars[n.a]), 0);
+                break;
+            case CIRCUIT_NOT:
+                mapped[i] = circuit_node(c, CIRCUIT_NOT, mapped[n.a], 0);
+                break;
+            default:
+                mapped[i] = circuit_node(c, n.op, mapped[n.a], mapped[n.b]);
+                break;
+        }
+    }
+
+    int result = mapped[node];
+    free(mapped);
+    free(reached);
+    return result;
+}
+
+// Adds expr to c with every quantifier eliminated. Free variables bound
+// in env (which may be NULL) are replaced by their values. stats may be
+// NULL. The elimination runs in a private circuit, so the quantified
+// variables and the intermediate cofactors never appear in c.
+int qbf_add_expression(Circuit* c, Expression* expr, Environment* env, QbfStats* stats) {
+    QbfStats ignored;
+    Qbf q;
+    Circuit* work = circuit_new();
+    q.circuit = work;
+    q.env = env;
+    q.stats = stats ? stats : &ignored;
+    memset(q.stats, 0, sizeof(QbfStats));
+    q.scope_capacity = 16;
+    q.scope_count = 0;
+    q.scope = malloc(sizeof(char*) * q.scope_capacity);
+    q.memo_capacity = INITIAL_CAPACITY;
+    q.memo_size = 0;
+    q.memo = malloc(sizeof(MemoEntry) * q.memo_capacity);
+    for (int i = 0; i < q.memo_capacity; i++) q.memo[i].kind = -1;
+    q.mapped = NULL;
+    q.mapped_capacity = 0;
+
+    int root = import_cone(c, work, build(&q, expr));
+    circuit_free(work);
+
+    free(q.mapped);
+    free(q.memo);
+    free(q.scope);
+    return root;
+}
+
+// Returns 1 or 0 when env determines the value of expr, and -1 when it
+// depends on free variables that env leaves unbound
+int qbf_eval(Expression* expr, Environment* env, QbfStats* stats) {
+    Circuit* c = circuit_new();
+    int root = qbf_add_expression(c, expr, env, stats);
+    int result = c->nodes[root].op == CIRCUIT_CONST ? c->nodes[root].a : -1;
+    circuit_free(c);
+    return result;
+}
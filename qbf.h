@@ -0,0 +1,25 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef QBF_H
+#define QBF_H
+
+#include "circuit.h"
+#include "environment.h"
+
+// Work done by one evaluation, for reporting
+typedef struct {
+    long expansions;  // Shannon expansions actually performed
+    long pruned;      // Quantifiers skipped or decided by one branch
+    long cache_hits;
+} QbfStats;
+
+bool qbf_is_quantified(Expression* expr);
+int qbf_add_expression(Circuit* c, Expression* expr, Environment* env, QbfStats* stats);
+int qbf_eval(Expression* expr, Environment* env, QbfStats* stats);
+
+#endif
@@ -9,12 +9,27 @@
 #include "lexer.h"
 #include "parser.h"
 #include "environment.h"
+#include "truthtable.h"
+#include "cnf.h"
+#include "rules.h"
+#include "ruleengine.h"
+#include "stream.h"
+#include "dedup.h"
+#include "allsat.h"
+#include "backbone.h"
+#include "qbf.h"
+#include "optimize.h"
+#include "explain.h"
+#include "anf.h"
+#include "lutmap.h"
+#include "cache.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MAX_LINE_LENGTH 1024
 #define OUTPUT_AST "OUTPUT_AST"
+#define ANF_MAX_PRINTED_TERMS 65536
 
 static bool parse_bool(const char* str) {
     return strcmp(str, "true") == 0;
@@ -35,7 +50,7 @@ static void handle_set_command(char* line, Environment* env) {
     }
     
     if (strcmp(var, OUTPUT_AST) == 0) {
-        environment_set_setting(env, OUTPUT_AST, parse_bool(value));
+        environment_set_setting(env, var, parse_bool(value));
         printf("Set %s to %s\n", var, value);
         return;
     }
@@ -44,13 +59,511 @@ static void handle_set_command(char* line, Environment* env) {
     printf("Set %s to %s\n", var, value);
 }
 
+// Parses source as a single expression, printing any parser errors.
+// Returns NULL if the expression could not be parsed.
+static Expression* parse_source(const char* source) {
+    Lexer* l = lexer_new(source);
+    Parser* p = parser_new(l);
+    Expression* expression = parser_parse_expression(p, PREC_LOWEST);
+
+    if (p->error_count > 0) {
+        for (int i = 0; i < p->error_count; i++) {
+            printf("Error: %s\n", p->errors[i]);
+        }
+        if (expression) expression->free(expression);
+        expression = NULL;
+    }
+
+    parser_free(p);
+    lexer_free(l);
+    return expression;
+}
+
+static void handle_truthtable_command(char* line) {
+    Expression* expression = parse_source(line + strlen("TRUTHTABLE"));
+    if (!expression) return;
+
+    truthtable_print(expression, stdout);
+    fflush(stdout);
+    expression->free(expression);
+}
+
+static void handle_allsat_command(char* line) {
+    Expression* expression = parse_source(line + strlen("ALLSAT"));
+    if (!expression) return;
+
+    allsat_print(expression, stdout);
+    expression->free(expression);
+}
+
+// Forced values replace the suggestions stored in env; they take effect
+// only once accepted with ACCEPT. A forced value that contradicts one the
+// user has set is reported instead.
+static void handle_backbone_command(char* line, Environment* env, ResultCache* cache) {
+    Expression* expression = parse_source(line + strlen("BACKBONE"));
+    if (!expression) return;
+
+    CacheKey key = cache_key(&expression, 1, CACHE_BACKBONE);
+    Backbone* backbone = cache_get_backbone(cache, &key);
+    bool cached = backbone != NULL;
+    if (!cached) {
+        backbone = backbone_compute(expression);
+        cache_put_backbone(cache, &key, backbone);
+    }
+    expression->free(expression);
+    environment_clear_suggestions(env);
+    if (!backbone->satisfiable) {
+        printf("Unsatisfiable\n");
+        backbone_free(backbone);
+        return;
+    }
+
+    int forced_count = 0;
+    printf("Forced:");
+    for (int v = 0; v < backbone->var_count; v++) {
+        if (backbone->values[v] < 0) continue;
+        printf(" %s=%s", backbone->vars[v], backbone->values[v] ? "true" : "false");
+        forced_count++;
+    }
+    printf("%s\nFree:", forced_count ? "" : " none");
+    for (int v = 0; v < backbone->var_count; v++) {
+        if (backbone->values[v] < 0) printf(" %s", backbone->vars[v]);
+    }
+    printf("%s\n", forced_count == backbone->var_count ? " none" : "");
+
+    int suggested = 0;
+    for (int v = 0; v < backbone->var_count; v++) {
+        if (backbone->values[v] < 0) continue;
+        bool value;
+        if (!environment_get(env, backbone->vars[v], &value)) {
+            environment_suggest(env, backbone->vars[v], backbone->values[v]);
+            suggested++;
+        } else if (value != backbone->values[v]) {
+            printf("Warning: %s is set to %s but is %s in every model\n", backbone->vars[v],
+                   value ? "true" : "false", backbone->values[v] ? "true" : "false");
+        }
+    }
+    printf("%d forced, %d free ", forced_count, backbone->var_count - forced_count);
+    if (cached) {
+        printf("(cached)\n");
+    } else {
+        printf("(%d SAT calls)\n", backbone->sat_calls);
+    }
+    if (suggested) {
+        printf("Use ACCEPT to set the %d forced value%s not set yet\n", suggested, suggested == 1 ? "" : "s");
+    }
+    backbone_free(backbone);
+}
+
+static void handle_accept_command(Environment* env) {
+    int accepted = environment_accept_suggestions(env);
+    printf("Set %d suggested value%s\n", accepted, accepted == 1 ? "" : "s");
+}
+
+static void handle_weight_command(char* line, Environment* env) {
+    char var[MAX_LINE_LENGTH];
+    long long weight;
+    if (sscanf(line, "WEIGHT %s %lld", var, &weight) != 2 || weight < 0) {
+        printf("Invalid WEIGHT command. Use: WEIGHT <var> <non-negative integer>\n");
+        return;
+    }
+
+    environment_set_weight(env, var, weight);
+    printf("Weight of %s set to %lld\n", var, weight);
+}
+
+static void print_improved(long long cost, void* data) {
+    (void)data;
+    printf("Found cost %lld\n", cost);
+    fflush(stdout);
+}
+
+// The cache key covers the weights of the expression's variables, so
+// changing a weight forces a new search
+static void handle_optimize_command(char* line, Environment* env, ResultCache* cache) {
+    Expression* expression = parse_source(line + strlen("OPTIMIZE"));
+    if (!expression) return;
+
+    CacheKey key = cache_key(&expression, 1, CACHE_OPTIMUM);
+    cache_key_add_weights(&key, expression, env);
+    Optimum* optimum = cache_get_optimum(cache, &key);
+    bool cached = optimum != NULL;
+    if (!cached) {
+        optimum = optimize(expression, env, print_improved, NULL);
+        cache_put_optimum(cache, &key, optimum);
+    }
+    expression->free(expression);
+    if (!optimum->satisfiable) {
+        printf("Unsatisfiable\n");
+    } else {
+        printf("Optimal cost %lld:", optimum->cost);
+        for (int v = 0; v < optimum->var_count; v++) {
+            printf(" %s=%s", optimum->vars[v], optimum->values[v] ? "true" : "false");
+        }
+        if (cached) {
+            printf("\n(cached)\n");
+        } else {
+            printf("\n(%d SAT calls)\n", optimum->sat_calls);
+        }
+    }
+    optimum_free(optimum);
+}
+
+static void handle_explain_command(char* line, Environment* env) {
+    Expression* expression = parse_source(line + strlen("EXPLAIN"));
+    if (!expression) return;
+
+    char* unbound;
+    Explanation* explanation = explain(expression, env, &unbound);
+    expression->free(expression);
+    if (!explanation) {
+        printf("Error: undefined variable: %s\n", unbound);
+        free(unbound);
+        return;
+    }
+
+    int count = 0;
+    printf("Result: %s\nCritical (a single flip changes the result):", explanation->result ? "true" : "false");
+    for (int v = 0; v < explanation->var_count; v++) {
+        if (!explanation->critical[v]) continue;
+        printf(" %s", explanation->vars[v]);
+        count++;
+    }
+    printf("%s\nSufficient (these values alone fix the result):", count ? "" : " none");
+    count = 0;
+    for (int v = 0; v < explanation->var_count; v++) {
+        if (!explanation->sufficient[v]) continue;
+        printf(" %s=%s", explanation->vars[v], explanation->values[v] ? "true" : "false");
+        count++;
+    }
+    printf("%s\n(%d passes, %d SAT calls)\n", count ? "" : " none", explanation->passes, explanation->sat_calls);
+    explanation_free(explanation);
+}
+
+// The polynomial replaces the expression for evaluation against env, so
+// the printed result or residual comes from the ANF itself
+static void handle_anf_command(char* line, Environment* env) {
+    Expression* expression = parse_source(line + strlen("ANF"));
+    if (!expression) return;
+
+    Anf* anf = anf_compute(expression);
+    expression->free(expression);
+    if (!anf) {
+        printf("Error: ANF supports at most %d variables\n", ANF_MAX_VARS);
+        return;
+    }
+    if (anf->term_count > ANF_MAX_PRINTED_TERMS) {
+        printf("%lld terms, degree %d (too many to print)\n", anf->term_count, anf->degree);
+        anf_free(anf);
+        return;
+    }
+
+    Expression* polynomial = anf_to_expression(anf);
+    char* polynomial_str = polynomial->string(polynomial);
+    printf("ANF: %s\n%lld terms, degree %d\n", polynomial_str, anf->term_count, anf->degree);
+    free(polynomial_str);
+    anf_free(anf);
+
+    Expression* residual = polynomial->partial_eval(polynomial, env);
+    bool result;
+    if (expression_is_constant(residual, &result)) {
+        printf("Result: %s\n", result ? "true" : "false");
+    } else {
+        char* residual_str = residual->string(residual);
+        printf("Residual: %s\n", residual_str);
+        free(residual_str);
+    }
+    residual->free(residual);
+    polynomial->free(polynomial);
+}
+
+static void print_signal(LutNetwork* net, int signal) {
+    if (signal < net->var_count) {
+        printf("%s", net->vars[signal]);
+    } else {
+        printf("L%d", signal - net->var_count);
+    }
+}
+
+// Tables are printed in hex with only the 2^inputs rows that matter
+static void handle_lutmap_command(char* line, Environment* env) {
+    Expression* expression = parse_source(line + strlen("LUTMAP"));
+    if (!expression) return;
+
+    LutNetwork* net = lutmap(expression, LUTMAP_MAX_INPUTS);
+    expression->free(expression);
+    for (int i = 0; i < net->lut_count; i++) {
+        Lut* lut = &net->luts[i];
+        int rows = 1 << lut->input_count;
+        uint64_t table = rows == 64 ? lut->table : lut->table & ((1ULL << rows) - 1);
+        printf("L%d = LUT(", i);
+        for (int j = 0; j < lut->input_count; j++) {
+            if (j) printf(", ");
+            print_signal(net, lut->inputs[j]);
+        }
+        printf(") 0x%0*llX\n", rows < 4 ? 1 : rows / 4, (unsigned long long)table);
+    }
+    printf("%d LUTs replacing %d gates, depth %d\n", net->lut_count, net->gate_count, net->depth);
+
+    bool* values = malloc(sizeof(bool) * (net->var_count > 0 ? net->var_count : 1));
+    int unbound = 0;
+    for (int v = 0; v < net->var_count; v++) {
+        if (!environment_get(env, net->vars[v], &values[v])) unbound++;
+    }
+    if (unbound) {
+        printf("Result: undetermined (%d unbound variables)\n", unbound);
+    } else {
+        printf("Result: %s\n", lutmap_eval(net, values) ? "true" : "false");
+    }
+    free(values);
+    lutmap_free(net);
+}
+
+static void handle_loadcnf_command(char* line, Environment* env) {
+    char path[MAX_LINE_LENGTH];
+    if (sscanf(line, "LOADCNF %s", path) != 1) {
+        printf("Invalid LOADCNF command. Use: LOADCNF <file>\n");
+        return;
+    }
+
+    Cnf* cnf = cnf_load(path);
+    if (!cnf) return;
+    printf("Loaded %d variables, %d clauses\n", cnf->var_count, cnf->clause_count);
+
+    int unbound;
+    int result = cnf_eval(cnf, env, &unbound);
+    if (result < 0) {
+        printf("Result: undetermined (%d unbound variables)\n", unbound);
+    } else {
+        printf("Result: %s\n", result ? "true" : "false");
+    }
+    cnf_free(cnf);
+}
+
+// EXPORTCNF <expr> <file>: the file name is the last word on the line
+static void handle_exportcnf_command(char* line) {
+    char* source = line + strlen("EXPORTCNF");
+    char* end = source + strlen(source);
+    while (end > source && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+    char* path = strrchr(source, ' ');
+    if (!path || path == source) {
+        printf("Invalid EXPORTCNF command. Use: EXPORTCNF <expr> <file>\n");
+        return;
+    }
+    *path++ = '\0';
+
+    Expression* expression = parse_source(source);
+    if (!expression) return;
+
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expression);
+    Cnf* cnf = cnf_from_circuit(c);
+    int* node_literals = calloc(c->size, sizeof(int));
+    int literal = cnf_encode(cnf, c, root, node_literals);
+    cnf_add_clause(cnf, &literal, 1);
+
+    if (cnf_write(cnf, path) == 0) {
+        printf("Wrote %d variables, %d clauses to %s\n", cnf->var_count, cnf->clause_count, path);
+    }
+
+    free(node_literals);
+    cnf_free(cnf);
+    circuit_free(c);
+    expression->free(expression);
+}
+
+static void handle_rule_command(char* line, RuleEngine* engine) {
+    Expression* expression = parse_source(line + strlen("RULE"));
+    if (!expression) return;
+
+    char* source = expression->string(expression);
+    int index = rule_engine_add(engine, expression);
+    printf("Rule %d: %s\n", index, source);
+    free(source);
+    expression->free(expression);
+}
+
+static void handle_loadrules_command(char* line, RuleEngine* engine) {
+    char path[MAX_LINE_LENGTH];
+    if (sscanf(line, "LOADRULES %s", path) != 1) {
+        printf("Invalid LOADRULES command. Use: LOADRULES <file>\n");
+        return;
+    }
+
+    RuleSet* rules = rules_load(path);
+    if (!rules) return;
+
+    int first = engine->rule_count;
+    for (int i = 0; i < rules->count; i++) {
+        rule_engine_add(engine, rules->formulas[i]);
+    }
+    printf("Loaded rules %d to %d (%d shared nodes in total)\n",
+           first, engine->rule_count - 1, engine->circuit->size);
+    rules_free(rules);
+}
+
+static void handle_rules_command(RuleEngine* engine, Environment* env) {
+    int words = (engine->rule_count + 63) / 64;
+    uint64_t* bitmap = malloc(sizeof(uint64_t) * (words > 0 ? words : 1));
+
+    const char* unbound = rule_engine_eval_env(engine, env, bitmap);
+    if (unbound) {
+        printf("Error: undefined variable: %s\n", unbound);
+        free(bitmap);
+        return;
+    }
+
+    printf("Bitmap:");
+    for (int w = words - 1; w >= 0; w--) {
+        printf(" %016llx", (unsigned long long)bitmap[w]);
+    }
+    printf("\nTrue rules:");
+    int true_count = 0;
+    for (int r = 0; r < engine->rule_count; r++) {
+        if ((bitmap[r / 64] >> (r % 64)) & 1) {
+            printf(" %d", r);
+            true_count++;
+        }
+    }
+    printf("%s\n%d of %d rules true\n", true_count ? "" : " none", true_count, engine->rule_count);
+    free(bitmap);
+}
+
+static void handle_stream_command(char* line, Environment* env) {
+    char path[MAX_LINE_LENGTH];
+    if (sscanf(line, "STREAM %s", path) != 1) {
+        printf("Invalid STREAM command. Use: STREAM <file>\n");
+        return;
+    }
+
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Error: could not open %s\n", path);
+        return;
+    }
+
+    Lexer* l = lexer_new_stream(file);
+    char error[MAX_LINE_LENGTH];
+    bool result;
+    if (stream_eval(l, env, &result, error, sizeof(error))) {
+        printf("Result: %s\n", result ? "true" : "false");
+    } else {
+        printf("Error: %s\n", error);
+    }
+    lexer_free(l);
+    fclose(file);
+}
+
+// The cached payload is the class count followed by each formula's
+// representative, as 32-bit integers
+static bool get_cached_classes(ResultCache* cache, const CacheKey* key, int count,
+                               int* representative, int* class_count) {
+    unsigned char* payload;
+    size_t length;
+    if (!cache_get(cache, key, &payload, &length)) return false;
+
+    bool ok = length == sizeof(int32_t) * (count + 1);
+    if (ok) {
+        int32_t value;
+        memcpy(&value, payload, sizeof(value));
+        *class_count = value;
+        for (int r = 0; r < count; r++) {
+            memcpy(&value, payload + sizeof(value) * (r + 1), sizeof(value));
+            representative[r] = value;
+        }
+    }
+    free(payload);
+    return ok;
+}
+
+static void put_cached_classes(ResultCache* cache, const CacheKey* key, int count,
+                               const int* representative, int class_count) {
+    if (!cache) return;
+    int32_t* payload = malloc(sizeof(int32_t) * (count + 1));
+    payload[0] = class_count;
+    for (int r = 0; r < count; r++) {
+        payload[r + 1] = representative[r];
+    }
+    cache_put(cache, key, (unsigned char*)payload, sizeof(int32_t) * (count + 1));
+    free(payload);
+}
+
+static void handle_dedup_command(char* line, ResultCache* cache) {
+    char path[MAX_LINE_LENGTH];
+    if (sscanf(line, "DEDUP %s", path) != 1) {
+        printf("Invalid DEDUP command. Use: DEDUP <file>\n");
+        return;
+    }
+
+    RuleSet* rules = rules_load(path);
+    if (!rules) return;
+
+    int* representative = malloc(sizeof(int) * (rules->count > 0 ? rules->count : 1));
+    CacheKey key = cache_key(rules->formulas, rules->count, CACHE_DEDUP);
+    int class_count;
+    bool cached = get_cached_classes(cache, &key, rules->count, representative, &class_count);
+    if (!cached) {
+        class_count = dedup_formulas(rules->formulas, rules->count, representative);
+        put_cached_classes(cache, &key, rules->count, representative, class_count);
+    }
+
+    // Only classes with more than one member are listed
+    for (int r = 0; r < rules->count; r++) {
+        if (representative[r] != r) continue;
+        bool shared = false;
+        for (int i = r + 1; i < rules->count; i++) {
+            if (representative[i] != r) continue;
+            if (!shared) {
+                printf("Line %d: %s\n  same as lines", rules->lines[r], rules->sources[r]);
+                shared = true;
+            }
+            printf(" %d", rules->lines[i]);
+        }
+        if (shared) printf("\n");
+    }
+    printf("%d formulas, %d equivalence classes%s\n", rules->count, class_count, cached ? " (cached)" : "");
+
+    free(representative);
+    rules_free(rules);
+}
+
+// LOGOS_CACHE names the result cache file, and an empty value disables
+// it. The default is ~/.logos_cache.
+static ResultCache* open_result_cache(void) {
+    const char* path = getenv("LOGOS_CACHE");
+    char default_path[MAX_LINE_LENGTH];
+    if (!path) {
+        const char* home = getenv("HOME");
+        if (!home) return NULL;
+        snprintf(default_path, sizeof(default_path), "%s/.logos_cache", home);
+        path = default_path;
+    }
+    if (!*path) return NULL;
+    return cache_open(path);
+}
+
 void start_repl(void) {
     Environment* env = environment_new();
+    RuleEngine* engine = rule_engine_new();
+    ResultCache* cache = open_result_cache();
     char line[MAX_LINE_LENGTH];
     
     printf("Propositional Logic REPL\n");
     printf("Use SET <var> true/false to define variables\n");
     printf("Use SET OUTPUT_AST true/false to toggle AST output\n");
+    printf("Use TRUTHTABLE <expr> to print the truth table of an expression\n");
+    printf("Use ALLSAT <expr> to list every model as cubes, with '-' for don't-cares\n");
+    printf("Use BACKBONE <expr> to find the variables forced in every model, ACCEPT to set them\n");
+    printf("Use WEIGHT <var> <n> to set the cost of a true variable, OPTIMIZE <expr> to minimise it\n");
+    printf("Use EXPLAIN <expr> to show which variables decide its current value\n");
+    printf("Use ANF <expr> to rewrite an expression as an XOR of ANDs and evaluate that\n");
+    printf("Use LUTMAP <expr> to map an expression onto 6-input lookup tables and evaluate them\n");
+    printf("Use LOADCNF <file> and EXPORTCNF <expr> <file> to read and write DIMACS CNF\n");
+    printf("Use RULE <expr> or LOADRULES <file> to register rules, RULES to evaluate them all\n");
+    printf("Use STREAM <file> to evaluate a large formula file without building an AST\n");
+    printf("Use DEDUP <file> to group the logically equivalent formulas of a rules file\n");
+    printf("Use ATMOST(k, ...), ATLEAST(k, ...) and EXACTLY(k, ...) to count true operands\n");
+    printf("Use forall X Y . <expr> and exists X Y . <expr> for quantified formulas\n");
     printf("Use expressions using ~(NOT), &(AND), |(OR), ^(XOR), ->(IMPLIES), <->(IFF)\n");
     printf(">> ");
     
@@ -67,20 +580,104 @@ void start_repl(void) {
             continue;
         }
         
-        Lexer* l = lexer_new(line);
-        Parser* p = parser_new(l);
-        Expression* expression = parser_parse_expression(p, PREC_LOWEST);
+        if (strncmp(line, "TRUTHTABLE", 10) == 0) {
+            handle_truthtable_command(line);
+            printf(">> ");
+            continue;
+        }
         
-        if (p->error_count > 0) {
-            for (int i = 0; i < p->error_count; i++) {
-                printf("Error: %s\n", p->errors[i]);
-            }
-            parser_free(p);
-            lexer_free(l);
+        if (strncmp(line, "ALLSAT", 6) == 0) {
+            handle_allsat_command(line);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "BACKBONE", 8) == 0) {
+            handle_backbone_command(line, env, cache);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strcmp(line, "ACCEPT") == 0) {
+            handle_accept_command(env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "WEIGHT", 6) == 0) {
+            handle_weight_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "OPTIMIZE", 8) == 0) {
+            handle_optimize_command(line, env, cache);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "EXPLAIN", 7) == 0) {
+            handle_explain_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "ANF ", 4) == 0) {
+            handle_anf_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "LUTMAP", 6) == 0) {
+            handle_lutmap_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "LOADCNF", 7) == 0) {
+            handle_loadcnf_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "EXPORTCNF", 9) == 0) {
+            handle_exportcnf_command(line);
             printf(">> ");
             continue;
         }
         
+        if (strncmp(line, "RULE ", 5) == 0) {
+            handle_rule_command(line, engine);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "LOADRULES", 9) == 0) {
+            handle_loadrules_command(line, engine);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strcmp(line, "RULES") == 0) {
+            handle_rules_command(engine, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "STREAM", 6) == 0) {
+            handle_stream_command(line, env);
+            printf(">> ");
+            continue;
+        }
+        
+        if (strncmp(line, "DEDUP", 5) == 0) {
+            handle_dedup_command(line, cache);
+            printf(">> ");
+            continue;
+        }
+        
+        Expression* expression = parse_source(line);
+        
         if (expression) {
             if (environment_get_setting(env, OUTPUT_AST)) {
                 printf("AST:\n");
@@ -89,24 +686,41 @@ void start_repl(void) {
                 free(ast);
             }
             
-            bool result;
-            bool has_error = false;
-            
-            // Simple error handling using setjmp/longjmp could be added here
-            // For now, we'll just try to evaluate and catch any undefined variables
-            result = expression->eval(expression, env);
+            // Quantifiers are decided with the memoised circuit evaluator;
+            // only a result that depends on unbound free variables falls
+            // through to partial evaluation below
+            if (qbf_is_quantified(expression)) {
+                QbfStats stats;
+                int value = qbf_eval(expression, env, &stats);
+                if (value >= 0) {
+                    printf("Result: %s (%ld expansions, %ld pruned, %ld cache hits)\n",
+                           value ? "true" : "false", stats.expansions, stats.pruned, stats.cache_hits);
+                    expression->free(expression);
+                    printf(">> ");
+                    continue;
+                }
+            }
             
-            if (!has_error) {
+            // Partially evaluate so unbound variables leave a residual
+            // formula instead of aborting
+            Expression* residual = expression->partial_eval(expression, env);
+            bool result;
+            if (expression_is_constant(residual, &result)) {
                 printf("Result: %s\n", result ? "true" : "false");
+            } else {
+                char* residual_str = residual->string(residual);
+                printf("Residual: %s\n", residual_str);
+                free(residual_str);
             }
+            residual->free(residual);
             
             expression->free(expression);
         }
         
-        parser_free(p);
-        lexer_free(l);
         printf(">> ");
     }
     
+    cache_close(cache);
+    rule_engine_free(engine);
     environment_free(env);
 }
\ No newline at end of file
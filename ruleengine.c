@@ -0,0 +1,99 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "ruleengine.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 16
+
+RuleEngine* rule_engine_new(void) {
+    RuleEngine* engine = malloc(sizeof(RuleEngine));
+    engine->circuit = circuit_new();
+    engine->roots = malloc(sizeof(int) * INITIAL_CAPACITY);
+    engine->rule_count = 0;
+    engine->rule_capacity = INITIAL_CAPACITY;
+    engine->var_words = NULL;
+    engine->values = NULL;
+    engine->values_capacity = 0;
+    engine->var_capacity = 0;
+    return engine;
+}
+
+void rule_engine_free(RuleEngine* engine) {
+    if (!engine) return;
+
+    circuit_free(engine->circuit);
+    free(engine->roots);
+    free(engine->var_words);
+    free(engine->values);
+    free(engine);
+}
+
+// Registers a rule and returns its index in result bitmaps
+int rule_engine_add(RuleEngine* engine, Expression* rule) {
+    if (engine->rule_count >= engine->rule_capacity) {
+        engine->rule_capacity *= 2;
+        engine->roots = realloc(engine->roots, sizeof(int) * engine->rule_capacity);
+    }
+    engine->roots[engine->rule_count] = circuit_add_expression(engine->circuit, rule);
+    return engine->rule_count++;
+}
+
+static void ensure_scratch(RuleEngine* engine) {
+    Circuit* c = engine->circuit;
+    if (engine->values_capacity < c->size) {
+        engine->values_capacity = c->size;
+        engine->values = realloc(engine->values, sizeof(uint64_t) * engine->values_capacity);
+    }
+    if (engine->var_capacity < c->var_count) {
+        engine->var_capacity = c->var_count;
+        engine->var_words = realloc(engine->var_words, sizeof(uint64_t) * engine->var_capacity);
+    }
+}
+
+// Evaluates 64 records at once: bit i of var_words[v] is variable v in
+// record i, and bit i of rule_words[r] receives rule r for record i.
+void rule_engine_eval_batch(RuleEngine* engine, const uint64_t* var_words, uint64_t* rule_words) {
+    ensure_scratch(engine);
+    circuit_simulate(engine->circuit, var_words, engine->values);
+    for (int r = 0; r < engine->rule_count; r++) {
+        rule_words[r] = engine->values[engine->roots[r]];
+    }
+}
+
+// Evaluates one record, given as one value per engine variable (in the
+// order of engine->circuit->vars). Bit r of bitmap[r / 64] receives the
+// value of rule r.
+void rule_engine_eval(RuleEngine* engine, const bool* assignment, uint64_t* bitmap) {
+    ensure_scratch(engine);
+    for (int v = 0; v < engine->circuit->var_count; v++) {
+        engine->var_words[v] = assignment[v] ? ~0ULL : 0;
+    }
+    circuit_simulate(engine->circuit, engine->var_words, engine->values);
+
+    memset(bitmap, 0, sizeof(uint64_t) * ((engine->rule_count + 63) / 64));
+    for (int r = 0; r < engine->rule_count; r++) {
+        bitmap[r / 64] |= (engine->values[engine->roots[r]] & 1) << (r % 64);
+    }
+}
+
+// Evaluates every rule against env. Returns the name of an unbound
+// variable (leaving bitmap untouched) or NULL on success.
+const char* rule_engine_eval_env(RuleEngine* engine, Environment* env, uint64_t* bitmap) {
+    Circuit* c = engine->circuit;
+    bool* assignment = malloc(sizeof(bool) * (c->var_count > 0 ? c->var_count : 1));
+    for (int v = 0; v < c->var_count; v++) {
+        if (!environment_get(env, c->vars[v], &assignment[v])) {
+            free(assignment);
+            return c->vars[v];
+        }
+    }
+    rule_engine_eval(engine, assignment, bitmap);
+    free(assignment);
+    return NULL;
+}
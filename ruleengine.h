@@ -0,0 +1,35 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef RULEENGINE_H
+#define RULEENGINE_H
+
+#include "circuit.h"
+#include "environment.h"
+
+// Evaluates many rules against one assignment. All rules are merged into
+// one hash-consed circuit, so a subterm shared by any number of rules is
+// computed once per record.
+typedef struct {
+    Circuit* circuit;
+    int* roots;
+    int rule_count;
+    int rule_capacity;
+    uint64_t* var_words;
+    int var_capacity;
+    uint64_t* values;
+    int values_capacity;
+} RuleEngine;
+
+RuleEngine* rule_engine_new(void);
+void rule_engine_free(RuleEngine* engine);
+int rule_engine_add(RuleEngine* engine, Expression* rule);
+void rule_engine_eval(RuleEngine* engine, const bool* assignment, uint64_t* bitmap);
+void rule_engine_eval_batch(RuleEngine* engine, const uint64_t* var_words, uint64_t* rule_words);
+const char* rule_engine_eval_env(RuleEngine* engine, Environment* env, uint64_t* bitmap);
+
+#endif
@@ -0,0 +1,175 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "rules.h"
+#include "parser.h"
+#include "parallel.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 16
+
+static RuleSet* rules_new(void) {
+    RuleSet* rules = malloc(sizeof(RuleSet));
+    rules->formulas = malloc(sizeof(Expression*) * INITIAL_CAPACITY);
+    rules->sources = malloc(sizeof(char*) * INITIAL_CAPACITY);
+    rules->lines = malloc(sizeof(int) * INITIAL_CAPACITY);
+    rules->count = 0;
+    rules->capacity = INITIAL_CAPACITY;
+    return rules;
+}
+
+void rules_free(RuleSet* rules) {
+    if (!rules) return;
+
+    for (int i = 0; i < rules->count; i++) {
+        rules->formulas[i]->free(rules->formulas[i]);
+        free(rules->sources[i]);
+    }
+    free(rules->formulas);
+    free(rules->sources);
+    free(rules->lines);
+    free(rules);
+}
+
+static void rules_add(RuleSet* rules, Expression* formula, const char* source, int line) {
+    if (rules->count >= rules->capacity) {
+        rules->capacity *= 2;
+        rules->formulas = realloc(rules->formulas, sizeof(Expression*) * rules->capacity);
+        rules->sources = realloc(rules->sources, sizeof(char*) * rules->capacity);
+        rules->lines = realloc(rules->lines, sizeof(int) * rules->capacity);
+    }
+    rules->formulas[rules->count] = formula;
+    rules->sources[rules->count] = strdup(source);
+    rules->lines[rules->count] = line;
+    rules->count++;
+}
+
+static char* read_file(const char* path, long* length) {
+    FILE* file = fopen(path, "rb");
+    if (!file) return NULL;
+
+    fseek(file, 0, SEEK_END);
+    *length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char* data = malloc(*length + 1);
+    if (fread(data, 1, *length, file) != (size_t)*length) {
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    data[*length] = '\0';
+    fclose(file);
+    return data;
+}
+
+static bool is_blank_or_comment(const char* line) {
+    while (*line == ' ' || *line == '\t') line++;
+    return *line == '\0' || *line == '#';
+}
+
+// Lines shorter than this are grouped into blocks for the worker threads
+#define LINES_PER_THREAD 256
+
+// Loads and parses every formula in a rules file. Parser errors are
+// reported with their line number and cause the whole load to fail.
+// Lines are parsed in parallel in contiguous blocks; a line longer than
+// PARALLEL_MIN_BYTES is instead split at its top-level operators and
+// parsed by all threads at once.
+RuleSet* rules_load(const char* path) {
+    long length;
+    char* data = read_file(path, &length);
+    if (!data) {
+        fprintf(stderr, "could not read rules file: %s\n", path);
+        return NULL;
+    }
+
+    int job_capacity = INITIAL_CAPACITY;
+    int job_count = 0;
+    ParseJob* jobs = malloc(sizeof(ParseJob) * job_capacity);
+    int* line_numbers = malloc(sizeof(int) * job_capacity);
+    int line_number = 0;
+    char* line = data;
+
+    while (line < data + length) {
+        char* end = memchr(line, '\n', data + length - line);
+        if (!end) end = data + length;
+        *end = '\0';
+        if (end > line && end[-1] == '\r') end[-1] = '\0';
+        line_number++;
+
+        if (!is_blank_or_comment(line)) {
+            if (job_count >= job_capacity) {
+                job_capacity *= 2;
+                jobs = realloc(jobs, sizeof(ParseJob) * job_capacity);
+                line_numbers = realloc(line_numbers, sizeof(int) * job_capacity);
+            }
+            jobs[job_count].text = line;
+            jobs[job_count].length = strlen(line);
+            line_numbers[job_count] = line_number;
+            job_count++;
+        }
+
+        line = end + 1;
+    }
+
+    int threads = parallel_thread_count();
+    ParseJob* small_jobs = malloc(sizeof(ParseJob) * (job_count > 0 ? job_count : 1));
+    int* small_index = malloc(sizeof(int) * (job_count > 0 ? job_count : 1));
+    int small_count = 0;
+    for (int i = 0; i < job_count; i++) {
+        if (jobs[i].length >= PARALLEL_MIN_BYTES) {
+            char* error;
+            jobs[i].formula = parallel_parse_expression(jobs[i].text, jobs[i].length, threads, &error);
+            jobs[i].errors = NULL;
+            jobs[i].error_count = 0;
+            if (error) {
+                jobs[i].errors = malloc(sizeof(char*));
+                jobs[i].errors[0] = error;
+                jobs[i].error_count = 1;
+            }
+        } else {
+            small_index[small_count] = i;
+            small_jobs[small_count++] = jobs[i];
+        }
+    }
+
+    int line_threads = small_count / LINES_PER_THREAD + 1;
+    parallel_parse_lines(small_jobs, small_count, line_threads < threads ? line_threads : threads);
+    for (int i = 0; i < small_count; i++) {
+        jobs[small_index[i]] = small_jobs[i];
+    }
+
+    RuleSet* rules = rules_new();
+    bool ok = true;
+    for (int i = 0; i < job_count; i++) {
+        for (int e = 0; e < jobs[i].error_count; e++) {
+            fprintf(stderr, "%s:%d: %s\n", path, line_numbers[i], jobs[i].errors[e]);
+            free(jobs[i].errors[e]);
+        }
+        free(jobs[i].errors);
+
+        if (jobs[i].formula) {
+            rules_add(rules, jobs[i].formula, jobs[i].text, line_numbers[i]);
+        } else {
+            ok = false;
+        }
+    }
+
+    free(small_jobs);
+    free(small_index);
+    free(line_numbers);
+    free(jobs);
+    free(data);
+    if (!ok) {
+        rules_free(rules);
+        return NULL;
+    }
+    return rules;
+}
@@ -0,0 +1,26 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef RULES_H
+#define RULES_H
+
+#include "ast.h"
+
+// A rules file holds one formula per line. Blank lines and lines starting
+// with '#' are ignored.
+typedef struct {
+    Expression** formulas;
+    char** sources;
+    int* lines;  // 1-based line number of each formula in the file
+    int count;
+    int capacity;
+} RuleSet;
+
+RuleSet* rules_load(const char* path);
+void rules_free(RuleSet* rules);
+
+#endif
@@ -0,0 +1,596 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "sat.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 64
+#define RESTART_BASE 100
+#define VAR_DECAY 0.95
+#define CLAUSE_DECAY 0.999
+
+// Internal literals are 2 * v + sign for the 0-based variable v
+#define LIT_VAR(l) ((l) >> 1)
+#define LIT_NEG(l) ((l) ^ 1)
+
+static int from_dimacs(int literal) {
+    return literal > 0 ? 2 * (literal - 1) : 2 * (-literal - 1) + 1;
+}
+
+static int to_dimacs(int lit) {
+    return (lit & 1) ? -(LIT_VAR(lit) + 1) : LIT_VAR(lit) + 1;
+}
+
+// -1 unassigned, 0 false, 1 true
+static int lit_value(SatSolver* s, int lit) {
+    signed char value = s->values[LIT_VAR(lit)];
+    return value < 0 ? -1 : value ^ (lit & 1);
+}
+
+static void watch_push(SatWatchList* w, SatClause* c) {
+    if (w->size >= w->capacity) {
+        w->capacity = w->capacity ? w->capacity * 2 : 4;
+        w->data = realloc(w->data, sizeof(SatClause*) * w->capacity);
+    }
+    w->data[w->size++] = c;
+}
+
+static void clause_list_push(SatClause*** list, int* count, int* capacity, SatClause* c) {
+    if (*count >= *capacity) {
+        *capacity = *capacity ? *capacity * 2 : INITIAL_CAPACITY;
+        *list = realloc(*list, sizeof(SatClause*) * *capacity);
+    }
+    (*list)[(*count)++] = c;
+}
+
+// Variable order heap
+
+static bool heap_less(SatSolver* s, int a, int b) {
+    return s->activity[a] > s->activity[b];
+}
+
+static void heap_up(SatSolver* s, int i) {
+    int v = s->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!heap_less(s, v, s->heap[parent])) break;
+        s->heap[i] = s->heap[parent];
+        s->heap_index[s->heap[i]] = i;
+        i = parent;
+    }
+    s->heap[i] = v;
+    s->heap_index[v] = i;
+}
+
+static void heap_down(SatSolver* s, int i) {
+    int v = s->heap[i];
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= s->heap_size) break;
+        if (child + 1 < s->heap_size && heap_less(s, s->heap[child + 1], s->heap[child])) child++;
+        if (!heap_less(s, s->heap[child], v)) break;
+        s->heap[i] = s->heap[child];
+        s->heap_index[s->heap[i]] = i;
+        i = child;
+    }
+    s->heap[i] = v;
+    s->heap_index[v] = i;
+}
+
+static void heap_insert(SatSolver* s, int v) {
+    if (s->heap_index[v] >= 0) return;
+    s->heap[s->heap_size] = v;
+    s->heap_index[v] = s->heap_size;
+    s->heap_size++;
+    heap_up(s, s->heap_size - 1);
+}
+
+static int heap_pop(SatSolver* s) {
+    int v = s->heap[0];
+    s->heap_index[v] = -1;
+    s->heap_size--;
+    if (s->heap_size > 0) {
+        s->heap[0] = s->heap[s->heap_size];
+        s->heap_index[s->heap[0]] = 0;
+        heap_down(s, 0);
+    }
+    return v;
+}
+
+static void bump_var(SatSolver* s, int v) {
+    s->activity[v] += s->var_inc;
+    if (s->activity[v] > 1e100) {
+        for (int i = 0; i < s->var_count; i++) s->activity[i] *= 1e-100;
+        s->var_inc *= 1e-100;
+    }
+    if (s->heap_index[v] >= 0) heap_up(s, s->heap_index[v]);
+}
+
+static void bump_clause(SatSolver* s, SatClause* c) {
+    c->activity += s->clause_inc;
+    if (c->activity > 1e20) {
+        for (int i = 0; i < s->learnt_count; i++) s->learnts[i]->activity *= 1e-20;
+        s->clause_inc *= 1e-20;
+    }
+}
+
+// Solver lifetime
+
+SatSolver* sat_new(void) {
+    SatSolver* s = calloc(1, sizeof(SatSolver));
+    s->var_inc = 1.0;
+    s->clause_inc = 1.0;
+    s->ok = true;
+    s->max_learnts = 1000;
+    return s;
+}
+
+void sat_free(SatSolver* s) {
+    if (!s) return;
+
+    for (int i = 0; i < s->clause_count; i++) free(s->clauses[i]);
+    for (int i = 0; i < s->learnt_count; i++) free(s->learnts[i]);
+    for (int i = 0; i < 2 * s->var_count; i++) free(s->watches[i].data);
+    free(s->clauses);
+    free(s->learnts);
+    free(s->watches);
+    free(s->values);
+    free(s->model);
+    free(s->phases);
+    free(s->levels);
+    free(s->reasons);
+    free(s->activity);
+    free(s->seen);
+    free(s->heap);
+    free(s->heap_index);
+    free(s->trail);
+    free(s->trail_lims);
+    free(s->core);
+    free(s->scratch);
+    free(s);
+}
+
+void sat_reserve_vars(SatSolver* s, int var_count) {
+    if (var_count > s->var_capacity) {
+        int capacity = s->var_capacity ? s->var_capacity : INITIAL_CAPACITY;
+        while (capacity < var_count) capacity *= 2;
+
+        s->values = realloc(s->values, capacity);
+        s->model = realloc(s->model, capacity);
+        s->phases = realloc(s->phases, capacity);
+        s->levels = realloc(s->levels, sizeof(int) * capacity);
+        s->reasons = realloc(s->reasons, sizeof(SatClause*) * capacity);
+        s->activity = realloc(s->activity, sizeof(double) * capacity);
+        s->seen = realloc(s->seen, capacity);
+        s->heap = realloc(s->heap, sizeof(int) * capacity);
+        s->heap_index = realloc(s->heap_index, sizeof(int) * capacity);
+        s->trail = realloc(s->trail, sizeof(int) * capacity);
+        s->trail_lims = realloc(s->trail_lims, sizeof(int) * (capacity + 1));
+        s->core = realloc(s->core, sizeof(int) * capacity);
+        s->watches = realloc(s->watches, sizeof(SatWatchList) * 2 * capacity);
+        s->var_capacity = capacity;
+    }
+
+    while (s->var_count < var_count) {
+        int v = s->var_count++;
+        s->values[v] = -1;
+        s->model[v] = 0;
+        s->phases[v] = 0;
+        s->levels[v] = 0;
+        s->reasons[v] = NULL;
+        s->activity[v] = 0.0;
+        s->seen[v] = 0;
+        s->heap_index[v] = -1;
+        memset(&s->watches[2 * v], 0, sizeof(SatWatchList) * 2);
+        heap_insert(s, v);
+    }
+}
+
+int sat_new_var(SatSolver* s) {
+    sat_reserve_vars(s, s->var_count + 1);
+    return s->var_count;
+}
+
+// Assignment and propagation
+
+static void enqueue(SatSolver* s, int lit, SatClause* reason) {
+    int v = LIT_VAR(lit);
+    s->values[v] = !(lit & 1);
+    s->levels[v] = s->level_count;
+    s->reasons[v] = reason;
+    s->trail[s->trail_size++] = lit;
+}
+
+static void cancel_until(SatSolver* s, int level) {
+    if (s->level_count <= level) return;
+
+    for (int i = s->trail_size - 1; i >= s->trail_lims[level]; i--) {
+        int v = LIT_VAR(s->trail[i]);
+        s->phases[v] = s->values[v];
+        s->values[v] = -1;
+        s->reasons[v] = NULL;
+        heap_insert(s, v);
+    }
+    s->trail_size = s->trail_lims[level];
+    s->queue_head = s->trail_size;
+    s->level_count = level;
+}
+
+static SatClause* propagate(SatSolver* s) {
+    while (s->queue_head < s->trail_size) {
+        int false_lit = LIT_NEG(s->trail[s->queue_head++]);
+        SatWatchList* w = &s->watches[false_lit];
+        int i = 0, j = 0;
+
+        while (i < w->size) {
+            SatClause* c = w->data[i++];
+            if (c->lits[0] == false_lit) {
+                c->lits[0] = c->lits[1];
+                c->lits[1] = false_lit;
+            }
+
+            if (lit_value(s, c->lits[0]) == 1) {
+                w->data[j++] = c;
+                continue;
+            }
+
+            bool moved = false;
+            for (int k = 2; k < c->size; k++) {
+                if (lit_value(s, c->lits[k]) != 0) {
+                    c->lits[1] = c->lits[k];
+                    c->lits[k] = false_lit;
+                    watch_push(&s->watches[c->lits[1]], c);
+                    moved = true;
+                    break;
+                }
+            }
+            if (moved) continue;
+
+            w->data[j++] = c;
+            if (lit_value(s, c->lits[0]) == 0) {
+                while (i < w->size) w->data[j++] = w->data[i++];
+                w->size = j;
+                s->queue_head = s->trail_size;
+                return c;
+            }
+            enqueue(s, c->lits[0], c);
+        }
+        w->size = j;
+    }
+    return NULL;
+}
+
+static SatClause* new_clause(const int* lits, int size, bool learnt) {
+    SatClause* c = malloc(sizeof(SatClause) + sizeof(int) * size);
+    c->size = size;
+    c->learnt = learnt;
+    c->activity = 0.0;
+    memcpy(c->lits, lits, sizeof(int) * size);
+    return c;
+}
+
+static void attach(SatSolver* s, SatClause* c) {
+    watch_push(&s->watches[c->lits[0]], c);
+    watch_push(&s->watches[c->lits[1]], c);
+}
+
+static int* scratch(SatSolver* s, int size) {
+    if (size > s->scratch_capacity) {
+        s->scratch_capacity = size * 2;
+        s->scratch = realloc(s->scratch, sizeof(int) * s->scratch_capacity);
+    }
+    return s->scratch;
+}
+
+static int compare_ints(const void* a, const void* b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+bool sat_add_clause(SatSolver* s, const int* literals, int count) {
+    if (!s->ok) return false;
+    cancel_until(s, 0);
+
+    int max_var = 0;
+    for (int i = 0; i < count; i++) {
+        int v = literals[i] < 0 ? -literals[i] : literals[i];
+        if (v > max_var) max_var = v;
+    }
+    sat_reserve_vars(s, max_var);
+
+    int* lits = scratch(s, count + 1);
+    for (int i = 0; i < count; i++) lits[i] = from_dimacs(literals[i]);
+    qsort(lits, count, sizeof(int), compare_ints);
+
+    // Drop duplicates and literals false at level 0; skip satisfied clauses
+    int size = 0;
+    for (int i = 0; i < count; i++) {
+        int value = lit_value(s, lits[i]);
+        if (value == 1 || (size > 0 && lits[i] == LIT_NEG(lits[size - 1]))) return true;
+        if (value == 0 || (size > 0 && lits[i] == lits[size - 1])) continue;
+        lits[size++] = lits[i];
+    }
+
+    if (size == 0) {
+        s->ok = false;
+        return false;
+    }
+    if (size == 1) {
+        enqueue(s, lits[0], NULL);
+        if (propagate(s)) s->ok = false;
+        return s->ok;
+    }
+
+    SatClause* c = new_clause(lits, size, false);
+    clause_list_push(&s->clauses, &s->clause_count, &s->clause_capacity, c);
+    attach(s, c);
+    return true;
+}
+
+// Feeds the clauses of cnf starting at literal offset from, and returns
+// the offset to continue from when more clauses have been added.
+size_t sat_add_cnf(SatSolver* s, Cnf* cnf, size_t from) {
+    sat_reserve_vars(s, cnf->var_count);
+    size_t start = from;
+    for (size_t i = from; i < cnf->literal_count; i++) {
+        if (cnf->literals[i] == 0) {
+            sat_add_clause(s, cnf->literals + start, (int)(i - start));
+            start = i + 1;
+        }
+    }
+    return start;
+}
+
+// Conflict analysis
+
+// A literal of the learnt clause is redundant if its reason clause only
+// contains literals already in the learnt clause (or fixed at level 0).
+static bool redundant(SatSolver* s, int lit) {
+    SatClause* reason = s->reasons[LIT_VAR(lit)];
+    if (!reason) return false;
+    for (int k = 1; k < reason->size; k++) {
+        int v = LIT_VAR(reason->lits[k]);
+        if (!s->seen[v] && s->levels[v] > 0) return false;
+    }
+    return true;
+}
+
+// First-UIP learning. Returns the learnt clause length (in scratch) and
+// the level to backtrack to.
+static int analyze(SatSolver* s, SatClause* confl, int* backtrack_level) {
+    // The second half keeps the unminimized clause so seen can be reset
+    int* learnt = scratch(s, 2 * (s->var_count + 1));
+    int size = 1;
+    int path = 0;
+    int p = -1;
+    int index = s->trail_size - 1;
+
+    do {
+        if (confl->learnt) bump_clause(s, confl);
+        for (int j = (p == -1) ? 0 : 1; j < confl->size; j++) {
+            int q = confl->lits[j];
+            int v = LIT_VAR(q);
+            if (!s->seen[v] && s->levels[v] > 0) {
+                bump_var(s, v);
+                s->seen[v] = 1;
+                if (s->levels[v] >= s->level_count) {
+                    path++;
+                } else {
+                    learnt[size++] = q;
+                }
+            }
+        }
+        while (!s->seen[LIT_VAR(s->trail[index])]) index--;
+        p = s->trail[index--];
+        confl = s->reasons[LIT_VAR(p)];
+        s->seen[LIT_VAR(p)] = 0;
+        path--;
+    } while (path > 0);
+    learnt[0] = LIT_NEG(p);
+
+    int* original = learnt + s->var_count + 1;
+    memcpy(original, learnt, sizeof(int) * size);
+    int kept = 1;
+    for (int i = 1; i < size; i++) {
+        if (!redundant(s, learnt[i])) learnt[kept++] = learnt[i];
+    }
+    for (int i = 1; i < size; i++) s->seen[LIT_VAR(original[i])] = 0;
+    size = kept;
+
+    *backtrack_level = 0;
+    if (size > 1) {
+        int max_i = 1;
+        for (int i = 2; i < size; i++) {
+            if (s->levels[LIT_VAR(learnt[i])] > s->levels[LIT_VAR(learnt[max_i])]) max_i = i;
+        }
+        int tmp = learnt[1];
+        learnt[1] = learnt[max_i];
+        learnt[max_i] = tmp;
+        *backtrack_level = s->levels[LIT_VAR(learnt[1])];
+    }
+    return size;
+}
+
+// Collects the assumptions responsible for falsifying assumption p
+static void analyze_final(SatSolver* s, int p) {
+    s->core_size = 0;
+    s->core[s->core_size++] = to_dimacs(p);
+    if (s->level_count == 0) return;
+
+    s->seen[LIT_VAR(p)] = 1;
+    for (int i = s->trail_size - 1; i >= s->trail_lims[0]; i--) {
+        int v = LIT_VAR(s->trail[i]);
+        if (!s->seen[v]) continue;
+        SatClause* reason = s->reasons[v];
+        if (!reason) {
+            if (s->levels[v] > 0) {
+                s->core[s->core_size++] = to_dimacs(s->trail[i]);
+            }
+        } else {
+            for (int k = 1; k < reason->size; k++) {
+                if (s->levels[LIT_VAR(reason->lits[k])] > 0) s->seen[LIT_VAR(reason->lits[k])] = 1;
+            }
+        }
+        s->seen[v] = 0;
+    }
+    s->seen[LIT_VAR(p)] = 0;
+}
+
+static bool locked(SatSolver* s, SatClause* c) {
+    return s->reasons[LIT_VAR(c->lits[0])] == c && lit_value(s, c->lits[0]) == 1;
+}
+
+static int compare_activity(const void* a, const void* b) {
+    double x = (*(SatClause* const*)a)->activity;
+    double y = (*(SatClause* const*)b)->activity;
+    return (x > y) - (x < y);
+}
+
+// Deletes the less active half of the learnt clauses and rebuilds the
+// watch lists from scratch
+static void reduce_db(SatSolver* s) {
+    qsort(s->learnts, s->learnt_count, sizeof(SatClause*), compare_activity);
+    int kept = 0;
+    for (int i = 0; i < s->learnt_count; i++) {
+        SatClause* c = s->learnts[i];
+        if (i < s->learnt_count / 2 && c->size > 2 && !locked(s, c)) {
+            free(c);
+        } else {
+            s->learnts[kept++] = c;
+        }
+    }
+    s->learnt_count = kept;
+
+    for (int i = 0; i < 2 * s->var_count; i++) s->watches[i].size = 0;
+    for (int i = 0; i < s->clause_count; i++) attach(s, s->clauses[i]);
+    for (int i = 0; i < s->learnt_count; i++) attach(s, s->learnts[i]);
+    s->max_learnts += s->max_learnts / 10;
+}
+
+static double luby(int i) {
+    int size = 1, seq = 0;
+    while (size < i + 1) {
+        seq++;
+        size = 2 * size + 1;
+    }
+    while (size - 1 != i) {
+        size = (size - 1) >> 1;
+        seq--;
+        i = i % size;
+    }
+    double result = 1.0;
+    while (seq-- > 0) result *= 2.0;
+    return result;
+}
+
+// Returns 1 if satisfiable, 0 if unsatisfiable and -1 on restart
+static int search(SatSolver* s, const int* assumptions, int assumption_count, long budget) {
+    long conflicts = 0;
+
+    for (;;) {
+        SatClause* confl = propagate(s);
+        if (confl) {
+            conflicts++;
+            s->conflicts++;
+            if (s->level_count == 0) {
+                s->ok = false;
+                return 0;
+            }
+
+            int backtrack_level;
+            int size = analyze(s, confl, &backtrack_level);
+            cancel_until(s, backtrack_level);
+            if (size == 1) {
+                enqueue(s, s->scratch[0], NULL);
+            } else {
+                SatClause* c = new_clause(s->scratch, size, true);
+                clause_list_push(&s->learnts, &s->learnt_count, &s->learnt_capacity, c);
+                attach(s, c);
+                bump_clause(s, c);
+                enqueue(s, c->lits[0], c);
+            }
+            s->var_inc /= VAR_DECAY;
+            s->clause_inc /= CLAUSE_DECAY;
+            continue;
+        }
+
+        if (conflicts >= budget) {
+            cancel_until(s, 0);
+            return -1;
+        }
+        if (s->learnt_count - s->trail_size >= s->max_learnts) {
+            reduce_db(s);
+        }
+
+        int next = -1;
+        while (s->level_count < assumption_count) {
+            int p = assumptions[s->level_count];
+            int value = lit_value(s, p);
+            if (value == 1) {
+                s->trail_lims[s->level_count++] = s->trail_size;  // Dummy level
+            } else if (value == 0) {
+                analyze_final(s, p);
+                return 0;
+            } else {
+                next = p;
+                break;
+            }
+        }
+
+        if (next < 0) {
+            int v = -1;
+            while (s->heap_size > 0) {
+                v = heap_pop(s);
+                if (s->values[v] < 0) break;
+                v = -1;
+            }
+            if (v < 0) return 1;
+            next = 2 * v + (s->phases[v] ? 0 : 1);
+        }
+
+        s->trail_lims[s->level_count++] = s->trail_size;
+        enqueue(s, next, NULL);
+    }
+}
+
+// Solves under the given assumptions (DIMACS literals that hold for this
+// call only). After an unsatisfiable result, s->core holds a subset of
+// the assumptions that is already inconsistent (empty if the clauses are
+// unsatisfiable on their own).
+bool sat_solve(SatSolver* s, const int* assumptions, int count) {
+    s->core_size = 0;
+    if (!s->ok) return false;
+    cancel_until(s, 0);
+
+    int* internal = malloc(sizeof(int) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        int v = assumptions[i] < 0 ? -assumptions[i] : assumptions[i];
+        sat_reserve_vars(s, v);
+        internal[i] = from_dimacs(assumptions[i]);
+    }
+    // Every assumption may open a (possibly empty) decision level
+    s->trail_lims = realloc(s->trail_lims, sizeof(int) * (s->var_capacity + count + 1));
+    if (s->max_learnts < s->clause_count / 3) {
+        s->max_learnts = s->clause_count / 3;
+    }
+
+    int status = -1;
+    for (int restart = 0; status < 0; restart++) {
+        status = search(s, internal, count, (long)(luby(restart) * RESTART_BASE));
+    }
+
+    if (status == 1 && s->var_count > 0) {
+        memcpy(s->model, s->values, s->var_count);
+    }
+    cancel_until(s, 0);
+    free(internal);
+    return status == 1;
+}
+
+bool sat_model_value(SatSolver* s, int var) {
+    return var >= 1 && var <= s->var_count && s->model[var - 1] == 1;
+}
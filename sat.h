@@ -0,0 +1,86 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef SAT_H
+#define SAT_H
+
+#include "cnf.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// An incremental CDCL solver. Variables and literals use DIMACS numbering
+// (v or -v for variable v >= 1) at the interface. Clauses may be added
+// between calls to sat_solve, and everything learned in one call is kept
+// for the next, so a sequence of related queries (each expressed through
+// assumptions) gets cheaper as it goes.
+
+typedef struct {
+    int size;
+    bool learnt;
+    double activity;
+    int lits[];  // Internal literals; lits[0] and lits[1] are watched
+} SatClause;
+
+typedef struct {
+    SatClause** data;
+    int size;
+    int capacity;
+} SatWatchList;
+
+typedef struct SatSolver {
+    int var_count;
+    int var_capacity;
+    signed char* values;  // Per variable: -1 unassigned, 0 false, 1 true
+    signed char* model;
+    signed char* phases;
+    int* levels;
+    SatClause** reasons;
+    double* activity;
+    char* seen;
+
+    int* heap;  // Binary max-heap of unassigned variables by activity
+    int heap_size;
+    int* heap_index;
+
+    SatWatchList* watches;  // Indexed by internal literal
+
+    int* trail;
+    int trail_size;
+    int* trail_lims;
+    int level_count;
+    int queue_head;
+
+    SatClause** clauses;
+    int clause_count;
+    int clause_capacity;
+    SatClause** learnts;
+    int learnt_count;
+    int learnt_capacity;
+    int max_learnts;
+
+    double var_inc;
+    double clause_inc;
+    long conflicts;
+    bool ok;
+
+    int* core;  // Failed assumptions after an unsatisfiable solve
+    int core_size;
+
+    int* scratch;
+    int scratch_capacity;
+} SatSolver;
+
+SatSolver* sat_new(void);
+void sat_free(SatSolver* s);
+int sat_new_var(SatSolver* s);
+void sat_reserve_vars(SatSolver* s, int var_count);
+bool sat_add_clause(SatSolver* s, const int* literals, int count);
+size_t sat_add_cnf(SatSolver* s, Cnf* cnf, size_t from);
+bool sat_solve(SatSolver* s, const int* assumptions, int count);
+bool sat_model_value(SatSolver* s, int var);
+
+#endif
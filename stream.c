@@ -0,0 +1,173 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "stream.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INITIAL_STACK_CAPACITY 64
+
+// Operator stack entries: a binary or prefix operator, or an open paren
+typedef struct {
+    TokenType type;
+    int precedence;
+} StackOp;
+
+typedef struct {
+    bool* values;
+    int value_count;
+    int value_capacity;
+
+    StackOp* ops;
+    int op_count;
+    int op_capacity;
+} EvalStack;
+
+static int binary_precedence(TokenType type) {
+    switch (type) {
+        case T_IFF: return PREC_EQUALS;
+        case T_IMPLIES: return PREC_IMPLIES;
+        case T_OR:
+        case T_XOR: return PREC_OR_XOR;
+        case T_AND: return PREC_AND;
+        default: return PREC_LOWEST;
+    }
+}
+
+static void push_value(EvalStack* s, bool value) {
+    if (s->value_count >= s->value_capacity) {
+        s->value_capacity *= 2;
+        s->values = realloc(s->values, sizeof(bool) * s->value_capacity);
+    }
+    s->values[s->value_count++] = value;
+}
+
+static void push_op(EvalStack* s, TokenType type, int precedence) {
+    if (s->op_count >= s->op_capacity) {
+        s->op_capacity *= 2;
+        s->ops = realloc(s->ops, sizeof(StackOp) * s->op_capacity);
+    }
+    s->ops[s->op_count].type = type;
+    s->ops[s->op_count].precedence = precedence;
+    s->op_count++;
+}
+
+// Pops the top operator and applies it to the value stack
+static void apply_top(EvalStack* s) {
+    TokenType type = s->ops[--s->op_count].type;
+    if (type == T_NOT) {
+        s->values[s->value_count - 1] = !s->values[s->value_count - 1];
+        return;
+    }
+
+    bool right = s->values[--s->value_count];
+    bool left = s->values[s->value_count - 1];
+    bool result;
+    switch (type) {
+        case T_AND: result = left && right; break;
+        case T_OR: result = left || right; break;
+        case T_XOR: result = left != right; break;
+        case T_IMPLIES: result = !left || right; break;
+        default: result = left == right; break;
+    }
+    s->values[s->value_count - 1] = result;
+}
+
+// Evaluates the expression produced by l in a single pass without
+// building an AST. Operators wait on an explicit stack until an operator
+// of lower or equal precedence (all binary operators associate to the
+// left, as in the parser) or a closing paren arrives, so both stacks only
+// grow with the nesting depth of the input, not its length. Returns false
+// and fills error if the input is malformed or uses an unbound variable.
+bool stream_eval(Lexer* l, Environment* env, bool* result, char* error, size_t error_size) {
+    EvalStack s;
+    s.values = malloc(sizeof(bool) * INITIAL_STACK_CAPACITY);
+    s.value_count = 0;
+    s.value_capacity = INITIAL_STACK_CAPACITY;
+    s.ops = malloc(sizeof(StackOp) * INITIAL_STACK_CAPACITY);
+    s.op_count = 0;
+    s.op_capacity = INITIAL_STACK_CAPACITY;
+
+    bool expect_operand = true;
+    bool ok = true;
+
+    for (;;) {
+        Token* tok = lexer_next_token(l);
+        TokenType type = tok->type;
+
+        if (expect_operand) {
+            switch (type) {
+                case T_IDENT: {
+                    bool value;
+                    if (!environment_get(env, tok->literal, &value)) {
+                        snprintf(error, error_size, "undefined variable: %s", tok->literal);
+                        ok = false;
+                        break;
+                    }
+                    push_value(&s, value);
+                    expect_operand = false;
+                    break;
+                }
+                case T_TRUE:
+                case T_FALSE:
+                    push_value(&s, type == T_TRUE);
+                    expect_operand = false;
+                    break;
+                case T_NOT:
+                    push_op(&s, T_NOT, PREC_PREFIX);
+                    break;
+                case T_LPAREN:
+                    push_op(&s, T_LPAREN, PREC_LOWEST);
+                    break;
+                default:
+                    snprintf(error, error_size, "unexpected token '%s', expected an operand",
+                             tok->literal);
+                    ok = false;
+                    break;
+            }
+        } else if (binary_precedence(type) > PREC_LOWEST) {
+            int precedence = binary_precedence(type);
+            while (s.op_count > 0 && s.ops[s.op_count - 1].type != T_LPAREN &&
+                   s.ops[s.op_count - 1].precedence >= precedence) {
+                apply_top(&s);
+            }
+            push_op(&s, type, precedence);
+            expect_operand = true;
+        } else if (type == T_RPAREN || type == T_EOF) {
+            while (s.op_count > 0 && s.ops[s.op_count - 1].type != T_LPAREN) {
+                apply_top(&s);
+            }
+            if (type == T_RPAREN) {
+                if (s.op_count == 0) {
+                    snprintf(error, error_size, "unmatched ')'");
+                    ok = false;
+                } else {
+                    s.op_count--;
+                }
+            } else if (s.op_count > 0) {
+                snprintf(error, error_size, "missing ')'");
+                ok = false;
+            } else {
+                *result = s.values[0];
+                token_free(tok);
+                break;
+            }
+        } else {
+            snprintf(error, error_size, "unexpected token '%s', expected an operator",
+                     tok->literal);
+            ok = false;
+        }
+
+        token_free(tok);
+        if (!ok) break;
+    }
+
+    free(s.values);
+    free(s.ops);
+    return ok;
+}
@@ -0,0 +1,18 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "lexer.h"
+#include "environment.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+bool stream_eval(Lexer* l, Environment* env, bool* result, char* error, size_t error_size);
+
+#endif
@@ -11,6 +11,26 @@
 #include "lexer.h"
 #include "parser.h"
 #include "environment.h"
+#include "truthtable.h"
+#include "rules.h"
+#include "cnf.h"
+#include "ruleengine.h"
+#include "stream.h"
+#include "parallel.h"
+#include "sat.h"
+#include "dedup.h"
+#include "allsat.h"
+#include "backbone.h"
+#include "qbf.h"
+#include "optimize.h"
+#include "explain.h"
+#include "anf.h"
+#include "lutmap.h"
+#include "cache.h"
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 typedef struct {
     bool P, Q, R, S;
@@ -19,6 +39,26 @@ typedef struct {
     const char* desc;
 } TestCase;
 
+static int failures = 0;
+
+static Expression* parse_source(const char* source) {
+    Lexer* l = lexer_new(source);
+    Parser* p = parser_new(l);
+    Expression* expr = parser_parse_expression(p, PREC_LOWEST);
+    parser_free(p);
+    lexer_free(l);
+    return expr;
+}
+
+static void check(bool condition, const char* desc) {
+    if (condition) {
+        printf("PASS: %s\n", desc);
+    } else {
+        printf("FAIL: %s\n", desc);
+        failures++;
+    }
+}
+
 static void run_test_case(TestCase* tc) {
     Environment* env = environment_new();
     environment_set(env, "P", tc->P);
@@ -31,6 +71,7 @@ static void run_test_case(TestCase* tc) {
     Expression* expr = parser_parse_expression(p, PREC_LOWEST);
     
     if (p->error_count > 0) {
+        failures++;
         printf("FAIL: %s\n", tc->desc);
         printf("Parser errors:\n");
         for (int i = 0; i < p->error_count; i++) {
@@ -41,7 +82,17 @@ static void run_test_case(TestCase* tc) {
     
     bool result = expr->eval(expr, env);
     
+    bool streamed;
+    char error[100];
+    Lexer* sl = lexer_new(tc->expr);
+    if (!stream_eval(sl, env, &streamed, error, sizeof(error)) || streamed != result) {
+        failures++;
+        printf("FAIL: %s (streaming evaluator disagrees)\n", tc->desc);
+    }
+    lexer_free(sl);
+    
     if (result != tc->expected) {
+        failures++;
         printf("FAIL: %s\n", tc->desc);
         printf("Expected: %s\n", tc->expected ? "true" : "false");
         printf("Got: %s\n", result ? "true" : "false");
@@ -103,7 +154,1310 @@ void run_tests(void) {
     }
 }
 
+static void run_short_circuit_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "P", false);
+    environment_set(env, "Q", true);
+
+    // U is never defined, so evaluating it would abort the test run
+    Expression* expr = parse_source("P & U");
+    check(!expr->eval(expr, env), "Short-circuit AND skips right operand");
+    expr->free(expr);
+
+    expr = parse_source("Q | U");
+    check(expr->eval(expr, env), "Short-circuit OR skips right operand");
+    expr->free(expr);
+
+    expr = parse_source("P -> U");
+    check(expr->eval(expr, env), "Short-circuit IMPLIES skips consequent");
+    expr->free(expr);
+
+    environment_free(env);
+}
+
+static void run_adaptive_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "P", false);
+    environment_set(env, "Q", true);
+    environment_set(env, "R", true);
+
+    Expression* expr = parse_source("(Q | (R ^ Q)) & P");
+    for (int i = 0; i < 4096; i++) {
+        expr->eval(expr, env);
+    }
+    InfixExpression* root = (InfixExpression*)expr->node;
+    check(root->evaluations == 0 && root->left->type == EXPR_INFIX,
+          "Evaluation keeps no profile without ADAPTIVE_EVAL");
+
+    environment_set_setting(env, ADAPTIVE_EVAL, true);
+    for (int i = 0; i < 4096; i++) {
+        expr->eval(expr, env);
+    }
+    check(root->left->type == EXPR_IDENTIFIER, "Adaptive evaluation moves decisive leaf first");
+    check(!expr->eval(expr, env), "Adaptive evaluation preserves result");
+    expr->free(expr);
+
+    // The chain is one n-ary node whose decisive operand comes last
+    expr = parse_source("(Q & (R | Q) & ~(R ^ Q)) & P");
+    for (int i = 0; i < 4096; i++) {
+        expr->eval(expr, env);
+    }
+    NaryExpression* chain = (NaryExpression*)expr->node;
+    check(expr->type == EXPR_NARY && chain->count == 4 && chain->operands[0]->type == EXPR_IDENTIFIER &&
+          strcmp(((IdentifierExpression*)chain->operands[0]->node)->value, "P") == 0,
+          "Adaptive evaluation moves the decisive operand of a chain first");
+    check(!expr->eval(expr, env), "Adaptive evaluation of a chain preserves result");
+    expr->free(expr);
+
+    environment_free(env);
+}
+
+static void run_truthtable_tests(void) {
+    const char* source = "((P -> Q) & (R -> S)) <-> (~P | ~R)";
+    Expression* expr = parse_source(source);
+
+    // Brute-force count of satisfying rows to compare with the Gray-code walk
+    long long expected = 0;
+    for (int row = 0; row < 16; row++) {
+        Environment* env = environment_new();
+        environment_set(env, "P", row & 1);
+        environment_set(env, "Q", row & 2);
+        environment_set(env, "R", row & 4);
+        environment_set(env, "S", row & 8);
+        expected += expr->eval(expr, env);
+        environment_free(env);
+    }
+
+    FILE* out = tmpfile();
+    long long true_rows = truthtable_print(expr, out);
+    long lines = 0;
+    rewind(out);
+    for (int ch = fgetc(out); ch != EOF; ch = fgetc(out)) {
+        lines += ch == '\n';
+    }
+    fclose(out);
+
+    check(true_rows == expected, "Truth table counts satisfying rows");
+    check(lines == 18, "Truth table prints header, 16 rows and summary");
+    expr->free(expr);
+}
+
+static void run_rules_tests(void) {
+    char path[] = "/tmp/logos_rules_XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "# comment\nP & Q\n\n  \n~P | R\r\n");
+    fclose(file);
+
+    RuleSet* rules = rules_load(path);
+    check(rules && rules->count == 2, "Rules file skips comments and blank lines");
+    check(rules && rules->lines[1] == 5, "Rules file records line numbers");
+    check(rules && strcmp(rules->sources[1], "~P | R") == 0, "Rules file strips CRLF");
+    rules_free(rules);
+    remove(path);
+}
+
+static void run_cnf_tests(void) {
+    char path[] = "/tmp/logos_cnf_XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "c var 2 Q\np cnf 3 2\n1 -2\n 0 2 3 0\n");
+    fclose(file);
+
+    Cnf* cnf = cnf_load(path);
+    check(cnf && cnf->clause_count == 2 && cnf->var_count == 3, "DIMACS import reads header and clauses");
+    check(cnf && strcmp(cnf->var_names[0], "_x1") == 0 && strcmp(cnf->var_names[1], "Q") == 0,
+          "DIMACS import names variables from comments or _x<n>");
+
+    Environment* env = environment_new();
+    environment_set(env, "_x1", false);
+    environment_set(env, "Q", true);
+    int unbound;
+    check(cnf && cnf_eval(cnf, env, &unbound) == 0, "CNF evaluation finds falsified clause");
+    environment_set(env, "_x1", true);
+    check(cnf && cnf_eval(cnf, env, &unbound) == 1 && unbound == 1, "CNF evaluation with unbound variable");
+    environment_free(env);
+    cnf_free(cnf);
+
+    const char* malformed[] = {
+        "p cnf 3 -1\n1 0\n",
+        "p cnf -3 1\n1 0\n",
+        "p cnf 99999999999999999999 1\n1 0\n",
+        "p cnf\n1 0\n",
+        "c var 9999999999 Q\np cnf 1 1\n1 0\n",
+        "p cnf 1 1\n- 0\n",
+    };
+    bool rejected = true;
+    for (int i = 0; i < 6; i++) {
+        file = fopen(path, "w");
+        fputs(malformed[i], file);
+        fclose(file);
+        cnf = cnf_load(path);
+        rejected = rejected && cnf == NULL;
+        cnf_free(cnf);
+    }
+    check(rejected, "DIMACS import rejects negative or oversized counts");
+
+    // Export an expression and check the encoding agrees with eval once the
+    // auxiliary variables are fixed by unit propagation from the inputs
+    Expression* expr = parse_source("(P -> Q) <-> ~(R ^ P)");
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    cnf = cnf_from_circuit(c);
+    int* node_literals = calloc(c->size, sizeof(int));
+    int literal = cnf_encode(cnf, c, root, node_literals);
+    cnf_add_clause(cnf, &literal, 1);
+    check(cnf_write(cnf, path) == 0, "DIMACS export writes file");
+
+    Cnf* loaded = cnf_load(path);
+    check(loaded && loaded->clause_count == cnf->clause_count &&
+          strcmp(loaded->var_names[2], "R") == 0, "DIMACS export round-trips names and clauses");
+
+    bool consistent = true;
+    for (int row = 0; row < 8; row++) {
+        env = environment_new();
+        environment_set(env, "P", row & 1);
+        environment_set(env, "Q", row & 2);
+        environment_set(env, "R", row & 4);
+        uint64_t words[3] = { row & 1 ? ~0ULL : 0, row & 2 ? ~0ULL : 0, row & 4 ? ~0ULL : 0 };
+        uint64_t* values = malloc(sizeof(uint64_t) * c->size);
+        circuit_simulate(c, words, values);
+        for (int i = 0; i < c->size; i++) {
+            int lit = node_literals[i];
+            if (lit == 0 || c->nodes[i].op == CIRCUIT_VAR) continue;
+            int v = lit < 0 ? -lit : lit;
+            bool value = (values[i] & 1) == (lit > 0);
+            environment_set(env, loaded->var_names[v - 1], value);
+        }
+        if (cnf_eval(loaded, env, &unbound) != expr->eval(expr, env)) {
+            consistent = false;
+        }
+        free(values);
+        environment_free(env);
+    }
+    check(consistent, "Tseitin encoding agrees with evaluation");
+
+    free(node_literals);
+    cnf_free(loaded);
+    cnf_free(cnf);
+    circuit_free(c);
+    expr->free(expr);
+    remove(path);
+}
+
+static void run_rule_engine_tests(void) {
+    const char* sources[] = { "P & Q", "(P & Q) | R", "~(P & Q) -> S", "R ^ S" };
+    int count = sizeof(sources) / sizeof(sources[0]);
+    Expression* exprs[4];
+    RuleEngine* engine = rule_engine_new();
+    for (int i = 0; i < count; i++) {
+        exprs[i] = parse_source(sources[i]);
+        rule_engine_add(engine, exprs[i]);
+    }
+    // P, Q, R, S, (P & Q), the OR, NOT, IMPLIES and XOR
+    check(engine->circuit->size == 9, "Rule engine shares common subterms");
+
+    bool consistent = true;
+    for (int row = 0; row < 16; row++) {
+        Environment* env = environment_new();
+        environment_set(env, "P", row & 1);
+        environment_set(env, "Q", row & 2);
+        environment_set(env, "R", row & 4);
+        environment_set(env, "S", row & 8);
+        uint64_t bitmap = 0;
+        if (rule_engine_eval_env(engine, env, &bitmap)) consistent = false;
+        for (int i = 0; i < count; i++) {
+            if (((bitmap >> i) & 1) != exprs[i]->eval(exprs[i], env)) consistent = false;
+        }
+        environment_free(env);
+    }
+    check(consistent, "Rule engine bitmap matches individual evaluation");
+
+    for (int i = 0; i < count; i++) {
+        exprs[i]->free(exprs[i]);
+    }
+    rule_engine_free(engine);
+}
+
+static void run_partial_eval_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "P", true);
+    environment_set(env, "R", false);
+
+    Expression* expr = parse_source("(P & (Q | R)) ^ ~(S -> R)");
+    Expression* residual = expr->partial_eval(expr, env);
+    char* str = residual->string(residual);
+    check(strcmp(str, "(Q ^ S)") == 0, "Partial evaluation leaves residual over unbound variables");
+    free(str);
+
+    bool consistent = true;
+    for (int row = 0; row < 4; row++) {
+        Environment* full = environment_new();
+        environment_set(full, "P", true);
+        environment_set(full, "R", false);
+        environment_set(full, "Q", row & 1);
+        environment_set(full, "S", row & 2);
+        if (residual->eval(residual, full) != expr->eval(expr, full)) consistent = false;
+        environment_free(full);
+    }
+    check(consistent, "Residual agrees with full evaluation");
+    residual->free(residual);
+    expr->free(expr);
+
+    // U is unbound but irrelevant once R is known
+    expr = parse_source("R & U");
+    residual = expr->partial_eval(expr, env);
+    bool value;
+    check(expression_is_constant(residual, &value) && !value, "Partial evaluation short-circuits unbound operands");
+    residual->free(residual);
+    expr->free(expr);
+
+    environment_free(env);
+}
+
+static void run_stream_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "P", true);
+    environment_set(env, "a_long_variable_name_that_spans_buffer_refills", false);
+
+    // Long and deeply nested enough to cross many lexer window refills
+    FILE* file = tmpfile();
+    for (int i = 0; i < 2000; i++) fputc('(', file);
+    fputs("P", file);
+    for (int i = 0; i < 2000; i++) fputs(")", file);
+    for (int i = 0; i < 20000; i++) {
+        fputs(" & ~a_long_variable_name_that_spans_buffer_refills | false", file);
+    }
+    rewind(file);
+
+    Lexer* l = lexer_new_stream(file);
+    bool result = false;
+    char error[100];
+    check(stream_eval(l, env, &result, error, sizeof(error)) && result,
+          "Streaming evaluation of a large nested formula");
+    lexer_free(l);
+    fclose(file);
+
+    l = lexer_new("(P & Q");
+    check(!stream_eval(l, env, &result, error, sizeof(error)), "Streaming evaluation reports errors");
+    lexer_free(l);
+
+    environment_free(env);
+}
+
+static void check_parallel_parse(const char* source, const char* desc) {
+    Expression* serial = parse_source(source);
+    char* error;
+    Expression* parallel = parallel_parse_expression(source, strlen(source), 4, &error);
+
+    char* serial_str = serial->string(serial);
+    char* parallel_str = parallel ? parallel->string(parallel) : strdup("");
+    check(parallel && strcmp(serial_str, parallel_str) == 0, desc);
+
+    free(serial_str);
+    free(parallel_str);
+    serial->free(serial);
+    if (parallel) parallel->free(parallel);
+}
+
+static void run_parallel_tests(void) {
+    const char* pieces[] = { "(P -> Q)", "~R", "(S <-> (P ^ Q))", "P & Q", "R -> S", "Q <-> ~P" };
+    const char* ops[] = { " & ", " | ", " -> ", " ^ ", " <-> " };
+    size_t capacity = 1 << 18;
+    char* source = malloc(capacity);
+    strcpy(source, pieces[0]);
+    for (int i = 1; i < 4000; i++) {
+        strcat(source, ops[i % 5]);
+        strcat(source, pieces[i % 6]);
+    }
+    check_parallel_parse(source, "Parallel parse matches serial parse");
+
+    // Only a -> at the top level, each side built from many lower-level ops
+    char* wrapped = malloc(capacity * 2 + 8);
+    sprintf(wrapped, "(%s) -> ((%s))", source, source);
+    check_parallel_parse(wrapped, "Parallel parse splits at loosest top-level operator");
+
+    // All enclosing parens are stripped in one pass, but not a pair that
+    // closes early
+    int levels = 5000;
+    char* nested = malloc(strlen(source) + 2 * levels + 16);
+    memset(nested, '(', levels);
+    sprintf(nested + levels, " %s ", source);
+    memset(nested + strlen(nested), ')', levels);
+    nested[levels + strlen(source) + 2 + levels] = '\0';
+    check_parallel_parse(nested, "Parallel parse strips deeply nested enclosing parens");
+    check_parallel_parse("((P) & (Q | R))", "Parallel parse keeps parens that close early");
+    check_parallel_parse("( (P) )", "Parallel parse strips parens around a single operand");
+    free(nested);
+    free(wrapped);
+
+    char* error;
+    Expression* bad = parallel_parse_expression("P & (Q | R", 10, 4, &error);
+    check(!bad && error, "Parallel parse reports errors");
+    free(error);
+
+    ParseJob jobs[3] = { { "P & Q", 5, NULL, NULL, 0 }, { "~R", 2, NULL, NULL, 0 },
+                         { "P ->", 4, NULL, NULL, 0 } };
+    parallel_parse_lines(jobs, 3, 2);
+    check(jobs[0].formula && jobs[1].formula && !jobs[2].formula && jobs[2].error_count > 0,
+          "Parallel line parsing keeps per-line results");
+    for (int i = 0; i < 3; i++) {
+        if (jobs[i].formula) jobs[i].formula->free(jobs[i].formula);
+        for (int e = 0; e < jobs[i].error_count; e++) free(jobs[i].errors[e]);
+        free(jobs[i].errors);
+    }
+    free(source);
+}
+
+static void run_sat_tests(void) {
+    // Three pigeons in two holes: variable 2 * p + h + 1 puts pigeon p in hole h
+    SatSolver* s = sat_new();
+    for (int p = 0; p < 3; p++) {
+        int clause[] = { 2 * p + 1, 2 * p + 2 };
+        sat_add_clause(s, clause, 2);
+    }
+    for (int h = 0; h < 2; h++) {
+        for (int p = 0; p < 3; p++) {
+            for (int q = p + 1; q < 3; q++) {
+                int clause[] = { -(2 * p + h + 1), -(2 * q + h + 1) };
+                sat_add_clause(s, clause, 2);
+            }
+        }
+    }
+    check(!sat_solve(s, NULL, 0), "SAT solver refutes pigeonhole formula");
+    sat_free(s);
+
+    // (a | b) & (~a | c)
+    s = sat_new();
+    int c1[] = { 1, 2 }, c2[] = { -1, 3 };
+    sat_add_clause(s, c1, 2);
+    sat_add_clause(s, c2, 2);
+    int assume[] = { 1, -2 };
+    check(sat_solve(s, assume, 2) && sat_model_value(s, 1) && !sat_model_value(s, 2) &&
+          sat_model_value(s, 3), "SAT solver honours assumptions");
+    int conflicting[] = { 2, 1, -3 };
+    check(!sat_solve(s, conflicting, 3) && s->core_size == 2, "SAT solver reports failed assumptions");
+    check(sat_solve(s, NULL, 0), "SAT solver stays usable after failed assumptions");
+    sat_free(s);
+}
+
+static void run_dedup_tests(void) {
+    const char* sources[] = { "P & Q", "Q & P", "~(~P | ~Q)", "P | Q", "P -> Q",
+                              "~P | Q", "P ^ Q", "(P | Q) & ~(P & Q)", "P & ~P", "false" };
+    int expected[] = { 0, 0, 0, 3, 4, 4, 6, 6, 8, 8 };
+    int count = sizeof(sources) / sizeof(sources[0]);
+    Expression* exprs[10];
+    for (int i = 0; i < count; i++) {
+        exprs[i] = parse_source(sources[i]);
+    }
+
+    int representative[10];
+    int classes = dedup_formulas(exprs, count, representative);
+    check(classes == 5, "Dedup finds five equivalence classes");
+    bool grouped = true;
+    for (int i = 0; i < count; i++) {
+        if (representative[i] != expected[i]) grouped = false;
+    }
+    check(grouped, "Dedup groups equivalent formulas under the first one");
+
+    for (int i = 0; i < count; i++) {
+        exprs[i]->free(exprs[i]);
+    }
+}
+
+typedef struct {
+    signed char cubes[64][4];
+    int count;
+} CubeList;
+
+static void collect_cube(char** names, const signed char* cube, int var_count, void* data) {
+    CubeList* list = data;
+    for (int v = 0; v < 4; v++) {
+        list->cubes[list->count][v] = -1;
+    }
+    for (int v = 0; v < var_count; v++) {
+        list->cubes[list->count][names[v][0] - 'P'] = cube[v];
+    }
+    list->count++;
+}
+
+static void run_allsat_tests(void) {
+    const char* source = "(P & Q) | (~P & R) | (Q & S)";
+    Expression* expr = parse_source(source);
+    CubeList list = { .count = 0 };
+    long long cubes = allsat_enumerate(expr, collect_cube, &list);
+
+    // The cubes must cover exactly the models, each without redundant literals
+    bool exact = true;
+    for (int row = 0; row < 16; row++) {
+        Environment* env = environment_new();
+        environment_set(env, "P", row & 1);
+        environment_set(env, "Q", row & 2);
+        environment_set(env, "R", row & 4);
+        environment_set(env, "S", row & 8);
+        bool covered = false;
+        for (int k = 0; k < list.count; k++) {
+            bool inside = true;
+            for (int v = 0; v < 4; v++) {
+                if (list.cubes[k][v] >= 0 && list.cubes[k][v] != ((row >> v) & 1)) inside = false;
+            }
+            covered |= inside;
+        }
+        if (covered != expr->eval(expr, env)) exact = false;
+        environment_free(env);
+    }
+    check(exact, "ALLSAT cubes cover exactly the models");
+    check(cubes == list.count && cubes <= 4, "ALLSAT generalises models into few cubes");
+    expr->free(expr);
+
+    Expression* contradiction = parse_source("P & ~P");
+    list.count = 0;
+    check(allsat_enumerate(contradiction, collect_cube, &list) == 0, "ALLSAT finds no cube for a contradiction");
+    contradiction->free(contradiction);
+
+    Expression* valid = parse_source("true | P");
+    list.count = 0;
+    check(allsat_enumerate(valid, collect_cube, &list) == 1 && list.cubes[0][0] == -1,
+          "ALLSAT covers a valid formula with one empty cube");
+    valid->free(valid);
+
+    // Q | ~Q does not fold away, so only the solver can drop Q
+    Expression* tautology = parse_source("(P & (Q | ~Q)) | R");
+    list.count = 0;
+    bool single = allsat_enumerate(tautology, collect_cube, &list) == 2;
+    for (int k = 0; k < list.count; k++) {
+        int fixed = 0;
+        for (int v = 0; v < 4; v++) fixed += list.cubes[k][v] >= 0;
+        single = single && fixed == 1 && list.cubes[k][1] < 0;
+    }
+    check(single, "ALLSAT drops literals made redundant by a tautological residual");
+    tautology->free(tautology);
+}
+
+static void run_backbone_tests(void) {
+    // P and ~R are forced; Q and S are free
+    Expression* expr = parse_source("P & (P -> ~R) & (Q | S | R)");
+    Backbone* backbone = backbone_compute(expr);
+    int forced_p = -2, forced_r = -2, free_count = 0;
+    for (int v = 0; v < backbone->var_count; v++) {
+        if (strcmp(backbone->vars[v], "P") == 0) forced_p = backbone->values[v];
+        if (strcmp(backbone->vars[v], "R") == 0) forced_r = backbone->values[v];
+        free_count += backbone->values[v] < 0;
+    }
+    check(backbone->satisfiable && forced_p == 1 && forced_r == 0 && free_count == 2,
+          "Backbone finds forced and free variables");
+    backbone_free(backbone);
+    expr->free(expr);
+
+    Expression* contradiction = parse_source("P & ~P");
+    backbone = backbone_compute(contradiction);
+    check(!backbone->satisfiable, "Backbone reports unsatisfiable formulas");
+    backbone_free(backbone);
+
+    Environment* env = environment_new();
+    environment_set(env, "P", false);
+    environment_suggest(env, "P", true);
+    environment_suggest(env, "R", false);
+    bool value;
+    check(!environment_get(env, "R", &value) && environment_get_suggestion(env, "R", &value) && !value,
+          "Suggestions are kept apart from variables");
+    check(environment_accept_suggestions(env) == 1 && environment_get(env, "P", &value) && !value &&
+          environment_get(env, "R", &value) && !value && !environment_get_suggestion(env, "R", &value),
+          "Accepting suggestions sets only unset variables");
+    environment_free(env);
+    contradiction->free(contradiction);
+}
+
+static void run_qbf_tests(void) {
+    Expression* expr = parse_source("forall X . exists Y . X <-> Y & A");
+    char* str = expr->string(expr);
+    check(strcmp(str, "(forall X . (exists Y . (X <-> (Y & A))))") == 0,
+          "Quantifier body extends to the end of the expression");
+    free(str);
+
+    // Quantified variables shadow outer bindings and are restored after
+    Environment* env = environment_new();
+    environment_set(env, "X", false);
+    environment_set(env, "A", true);
+    check(expr->eval(expr, env) && qbf_eval(expr, env, NULL) == 1, "forall/exists hold when A is true");
+    bool x;
+    check(environment_get(env, "X", &x) && !x, "Quantifier restores the outer binding");
+    environment_set(env, "A", false);
+    check(!expr->eval(expr, env) && qbf_eval(expr, env, NULL) == 0, "forall/exists fail when A is false");
+    environment_free(env);
+    expr->free(expr);
+
+    const char* swapped_source = "exists Y . forall X . X <-> Y";
+    Expression* swapped = parse_source(swapped_source);
+    env = environment_new();
+    check(qbf_eval(swapped, env, NULL) == 0, "Quantifier order matters");
+    Expression* residual = parse_source("forall X . X | A");
+    Expression* partial = residual->partial_eval(residual, env);
+    str = partial->string(partial);
+    check(qbf_eval(residual, env, NULL) == -1 && strcmp(str, "A") == 0,
+          "Quantifiers over unbound free variables leave a residual");
+    free(str);
+    partial->free(partial);
+    residual->free(residual);
+    swapped->free(swapped);
+
+    // Bound variables are not variables of the circuit, so no command
+    // sees them
+    Expression* bound = parse_source("forall X . X | A");
+    Circuit* c = circuit_new();
+    circuit_add_expression(c, bound);
+    check(c->var_count == 1 && strcmp(c->vars[0], "A") == 0, "Bound variables stay out of the circuit");
+    circuit_free(c);
+
+    FILE* out = tmpfile();
+    check(truthtable_print(bound, out) == 1, "Truth table has no column for a bound variable");
+    long lines = 0;
+    rewind(out);
+    for (int ch; (ch = fgetc(out)) != EOF;) lines += ch == '\n';
+    fclose(out);
+    check(lines == 4, "Truth table of forall X . X | A has two rows");
+
+    Environment* bound_env = environment_new();
+    environment_set(bound_env, "A", true);
+    char* unbound = NULL;
+    Explanation* explanation = explain(bound, bound_env, &unbound);
+    check(explanation && explanation->var_count == 1, "EXPLAIN does not ask for a bound variable");
+    explanation_free(explanation);
+    free(unbound);
+    environment_free(bound_env);
+    bound->free(bound);
+
+    bound = parse_source("exists Y . Y & A");
+    Backbone* backbone = backbone_compute(bound);
+    check(backbone->var_count == 1 && strcmp(backbone->vars[0], "A") == 0 && backbone->values[0] == 1,
+          "Backbone does not report a bound variable as free");
+    backbone_free(backbone);
+    bound->free(bound);
+
+    // 30 universal and 30 existential variables, each Yi chosen per Xi
+    size_t capacity = 16384;
+    char* source = malloc(capacity);
+    strcpy(source, "forall");
+    for (int i = 0; i < 30; i++) sprintf(source + strlen(source), " X%d", i);
+    strcat(source, " . exists");
+    for (int i = 0; i < 30; i++) sprintf(source + strlen(source), " Y%d", i);
+    strcat(source, " .");
+    for (int i = 0; i < 30; i++) {
+        sprintf(source + strlen(source), "%s(X%d <-> Y%d ^ X%d)", i ? " & " : " ", i, i, (i + 1) % 30);
+    }
+    Expression* large = parse_source(source);
+    QbfStats stats;
+    check(qbf_eval(large, env, &stats) == 1 && stats.expansions <= 120,
+          "QBF with 60 quantified variables is decided without blowup");
+    large->free(large);
+    free(source);
+    environment_free(env);
+
+    check(parse_source("forall . X") == NULL && parse_source("exists X X") == NULL,
+          "Malformed quantifiers are parse errors");
+}
+
+static void count_improvement(long long cost, void* data) {
+    (void)cost;
+    (*(int*)data)++;
+}
+
+static void run_optimize_tests(void) {
+    Environment* env = environment_new();
+    environment_set_weight(env, "A", 5);
+    environment_set_weight(env, "B", 3);
+    environment_set_weight(env, "C", 4);
+    environment_set_weight(env, "D", 1);
+    check(environment_get_weight(env, "B") == 3 && environment_get_weight(env, "E") == 0,
+          "Environment stores weights");
+
+    // Brute force over the 16 assignments gives B & D at cost 4
+    Expression* expr = parse_source("(A | B) & (B -> C | D) & (A | D)");
+    int improvements = 0;
+    Optimum* optimum = optimize(expr, env, count_improvement, &improvements);
+    long long cost = 0;
+    Environment* model = environment_new();
+    for (int v = 0; v < optimum->var_count; v++) {
+        environment_set(model, optimum->vars[v], optimum->values[v]);
+        if (optimum->values[v]) cost += environment_get_weight(env, optimum->vars[v]);
+    }
+    check(optimum->satisfiable && optimum->cost == 4 && cost == 4 && expr->eval(expr, model),
+          "OPTIMIZE finds a minimum-cost model");
+    check(improvements >= 1, "OPTIMIZE reports improving solutions");
+    environment_free(model);
+    optimum_free(optimum);
+    expr->free(expr);
+
+    Expression* contradiction = parse_source("A & ~A");
+    optimum = optimize(contradiction, env, NULL, NULL);
+    check(!optimum->satisfiable, "OPTIMIZE reports unsatisfiable formulas");
+    optimum_free(optimum);
+    contradiction->free(contradiction);
+    environment_free(env);
+}
+
+// Whether the values marked known in the explanation fix its result for
+// every assignment of the other variables
+static bool fixes_result(Expression* expr, Explanation* e, const bool* known) {
+    Environment* env = environment_new();
+    bool fixed = true;
+    for (int bits = 0; fixed && bits < 1 << e->var_count; bits++) {
+        for (int v = 0; v < e->var_count; v++) {
+            environment_set(env, e->vars[v], known[v] ? e->values[v] : (bits >> v) & 1);
+        }
+        fixed = expr->eval(expr, env) == e->result;
+    }
+    environment_free(env);
+    return fixed;
+}
+
+// Whether the sufficient set fixes the result and no value can be dropped
+// from it
+static bool sufficient_is_minimal(Expression* expr, Explanation* e) {
+    bool* known = malloc(sizeof(bool) * (e->var_count + 1));
+    memcpy(known, e->sufficient, sizeof(bool) * e->var_count);
+    bool minimal = fixes_result(expr, e, known);
+    for (int v = 0; minimal && v < e->var_count; v++) {
+        if (!known[v]) continue;
+        known[v] = false;
+        minimal = !fixes_result(expr, e, known);
+        known[v] = true;
+    }
+    free(known);
+    return minimal;
+}
+
+static void run_explain_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "A", true);
+    environment_set(env, "B", false);
+    environment_set(env, "C", true);
+    environment_set(env, "D", false);
+
+    // (B -> D) already holds, as does (C & ~D), so no single flip matters
+    Expression* expr = parse_source("(A & B) | (C & ~D) | (B -> D)");
+    char* unbound;
+    Explanation* e = explain(expr, env, &unbound);
+    int critical = 0, sufficient = 0;
+    for (int v = 0; v < e->var_count; v++) {
+        critical += e->critical[v];
+        sufficient += e->sufficient[v];
+    }
+    check(e->result && critical == 0, "EXPLAIN finds no critical variable in a redundant formula");
+    // C alone fixes the result: with D false C & ~D holds, with D true so
+    // does B -> D
+    check(sufficient == 1 && sufficient_is_minimal(expr, e),
+          "EXPLAIN finds a minimal sufficient subset");
+    explanation_free(e);
+    expr->free(expr);
+
+    // A conjunction of 150 variables with only X77 false spans three lanes
+    // of 64 flips
+    char* source = malloc(4096);
+    source[0] = '\0';
+    for (int i = 0; i < 150; i++) {
+        char name[16];
+        sprintf(name, "X%d", i);
+        environment_set(env, name, i != 77);
+        sprintf(source + strlen(source), "%s%s", i ? " & " : "", name);
+    }
+    Expression* conjunction = parse_source(source);
+    e = explain(conjunction, env, &unbound);
+    bool only_x77 = !e->result;
+    for (int v = 0; v < e->var_count; v++) {
+        bool is_x77 = strcmp(e->vars[v], "X77") == 0;
+        if (e->critical[v] != is_x77 || e->sufficient[v] != is_x77) only_x77 = false;
+    }
+    check(only_x77, "EXPLAIN pins a false conjunction on its false variable");
+    check(e->passes <= 7, "EXPLAIN tests 64 flips or drops per pass");
+    explanation_free(e);
+    conjunction->free(conjunction);
+    free(source);
+
+    // Three-valued simulation cannot see that B is irrelevant once A is
+    // true, so the drop of B needs the SAT solver
+    Expression* tautology = parse_source(
+        "((B & A) & (A -> A)) ^ false ^ (((B | A) <-> (A ^ A)) | (~A <-> B))");
+    bool minimal = true, b_dropped = true;
+    for (int b = 0; b < 2; b++) {
+        environment_set(env, "B", b);
+        e = explain(tautology, env, &unbound);
+        minimal = minimal && sufficient_is_minimal(tautology, e);
+        for (int v = 0; v < e->var_count; v++) {
+            if (strcmp(e->vars[v], "B") == 0 && e->sufficient[v]) b_dropped = false;
+        }
+        explanation_free(e);
+    }
+    check(b_dropped, "EXPLAIN drops values that only three-valued simulation needs");
+    check(minimal, "EXPLAIN sufficient set is minimal under every assignment");
+    tautology->free(tautology);
+    environment_set(env, "B", false);
+
+    Expression* open = parse_source("A & E");
+    check(explain(open, env, &unbound) == NULL && strcmp(unbound, "E") == 0,
+          "EXPLAIN reports unbound variables");
+    free(unbound);
+    open->free(open);
+    environment_free(env);
+}
+
+static bool parses_to(const char* source, const char* expected) {
+    Expression* expr = parse_source(source);
+    if (!expr) return false;
+    char* str = expr->string(expr);
+    bool same = strcmp(str, expected) == 0;
+    if (!same) printf("  %s parsed as %s\n", source, str);
+    free(str);
+    expr->free(expr);
+    return same;
+}
+
+static void run_nary_tests(void) {
+    check(parses_to("A & B & C & (D & E)", "(A & B & C & D & E)"), "And chains parse to one n-ary node");
+    check(parses_to("A | B & C | D", "(A | (B & C) | D)"), "Or chains keep & operands whole");
+    check(parses_to("A & B", "(A & B)"), "Two operands stay binary");
+    check(parses_to("ATMOST(1, A, B | C, ~D)", "ATMOST(1, A, (B | C), (~D))"), "Cardinality operators parse");
+
+    const char* sized[] = { "A & B & C & (D & E)", "A | B & C | D", "~(A -> B)", "forall X . X | A" };
+    int sizes[] = { 6, 6, 4, 4 };
+    bool counted = true;
+    for (int i = 0; i < 4; i++) {
+        Expression* expr = parse_source(sized[i]);
+        counted = counted && expression_size(expr) == sizes[i];
+        expr->free(expr);
+    }
+    check(counted, "Subtree sizes are counted as nodes are built");
+
+    Lexer* l = lexer_new("ATMOST(2)");
+    Parser* p = parser_new(l);
+    check(!parser_parse_expression(p, PREC_LOWEST) && p->error_count > 0, "Cardinality needs operands");
+    parser_free(p);
+    lexer_free(l);
+
+    // Every constraint over five inputs against a direct count, through
+    // evaluation, partial evaluation with A bound, and circuit simulation
+    const char* names[] = { "ATMOST", "ATLEAST", "EXACTLY" };
+    TokenType types[] = { T_ATMOST, T_ATLEAST, T_EXACTLY };
+    Environment* env = environment_new();
+    Environment* partial = environment_new();
+    bool agree = true;
+    for (int t = 0; t < 3; t++) {
+        for (int k = 0; k <= 6; k++) {
+            char source[64];
+            sprintf(source, "%s(%d, A, B, C, D, E)", names[t], k);
+            Expression* expr = parse_source(source);
+            Circuit* c = circuit_new();
+            int root = circuit_add_expression(c, expr);
+            uint64_t words[5] = { 0 };
+            for (int row = 0; row < 32; row++) {
+                for (int v = 0; v < 5; v++) {
+                    if ((row >> v) & 1) words[v] |= 1ULL << row;
+                }
+            }
+            uint64_t* values = malloc(sizeof(uint64_t) * c->size);
+            circuit_simulate(c, words, values);
+
+            for (int row = 0; row < 32; row++) {
+                int count = __builtin_popcount(row);
+                bool expected = types[t] == T_ATMOST ? count <= k : types[t] == T_ATLEAST ? count >= k : count == k;
+                for (int v = 0; v < 5; v++) {
+                    char name[2] = { (char)('A' + v), '\0' };
+                    environment_set(env, name, (row >> v) & 1);
+                    if (v > 0) environment_set(partial, name, (row >> v) & 1);
+                }
+                environment_set(partial, "A", row & 1);
+                environment_unset(partial, "B");
+                Expression* residual = expr->partial_eval(expr, partial);
+                if (expr->eval(expr, env) != expected || residual->eval(residual, env) != expected ||
+                    (bool)((values[root] >> row) & 1) != expected) {
+                    agree = false;
+                }
+                residual->free(residual);
+            }
+            free(values);
+            circuit_free(c);
+            expr->free(expr);
+        }
+    }
+    check(agree, "Cardinality operators agree with a direct count");
+    environment_free(partial);
+    environment_free(env);
+
+    // 150 operands span three words of the packed count, and the
+    // totalizer keeps the circuit far from the binomial expansion
+    char* source = malloc(4096);
+    strcpy(source, "ATMOST(2");
+    for (int i = 0; i < 150; i++) {
+        sprintf(source + strlen(source), ", X%d", i);
+    }
+    strcat(source, ")");
+    Expression* wide = parse_source(source);
+    env = environment_new();
+    for (int i = 0; i < 150; i++) {
+        char name[16];
+        sprintf(name, "X%d", i);
+        environment_set(env, name, i == 3 || i == 140);
+    }
+    bool two = wide->eval(wide, env);
+    environment_set(env, "X70", true);
+    check(two && !wide->eval(wide, env), "Wide cardinality constraints count across words");
+    Circuit* c = circuit_new();
+    circuit_add_expression(c, wide);
+    check(c->size < 150 * 3 * 8, "Cardinality circuits grow linearly with the operand count");
+    circuit_free(c);
+    environment_free(env);
+    wide->free(wide);
+    free(source);
+
+    // The totalizer encoding goes through CNF to the SAT solver
+    Expression* formulas[] = {
+        parse_source("EXACTLY(1, A, B, C)"),
+        parse_source("(A | B | C) & ~(A & B) & ~(A & C) & ~(B & C)"),
+        parse_source("ATMOST(1, A, B, C)"),
+    };
+    int representative[3];
+    dedup_formulas(formulas, 3, representative);
+    check(representative[1] == 0 && representative[2] == 2, "Cardinality constraints are equivalent to their expansion");
+    for (int i = 0; i < 3; i++) formulas[i]->free(formulas[i]);
+}
+
+static bool anf_string_is(const char* source, const char* expected) {
+    Expression* expr = parse_source(source);
+    Anf* anf = anf_compute(expr);
+    Expression* polynomial = anf_to_expression(anf);
+    char* str = polynomial->string(polynomial);
+    bool same = strcmp(str, expected) == 0;
+    if (!same) printf("  ANF of %s: got %s, expected %s\n", source, str, expected);
+    free(str);
+    polynomial->free(polynomial);
+    anf_free(anf);
+    expr->free(expr);
+    return same;
+}
+
+static void run_anf_tests(void) {
+    check(anf_string_is("A | B", "(A ^ (B ^ (A & B)))"), "ANF of OR");
+    check(anf_string_is("A <-> B", "(true ^ (A ^ B))"), "ANF of IFF");
+    check(anf_string_is("A & ~A", "false"), "ANF of a contradiction");
+
+    // Twelve variables put half of them across words; the XOR chain has
+    // one term per variable and the product a single term
+    Expression* chain = parse_source("A ^ B ^ C ^ D ^ E ^ F ^ G ^ H ^ I ^ J ^ K ^ L");
+    Anf* anf = anf_compute(chain);
+    check(anf->term_count == 12 && anf->degree == 1, "ANF of an XOR chain is linear");
+    anf_free(anf);
+    chain->free(chain);
+    Expression* product = parse_source("~(A & B & C & D & E & F & G & H & I & J & K & L)");
+    anf = anf_compute(product);
+    check(anf->term_count == 2 && anf->degree == 12, "ANF of a NAND is 1 plus one product");
+    anf_free(anf);
+    product->free(product);
+
+    // The polynomial evaluates like the expression it came from
+    Expression* expr = parse_source("((A -> B) ^ (C | ~D)) <-> ((E & A) | (F ^ G ^ H)) | (B & ~G)");
+    anf = anf_compute(expr);
+    Expression* polynomial = anf_to_expression(anf);
+    Environment* env = environment_new();
+    bool agree = true;
+    for (int row = 0; row < 256; row++) {
+        for (int v = 0; v < anf->var_count; v++) {
+            environment_set(env, anf->vars[v], (row >> v) & 1);
+        }
+        if (expr->eval(expr, env) != polynomial->eval(polynomial, env)) agree = false;
+    }
+    check(agree, "ANF agrees with the expression on every assignment");
+    environment_free(env);
+    polynomial->free(polynomial);
+    anf_free(anf);
+    expr->free(expr);
+}
+
+static bool lutmap_agrees(const char* source, int k) {
+    Expression* expr = parse_source(source);
+    LutNetwork* net = lutmap(expr, k);
+    Environment* env = environment_new();
+    bool values[16];
+    bool agree = true;
+    for (int row = 0; row < (1 << net->var_count); row++) {
+        for (int v = 0; v < net->var_count; v++) {
+            values[v] = (row >> v) & 1;
+            environment_set(env, net->vars[v], values[v]);
+        }
+        if (expr->eval(expr, env) != lutmap_eval(net, values)) agree = false;
+    }
+    for (int i = 0; i < net->lut_count; i++) {
+        if (net->luts[i].input_count > k) agree = false;
+    }
+    environment_free(env);
+    lutmap_free(net);
+    expr->free(expr);
+    return agree;
+}
+
+static void run_lutmap_tests(void) {
+    const char* shared = "((A & B) | (C ^ D)) -> ((A & B) <-> (E | ~F)) & ((G -> H) ^ (C ^ D)) | (I & ~J & (A | J))";
+    check(lutmap_agrees(shared, 6), "6-input LUT mapping agrees with the expression");
+    check(lutmap_agrees(shared, 3), "3-input LUT mapping agrees with the expression");
+    check(lutmap_agrees("~A", 6) && lutmap_agrees("A", 6) && lutmap_agrees("A & ~A", 6),
+          "LUT mapping handles trivial results");
+
+    // Twelve inputs need at least three 6-input LUTs
+    Expression* chain = parse_source("A ^ B ^ C ^ D ^ E ^ F ^ G ^ H ^ I ^ J ^ K ^ L");
+    LutNetwork* net = lutmap(chain, 6);
+    check(net->lut_count == 3 && net->gate_count == 11, "An XOR chain of 12 inputs maps to 3 LUTs");
+    lutmap_free(net);
+    chain->free(chain);
+
+    Expression* small = parse_source("(A & B) | (C & ~D) | (B -> D)");
+    net = lutmap(small, 6);
+    check(net->lut_count == 1 && (net->luts[0].table & 0xFFFF) == 0xFFFB, "A 4-input formula is a single LUT");
+    lutmap_free(net);
+    small->free(small);
+}
+
+typedef struct {
+    EnvironmentReader* reader;
+    int pins;
+    bool stable;
+} SnapshotReader;
+
+static void* read_snapshots(void* arg) {
+    SnapshotReader* r = arg;
+    unsigned long last = 0;
+    for (int i = 0; i < r->pins; i++) {
+        Environment* view = environment_reader_pin(r->reader);
+        unsigned long version = environment_version(view);
+        bool first[40], again[40];
+        for (int v = 0; v < 40; v++) {
+            char name[16];
+            sprintf(name, "X%d", v);
+            environment_get(view, name, &first[v]);
+        }
+        for (int v = 0; v < 40; v++) {
+            char name[16];
+            sprintf(name, "X%d", v);
+            environment_get(view, name, &again[v]);
+        }
+        if (version < last || memcmp(first, again, sizeof(first)) != 0) r->stable = false;
+        last = version;
+        environment_reader_unpin(r->reader);
+    }
+    return NULL;
+}
+
+typedef struct {
+    EnvironmentReader* reader;
+    Expression* expr;
+    bool correct;
+} SharedEval;
+
+static void* eval_shared(void* arg) {
+    SharedEval* r = arg;
+    for (int i = 0; i < 5000; i++) {
+        Environment* view = environment_reader_pin(r->reader);
+        if (r->expr->eval(r->expr, view)) r->correct = false;
+        environment_reader_unpin(r->reader);
+    }
+    return NULL;
+}
+
+static void run_snapshot_tests(void) {
+    Environment* env = environment_new();
+    environment_set(env, "P", true);
+    EnvironmentReader* reader = environment_reader_new(env);
+
+    Environment* view = environment_reader_pin(reader);
+    environment_set(env, "P", false);
+    bool value;
+    check(environment_get(view, "P", &value) && value, "A pinned view keeps its version");
+    environment_set(view, "Q", true);
+    check(!environment_get(env, "Q", &value), "Writes to a view stay private");
+    environment_reader_unpin(reader);
+    view = environment_reader_pin(reader);
+    check(environment_get(view, "P", &value) && !value && !environment_get(view, "Q", &value),
+          "A new pin sees the latest version");
+    environment_reader_unpin(reader);
+
+    // A view has no weights and refuses new ones
+    view = environment_reader_pin(reader);
+    pid_t child = fork();
+    if (child == 0) {
+        freopen("/dev/null", "w", stderr);  // Keep the assertion message out of the report
+        environment_set_weight(view, "P", 3);
+        _exit(0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+    check(environment_get_weight(view, "P") == 0 && WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT,
+          "Setting a weight through a view is rejected");
+    environment_reader_unpin(reader);
+    environment_reader_free(reader);
+
+    // 40 variables span two chunks; readers check every pin is a consistent
+    // snapshot while the writer keeps flipping them
+    for (int v = 0; v < 40; v++) {
+        char name[16];
+        sprintf(name, "X%d", v);
+        environment_set(env, name, false);
+    }
+    SnapshotReader readers[4];
+    pthread_t threads[4];
+    for (int t = 0; t < 4; t++) {
+        readers[t] = (SnapshotReader){environment_reader_new(env), 2000, true};
+        pthread_create(&threads[t], NULL, read_snapshots, &readers[t]);
+    }
+    for (int i = 0; i < 4000; i++) {
+        char name[16];
+        sprintf(name, "X%d", i % 40);
+        environment_set(env, name, (i / 40) & 1);
+    }
+    bool stable = true;
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        stable = stable && readers[t].stable;
+        environment_reader_free(readers[t].reader);
+    }
+    check(stable, "Concurrent readers see stable snapshots while a writer publishes");
+    check(env->retired == NULL, "Retired versions are reclaimed once readers leave");
+
+    // Readers and the owner evaluate one expression at once; with readers
+    // registered nobody profiles or reorders it, even with ADAPTIVE_EVAL on
+    environment_set(env, "P", false);
+    environment_set(env, "Q", true);
+    environment_set(env, "R", true);
+    environment_set_setting(env, ADAPTIVE_EVAL, true);
+    Expression* shared = parse_source("(Q | (R ^ Q)) & P & (R | Q)");
+    SharedEval evaluators[4];
+    for (int t = 0; t < 4; t++) {
+        evaluators[t] = (SharedEval){environment_reader_new(env), shared, true};
+        pthread_create(&threads[t], NULL, eval_shared, &evaluators[t]);
+    }
+    bool correct = true;
+    for (int i = 0; i < 5000; i++) {
+        if (shared->eval(shared, env)) correct = false;
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+        correct = correct && evaluators[t].correct;
+        environment_reader_free(evaluators[t].reader);
+    }
+    NaryExpression* chain = (NaryExpression*)shared->node;
+    check(correct, "Concurrent readers evaluate one expression correctly");
+    check(chain->evaluations == 0 && chain->operands[0]->type == EXPR_INFIX,
+          "A shared expression is neither profiled nor reordered");
+    for (int i = 0; i < 4096; i++) {
+        shared->eval(shared, env);
+    }
+    check(chain->operands[0]->type == EXPR_IDENTIFIER,
+          "Adaptive evaluation resumes once the readers leave");
+    shared->free(shared);
+    environment_free(env);
+}
+
+static CacheKey cache_key_of(const char* source, CacheKind kind) {
+    Expression* expr = parse_source(source);
+    CacheKey key = cache_key(&expr, 1, kind);
+    expr->free(expr);
+    return key;
+}
+
+static bool cache_holds(ResultCache* cache, int i) {
+    CacheKey key = { { (uint64_t)i * 7919 + 1, (uint64_t)i * 104729 }, CACHE_DEDUP };
+    unsigned char* payload;
+    size_t length;
+    if (!cache_get(cache, &key, &payload, &length)) return false;
+    bool ok = length == sizeof(int) && memcmp(payload, &i, sizeof(int)) == 0;
+    free(payload);
+    return ok;
+}
+
+static void cache_store(ResultCache* cache, int i) {
+    CacheKey key = { { (uint64_t)i * 7919 + 1, (uint64_t)i * 104729 }, CACHE_DEDUP };
+    cache_put(cache, &key, (unsigned char*)&i, sizeof(int));
+}
+
+typedef struct {
+    const char* path;
+    int first;
+    atomic_int* waiting;  // Writers not yet started; all start together
+} CacheWriter;
+
+// Opens and closes its handle every 500 entries to check that closing one
+// descriptor leaves the locks of the other threads in place
+static void* write_cache(void* arg) {
+    CacheWriter* w = arg;
+    atomic_fetch_sub(w->waiting, 1);
+    while (atomic_load(w->waiting) > 0) {}
+    for (int round = 0; round < 8; round++) {
+        ResultCache* cache = cache_open(w->path);
+        for (int i = 0; i < 500; i++) {
+            cache_store(cache, w->first + round * 500 + i);
+        }
+        cache_close(cache);
+    }
+    return NULL;
+}
+
+static void run_cache_tests(void) {
+    CacheKey key = cache_key_of("(A & B) | ~C", CACHE_BACKBONE);
+    CacheKey same = cache_key_of("~C | (B & A)", CACHE_BACKBONE);
+    CacheKey other = cache_key_of("(A & B) | ~C", CACHE_OPTIMUM);
+    CacheKey renamed = cache_key_of("(A & D) | ~C", CACHE_BACKBONE);
+    check(memcmp(key.hash, same.hash, sizeof(key.hash)) == 0, "Cache: commuted operands share a key");
+    check(memcmp(key.hash, other.hash, sizeof(key.hash)) != 0, "Cache: query kind is part of the key");
+    check(memcmp(key.hash, renamed.hash, sizeof(key.hash)) != 0, "Cache: variable names are part of the key");
+
+    Expression* expr = parse_source("A | B");
+    Environment* env = environment_new();
+    CacheKey weighted = cache_key(&expr, 1, CACHE_OPTIMUM);
+    CacheKey unweighted = weighted;
+    cache_key_add_weights(&weighted, expr, env);
+    cache_key_add_weights(&unweighted, expr, env);
+    check(memcmp(weighted.hash, unweighted.hash, sizeof(weighted.hash)) == 0, "Cache: equal weights give equal keys");
+    environment_set_weight(env, "B", 3);
+    weighted = cache_key(&expr, 1, CACHE_OPTIMUM);
+    cache_key_add_weights(&weighted, expr, env);
+    check(memcmp(weighted.hash, unweighted.hash, sizeof(weighted.hash)) != 0, "Cache: weights are part of the key");
+    expr->free(expr);
+    environment_free(env);
+
+    char path[] = "/tmp/logos_cache_XXXXXX";
+    close(mkstemp(path));
+    ResultCache* cache = cache_open(path);
+    check(cache != NULL, "Cache: opens an empty file");
+
+    expr = parse_source("A & (A -> ~B) & (C | D)");
+    Backbone* backbone = backbone_compute(expr);
+    key = cache_key(&expr, 1, CACHE_BACKBONE);
+    check(cache_get_backbone(cache, &key) == NULL, "Cache: miss before the first put");
+    cache_put_backbone(cache, &key, backbone);
+    cache_close(cache);
+
+    // A new handle, as in a later run of logos
+    cache = cache_open(path);
+    Backbone* cached = cache_get_backbone(cache, &key);
+    bool same_backbone = cached && cached->satisfiable && cached->var_count == backbone->var_count &&
+                         cached->sat_calls == 0;
+    for (int v = 0; same_backbone && v < backbone->var_count; v++) {
+        same_backbone = strcmp(cached->vars[v], backbone->vars[v]) == 0 &&
+                        cached->values[v] == backbone->values[v];
+    }
+    check(same_backbone, "Cache: backbone survives reopening");
+    backbone_free(cached);
+    backbone_free(backbone);
+    expr->free(expr);
+
+    env = environment_new();
+    environment_set_weight(env, "A", 5);
+    environment_set_weight(env, "D", 1);
+    expr = parse_source("(A | B) & (A | D)");
+    Optimum* optimum = optimize(expr, env, NULL, NULL);
+    key = cache_key(&expr, 1, CACHE_OPTIMUM);
+    cache_key_add_weights(&key, expr, env);
+    cache_put_optimum(cache, &key, optimum);
+    Optimum* cached_optimum = cache_get_optimum(cache, &key);
+    bool same_optimum = cached_optimum && cached_optimum->cost == optimum->cost &&
+                        cached_optimum->var_count == optimum->var_count;
+    for (int v = 0; same_optimum && v < optimum->var_count; v++) {
+        same_optimum = strcmp(cached_optimum->vars[v], optimum->vars[v]) == 0 &&
+                       cached_optimum->values[v] == optimum->values[v];
+    }
+    check(same_optimum, "Cache: optimum round-trips");
+    optimum_free(cached_optimum);
+    optimum_free(optimum);
+    expr->free(expr);
+    environment_free(env);
+
+    // Enough entries to outgrow the initial index several times
+    for (int i = 0; i < 5000; i++) {
+        cache_store(cache, i);
+    }
+    bool all = true;
+    for (int i = 0; i < 5000; i++) {
+        all = all && cache_holds(cache, i);
+    }
+    check(all, "Cache: 5000 entries after the index grows");
+    check(!cache_holds(cache, 5000), "Cache: absent key misses");
+    cache_close(cache);
+
+    // Several processes writing at once lose nothing
+    for (int p = 0; p < 4; p++) {
+        if (fork() == 0) {
+            ResultCache* child = cache_open(path);
+            for (int i = 0; i < 2000; i++) {
+                cache_store(child, 10000 + p * 2000 + i);
+            }
+            cache_close(child);
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < 4; p++) {
+        wait(NULL);
+    }
+    cache = cache_open(path);
+    all = cache_holds(cache, 4999);
+    for (int i = 10000; i < 18000; i++) {
+        all = all && cache_holds(cache, i);
+    }
+    check(all, "Cache: concurrent writers from four processes");
+    cache_close(cache);
+
+    // Likewise threads with their own handles in one process
+    CacheWriter writers[4];
+    pthread_t threads[4];
+    atomic_int waiting = 4;
+    for (int t = 0; t < 4; t++) {
+        writers[t] = (CacheWriter){path, 20000 + t * 4000, &waiting};
+        pthread_create(&threads[t], NULL, write_cache, &writers[t]);
+    }
+    for (int t = 0; t < 4; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    cache = cache_open(path);
+    all = cache_holds(cache, 4999) && cache_holds(cache, 17999);
+    for (int i = 20000; i < 36000; i++) {
+        all = all && cache_holds(cache, i);
+    }
+    check(all, "Cache: concurrent writers from four threads");
+    cache_close(cache);
+
+    // A file written by another version is started afresh
+    FILE* file = fopen(path, "r+b");
+    uint32_t version = CACHE_VERSION + 1;
+    fseek(file, 8, SEEK_SET);
+    fwrite(&version, sizeof(version), 1, file);
+    fclose(file);
+    cache = cache_open(path);
+    check(cache && !cache_holds(cache, 1), "Cache: version mismatch discards old entries");
+    cache_store(cache, 1);
+    check(cache_holds(cache, 1), "Cache: usable after a reset");
+    cache_close(cache);
+    unlink(path);
+}
+
 int main(void) {
     run_tests();
-    return 0;
+    run_short_circuit_tests();
+    run_adaptive_tests();
+    run_truthtable_tests();
+    run_rules_tests();
+    run_cnf_tests();
+    run_rule_engine_tests();
+    run_partial_eval_tests();
+    run_stream_tests();
+    run_parallel_tests();
+    run_sat_tests();
+    run_dedup_tests();
+    run_allsat_tests();
+    run_backbone_tests();
+    run_qbf_tests();
+    run_optimize_tests();
+    run_explain_tests();
+    run_anf_tests();
+    run_lutmap_tests();
+    run_nary_tests();
+    run_snapshot_tests();
+    run_cache_tests();
+    printf("\n%d failure(s)\n", failures);
+    return failures > 0;
 }
\ No newline at end of file
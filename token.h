@@ -22,7 +22,15 @@ typedef enum {
     T_OR,
     T_XOR,
     T_IMPLIES,
-    T_IFF
+    T_IFF,
+    T_FORALL,
+    T_EXISTS,
+    T_DOT,
+    T_ATMOST,
+    T_ATLEAST,
+    T_EXACTLY,
+    T_INT,
+    T_COMMA
 } TokenType;
 
 typedef struct {
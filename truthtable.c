@@ -0,0 +1,182 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#include "truthtable.h"
+#include "circuit.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define OUTPUT_BUFFER_SIZE (1 << 22)
+
+typedef struct {
+    char* data;
+    size_t used;
+    FILE* out;
+} OutputBuffer;
+
+static void buffer_write(OutputBuffer* buf, const char* bytes, size_t len) {
+    if (buf->used + len > OUTPUT_BUFFER_SIZE) {
+        fwrite(buf->data, 1, buf->used, buf->out);
+        buf->used = 0;
+    }
+    // A header wider than the buffer (very long variable names) bypasses it
+    if (len > OUTPUT_BUFFER_SIZE) {
+        fwrite(bytes, 1, len, buf->out);
+        return;
+    }
+    memcpy(buf->data + buf->used, bytes, len);
+    buf->used += len;
+}
+
+// For every variable, the gates in its fanout cone in topological order.
+// These are the only nodes that can change when that variable flips.
+static int** build_cones(Circuit* c, int* cone_sizes) {
+    int** cones = malloc(sizeof(int*) * c->var_count);
+    bool* in_cone = malloc(sizeof(bool) * c->size);
+
+    for (int v = 0; v < c->var_count; v++) {
+        cones[v] = malloc(sizeof(int) * c->size);
+        cone_sizes[v] = 0;
+        for (int i = 0; i < c->size; i++) {
+            CircuitNode* n = &c->nodes[i];
+            switch (n->op) {
+                case CIRCUIT_CONST:
+                    in_cone[i] = false;
+                    break;
+                case CIRCUIT_VAR:
+                    in_cone[i] = n->a == v;
+                    break;
+                case CIRCUIT_NOT:
+                    in_cone[i] = in_cone[n->a];
+                    break;
+                default:
+                    in_cone[i] = in_cone[n->a] || in_cone[n->b];
+                    break;
+            }
+            if (in_cone[i] && n->op != CIRCUIT_VAR) {
+                cones[v][cone_sizes[v]++] = i;
+            }
+        }
+    }
+
+    free(in_cone);
+    return cones;
+}
+
+// Prints the truth table of expr, visiting assignments in Gray-code order
+// so that exactly one variable flips between consecutive rows. Only the
+// fanout cone of the flipped variable is re-evaluated, and propagation
+// stops at nodes whose value did not change. Returns the number of rows
+// for which the expression is true, or -1 if it has too many variables.
+long long truthtable_print(Expression* expr, FILE* out) {
+    Circuit* c = circuit_new();
+    int root = circuit_add_expression(c, expr);
+    int n = c->var_count;
+
+    if (n > TRUTHTABLE_MAX_VARS) {
+        fprintf(out, "Too many variables for a truth table (%d, max %d)\n",
+                n, TRUTHTABLE_MAX_VARS);
+        circuit_free(c);
+        return -1;
+    }
+
+    // Start from the all-false assignment
+    uint64_t* var_words = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+    uint64_t* values = malloc(sizeof(uint64_t) * c->size);
+    circuit_simulate(c, var_words, values);
+
+    int* var_nodes = malloc(sizeof(int) * (n > 0 ? n : 1));
+    for (int v = 0; v < n; v++) {
+        var_nodes[v] = -1;  // Variable folded away by simplification
+    }
+    for (int i = 0; i < c->size; i++) {
+        if (c->nodes[i].op == CIRCUIT_VAR) {
+            var_nodes[c->nodes[i].a] = i;
+        }
+    }
+
+    int* cone_sizes = malloc(sizeof(int) * (n > 0 ? n : 1));
+    int** cones = build_cones(c, cone_sizes);
+    unsigned long long* changed = calloc(c->size, sizeof(unsigned long long));
+
+    // Row template: one cell per variable, padded to the column width
+    int* offsets = malloc(sizeof(int) * (n > 0 ? n : 1));
+    size_t row_len = 0;
+    for (int v = 0; v < n; v++) {
+        offsets[v] = row_len;
+        row_len += strlen(c->vars[v]) + 1;
+    }
+    size_t result_offset = row_len + 2;
+    row_len = result_offset + 2;
+
+    char* row = malloc(row_len + 1);
+    char* header = malloc(row_len + 16);
+    memset(row, ' ', row_len);
+    memset(header, ' ', row_len);
+    for (int v = 0; v < n; v++) {
+        memcpy(header + offsets[v], c->vars[v], strlen(c->vars[v]));
+        row[offsets[v]] = 'F';
+    }
+    row[result_offset - 2] = '|';
+    row[row_len - 1] = '\n';
+    header[result_offset - 2] = '|';
+    memcpy(header + result_offset, "Result\n", 7);
+
+    OutputBuffer buf = { malloc(OUTPUT_BUFFER_SIZE), 0, out };
+    buffer_write(&buf, header, result_offset + 7);
+
+    unsigned long long rows = 1ULL << n;
+    long long true_rows = 0;
+    for (unsigned long long k = 0; k < rows; k++) {
+        if (k > 0) {
+            int v = __builtin_ctzll(k);
+            row[offsets[v]] = row[offsets[v]] == 'F' ? 'T' : 'F';
+
+            if (var_nodes[v] >= 0) {
+                values[var_nodes[v]] = ~values[var_nodes[v]];
+                changed[var_nodes[v]] = k;
+                for (int j = 0; j < cone_sizes[v]; j++) {
+                    int i = cones[v][j];
+                    CircuitNode* node = &c->nodes[i];
+                    if (changed[node->a] != k &&
+                        (node->op == CIRCUIT_NOT || changed[node->b] != k)) {
+                        continue;
+                    }
+                    uint64_t value = circuit_apply(node->op, values[node->a], values[node->b]);
+                    if (value != values[i]) {
+                        values[i] = value;
+                        changed[i] = k;
+                    }
+                }
+            }
+        }
+
+        bool result = values[root] & 1;
+        true_rows += result;
+        row[result_offset] = result ? 'T' : 'F';
+        buffer_write(&buf, row, row_len);
+    }
+
+    fwrite(buf.data, 1, buf.used, out);
+    fprintf(out, "%lld of %llu rows true\n", true_rows, rows);
+
+    for (int v = 0; v < n; v++) {
+        free(cones[v]);
+    }
+    free(cones);
+    free(cone_sizes);
+    free(changed);
+    free(offsets);
+    free(row);
+    free(header);
+    free(buf.data);
+    free(var_nodes);
+    free(values);
+    free(var_words);
+    circuit_free(c);
+    return true_rows;
+}
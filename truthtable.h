@@ -0,0 +1,18 @@
+/* Copyright (C) 2024 Ross Heaton
+
+   This program is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version. */
+
+#ifndef TRUTHTABLE_H
+#define TRUTHTABLE_H
+
+#include "ast.h"
+#include <stdio.h>
+
+#define TRUTHTABLE_MAX_VARS 40
+
+long long truthtable_print(Expression* expr, FILE* out);
+
+#endif